@@ -0,0 +1,154 @@
+#ifndef ASYNC_OPTIMIZER_H
+#define ASYNC_OPTIMIZER_H
+
+#include <deque>
+#include <exception>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <gtsam/inference/Key.h>
+#include <gtsam/nonlinear/NonlinearFactorGraph.h>
+#include <gtsam/nonlinear/Values.h>
+#include <gtsam/nonlinear/ISAM2.h>
+#include <gtsam_unstable/nonlinear/IncrementalFixedLagSmoother.h>
+
+namespace plane_slam
+{
+
+// Owns ISAM2 and runs its updates on a dedicated thread. New factors and values are
+// queued by the frontend, which goes on with the next keyframe. After each update the
+// worker collects the changed estimates, the frontend takes them when it wants them.
+// The mapper state is only written by the frontend thread taking the changes, tracking
+// and the publishers read it on that same thread, so no estimate is shared with the worker.
+// Only the variables an update moved are read back from ISAM2: new or relinearized ones,
+// and the ones whose delta changed, which includes the variables the back-substitution
+// moved below the re-eliminated cliques. They are kept if they moved beyond the
+// threshold. Every few updates the whole estimate is computed again, to drop the
+// removed variables.
+// In synchronous mode push() runs the update on the caller, as before.
+// With a lag the graph is an incremental fixed-lag smoother instead. Variables not in
+// a factor for longer than the lag are marginalized into priors on the window, their
+// last estimates stay. A factor on a marginalized variable brings it back into the
+// window from that estimate. The smoother keeps the timestamps of keys dropped by a
+// rekey or remove, so those are for the full-history graph only.
+// An update that throws is dropped, the graph may be left with part of it. The first
+// error is thrown again to the frontend by the next flush() or takeChanges(), or by the
+// push itself in synchronous mode.
+class AsyncOptimizer
+{
+public:
+    AsyncOptimizer();
+    ~AsyncOptimizer();
+
+    // Drops the queue and the graph, starts over with a new ISAM2, or a fixed-lag
+    // smoother if lag > 0
+    void reset( const gtsam::ISAM2Params &params, double lag = 0 );
+
+    bool isFixedLag() const { return smoother_ != 0; }
+    // Window of the smoother, in the unit of the timestamps
+    void setLag( double lag );
+
+    void setAsync( bool async );
+    bool isAsync() const { return async_; }
+
+    // Queue an update. All factors of the prune keys but the first are removed too,
+    // resolved against the graph at the time the update runs, after the factors of all
+    // updates queued before. The timestamp marks the variables of the factors as active
+    // in the fixed-lag window, < 0 for the latest.
+    void push( const gtsam::NonlinearFactorGraph &graph,
+               const gtsam::Values &values = gtsam::Values(),
+               const gtsam::FactorIndices &removed_factors = gtsam::FactorIndices(),
+               const gtsam::FastVector<gtsam::Key> &prune_keys = gtsam::FastVector<gtsam::Key>(),
+               double timestamp = -1 );
+
+    // Queue moving all factors of the old keys onto the new ones, resolved like the
+    // prune keys. An old key is dropped by ISAM2 once none of its factors is left.
+    void rekey( const std::map<gtsam::Key, gtsam::Key> &mapping );
+
+    // Queue an update removing all factors of the keys, resolved like the prune keys,
+    // the keys are dropped with them
+    void remove( const gtsam::FastVector<gtsam::Key> &keys,
+                 const gtsam::NonlinearFactorGraph &graph = gtsam::NonlinearFactorGraph() );
+
+    // Wait until the queue is drained, throws the error of a failed update
+    void flush();
+
+    // Estimates changed since the last call, the refreshed ones override the older.
+    // Throws the error of a failed update.
+    void takeChanges( gtsam::Values &changes );
+
+    inline void setRefreshThreshold( double threshold ) { refresh_threshold_ = threshold; }
+    inline void setFullRefreshInterval( int interval ) { full_refresh_interval_ = interval; }
+
+    // Direct access for graph surgery, waits for the queue first. Only the thread
+    // feeding the queue may use it.
+    const gtsam::ISAM2 *isam2();
+
+    bool empty();
+
+private:
+    struct Job
+    {
+        gtsam::NonlinearFactorGraph graph;
+        gtsam::Values values;
+        gtsam::FactorIndices removed_factors;
+        gtsam::FastVector<gtsam::Key> prune_keys;
+        gtsam::FastVector<gtsam::Key> remove_keys;
+        std::map<gtsam::Key, gtsam::Key> rekey;
+        double timestamp;
+
+        Job() : timestamp( -1 ) {}
+        inline bool resolvesKeys() const { return !prune_keys.empty() || !remove_keys.empty() || !rekey.empty(); }
+    };
+
+    // Run now if synchronous, else queue
+    void enqueue( const Job &job );
+
+    void run();
+
+    // Wait until the queue is drained
+    void wait();
+
+    // Throw the error of a failed update once, with the lock held
+    void rethrowError();
+
+    // Factor removals and replacements of the keys to resolve
+    void resolveKeys( Job &job );
+
+    void update( Job &job );
+
+    gtsam::ISAM2Result updateSmoother( Job &job );
+
+    // Read back the touched estimates into changed, or all of them
+    bool refresh( const gtsam::ISAM2Result &result, gtsam::Values &changed );
+
+    // Insert or overwrite
+    static void upsert( gtsam::Values &values, gtsam::Key key, const gtsam::Value &value );
+
+private:
+    gtsam::ISAM2 *isam2_;
+    gtsam::IncrementalFixedLagSmoother *smoother_;     // instead of isam2_
+    double latest_timestamp_;
+    bool async_;
+    gtsam::Values estimate_;    // last estimate kept per variable
+    gtsam::VectorValues last_delta_;    // of the last refresh
+    double refresh_threshold_;
+    int full_refresh_interval_;
+    int updates_since_refresh_;
+
+    // Queue
+    std::mutex mutex_;
+    std::condition_variable queue_condition_;
+    std::condition_variable idle_condition_;
+    std::deque<Job> queue_;
+    gtsam::Values changes_;     // not taken yet
+    std::exception_ptr error_;  // first failed update, not reported yet
+    bool busy_;
+    bool stop_;
+    std::thread worker_;
+};
+
+} // end of namespace plane_slam
+
+#endif // ASYNC_OPTIMIZER_H
@@ -0,0 +1,56 @@
+#ifndef COVISIBILITY_GRAPH_H
+#define COVISIBILITY_GRAPH_H
+
+#include <vector>
+#include <unordered_map>
+#include <gtsam/inference/Key.h>
+
+namespace plane_slam
+{
+
+// Keyframes linked by the landmarks they observe together, weighted by the number of
+// shared landmarks. Landmarks are the graph keys of the planes and keypoints, an
+// observation costs as many weight updates as the landmark has observers.
+class CovisibilityGraph
+{
+public:
+    CovisibilityGraph() {}
+
+    // False if already observed
+    bool addObservation( int frame, gtsam::Key landmark );
+
+    void removeObservation( int frame, gtsam::Key landmark );
+
+    void removeFrame( int frame );
+
+    void removeLandmark( gtsam::Key landmark );
+
+    // Observers of 'from' observe 'to' instead
+    void mergeLandmark( gtsam::Key from, gtsam::Key to );
+
+    void clear();
+
+    int weight( int frame1, int frame2 ) const;
+
+    // Keyframes sharing at least min_weight landmarks, heaviest first, at most max_count
+    void neighbours( int frame, int min_weight, int max_count, std::vector<int> &frames ) const;
+
+    // The keyframe, its neighbours and all landmarks they observe, sorted
+    void localMap( int frame, int min_weight, int max_neighbours,
+                   std::vector<int> &frames, std::vector<gtsam::Key> &landmarks ) const;
+
+    const std::vector<gtsam::Key> &landmarks( int frame ) const;
+
+    const std::vector<int> &observers( gtsam::Key landmark ) const;
+
+    inline int size() const { return frame_landmarks_.size(); }
+
+private:
+    std::unordered_map<int, std::vector<gtsam::Key> > frame_landmarks_;
+    std::unordered_map<gtsam::Key, std::vector<int> > landmark_frames_;
+    std::unordered_map<int, std::unordered_map<int, int> > weights_;
+};
+
+} // end of namespace plane_slam
+
+#endif // COVISIBILITY_GRAPH_H
@@ -0,0 +1,89 @@
+#ifndef DENSE_ODOMETRY_H
+#define DENSE_ODOMETRY_H
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <Eigen/Core>
+#include "frame.h"
+#include "utils.h"
+#include "worker_pool.h"
+
+namespace plane_slam
+{
+
+// Direct RGB-D odometry, photometric and depth error over an image pyramid.
+// Works on the organized downsampled cloud, which is kept after throttling memory.
+class DenseOdometry
+{
+public:
+    DenseOdometry();
+
+    // Motion maps target points into source frame, as the other tracking methods.
+    bool align( const Frame &source, const Frame &target, RESULT_OF_MOTION &result,
+                const Eigen::Matrix4d &estimated_transform = Eigen::Matrix4d::Identity() );
+
+    inline void setLevels( int levels ) { levels_ = levels; }
+    inline void setIterations( int iterations ) { iterations_ = iterations; }
+    inline void setThreads( int threads ) { threads_ = threads; }
+    inline void setDepthWeight( double weight ) { depth_weight_ = weight; }
+    inline void setIntensityHuber( double huber ) { intensity_huber_ = huber; }
+    inline void setDepthHuber( double huber ) { depth_huber_ = huber; }
+    inline void setMinPixels( int pixels ) { min_pixels_ = pixels; }
+    inline void setMaxRmse( double rmse ) { max_rmse_ = rmse; }
+    inline void setVerbose( bool verbose ) { verbose_ = verbose; }
+
+private:
+    struct Level
+    {
+        cv::Mat intensity;  // CV_32F, [0, 1]
+        cv::Mat depth;      // CV_32F, 0 for invalid
+        cv::Mat gradient_x;
+        cv::Mat gradient_y;
+        cv::Mat depth_gradient_x;
+        cv::Mat depth_gradient_y;
+        float fx, fy, cx, cy;
+    };
+
+    struct Pyramid
+    {
+        ros::Time stamp;
+        std::vector<Level> levels;
+    };
+
+    // Normal equations of one reduction
+    struct System
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        Eigen::Matrix<double, 6, 6> JtJ;
+        Eigen::Matrix<double, 6, 1> Jtr;
+        double error;
+        int count;
+    };
+
+    void buildPyramid( const Frame &frame, Pyramid &pyramid );
+
+    void reduce( const int level, const Eigen::Matrix4d &transform, System &system );
+
+    // Reduces the band of rows into systems[band]
+    void reduceRows( const int level, const Eigen::Matrix4d *transform,
+                     const int rows, const int band, System *systems );
+
+private:
+    bool verbose_;
+    int levels_;
+    int iterations_;
+    int threads_;
+    WorkerPool pool_;   // threads_ - 1 workers, the caller is the last one
+    double depth_weight_;
+    double intensity_huber_;
+    double depth_huber_;
+    int min_pixels_;
+    double max_rmse_;
+    // Buffers reused between frames, target pyramid becomes next source
+    Pyramid source_pyramid_;
+    Pyramid target_pyramid_;
+};
+
+} // end of namespace plane_slam
+
+#endif // DENSE_ODOMETRY_H
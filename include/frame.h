@@ -43,8 +43,10 @@ public:
     void extractORB();
     void lineBasedPlaneSegment();
     void organizedPlaneSegment();
+    void preprocessPlanes( PlanePreprocessor *preprocessor );
     inline void setId( int id ) { id_ = id; }
     int &id() {return id_;}
+    int id() const {return id_;}
     void throttleMemory();
 
     enum { VGA = 0, QVGA = 1, QQVGA = 2};
@@ -85,6 +87,8 @@ private:
 public:
     // Key frame
     bool key_frame_;
+    // Planes have voxelized inlier and hull, done by the frame workers
+    bool planes_preprocessed_;
     // Valid
     bool valid_;    // for first frame, valid is under the condition that the number of planes is not zero,
                     // for other frame, valid is under the condition that relative motion respect to previous frame is valid.
@@ -111,6 +115,7 @@ public:
     CameraParameters camera_params_;
     // Downsampling data
     PointCloudTypePtr cloud_downsampled_; //
+    NormalCloudPtr normal_cloud_;   // normals and curvature of cloud_downsampled_, shared by segmentation and icp
     cv::Mat visual_image_downsampled_; //
     CameraParameters camera_params_downsampled_;
     // Keypoint
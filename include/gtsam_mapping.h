@@ -48,6 +48,13 @@
 #include "frame.h"
 #include "viewer.h"
 #include "tracking.h"
+#include "plane_raster.h"
+#include "landmark_index.h"
+#include "plane_buckets.h"
+#include "async_optimizer.h"
+#include "covisibility_graph.h"
+#include "submap_graph.h"
+#include "rgbd_factors.h"
 
 using namespace std;
 using namespace gtsam;
@@ -55,6 +62,15 @@ using namespace gtsam;
 namespace plane_slam
 {
 
+// Observation of a plane landmark, the segment_planes_[plane_index] of the frame
+struct PlaneObservation
+{
+    int frame_id;
+    int plane_index;
+    bool merged;            // inlier already in the landmark cloud
+    gtsam::Pose3 pose;      // frame pose when merged
+};
+
 class GTMapping
 {
 public:
@@ -102,16 +118,21 @@ public:
     void saveOctomap( const std::string &filename = "octomap" );
     // Save graph
     inline void saveGraphDot( const std::string &filename = "plane_slam_graph.dot" ){
-        isam2_->saveGraph( filename );
+        optimizer_.isam2()->saveGraph( filename );
     }
     // Get optimized pose
     const tf::Transform &getOptimizedPoseTF() { return last_estimated_pose_tf_; }
     // Get optimized path
     std::vector<geometry_msgs::PoseStamped> getOptimizedPath();
     // Get landmarks
-    const std::map<int, PlaneType*> &getLandmark() { return landmarks_list_; }
-    const std::map<int, KeyPoint*> &getKeypointLandmark(){ return keypoints_list_; }
-    const std::map<int, Frame*> &getFrames() { return frames_list_; }
+    const SlotMap<PlaneType*> &getLandmark() { return landmarks_list_; }
+    const SlotMap<KeyPoint*> &getKeypointLandmark(){ return keypoints_list_; }
+    const SlotMap<Frame*> &getFrames() { return frames_list_; }
+    // Local map around the last keyframe, for pose-only tracking. Built on the first
+    // call after each keyframe.
+    const LocalMap &getLocalMap();
+    // Per plane preprocessing, shared with the frame workers
+    PlanePreprocessor *getPlanePreprocessor() { return &plane_preprocessor_; }
     // Get map cloud
     PointCloudTypePtr getMapCloud( bool force = false );
     PointCloudTypePtr getMapFullCloud( bool colored = false );
@@ -157,8 +178,21 @@ protected:
 
     bool isKeyFrame( Frame *frame );
 
+    // Timestamp of the frame in the unit of the fixed-lag window
+    double windowTime( Frame *frame ) const;
+
+    // Keyframe or spatial budget of the active submap reached
+    bool isSubmapFull( Frame *frame ) const;
+
+    // Move the active map into a finished submap, the next keyframe starts a new one
+    void closeSubmap();
+
     bool addFactorBetweenFrames( int previous_id, int id );
 
+    // Observation factors, the analytic RGB-D ones or the generic gtsam ones
+    void addPlaneFactor( const Eigen::Vector4d &coefficients, const Eigen::Vector3d &sigmas, Key pose_key, Key plane_key );
+    void addKeypointFactor( const gtsam::Point3 &point, Key pose_key, Key point_key );
+
     void semanticMapLabel();
 
     void labelPlane( PlaneType *plane );
@@ -189,17 +223,17 @@ protected:
                              const std::map<int, gtsam::Point3> &predicted_keypoints,
                              std::vector<int> &unmatched_landmarks,
                              vector<cv::DMatch> &good_matches );
-    static inline int hamming_distance_orb32x8_popcountll(const uint64_t* v1, const uint64_t* v2) {
-      return (__builtin_popcountll(v1[0] ^ v2[0]) + __builtin_popcountll(v1[1] ^ v2[1])) +
-             (__builtin_popcountll(v1[2] ^ v2[2]) + __builtin_popcountll(v1[3] ^ v2[3]));
-    }
     // Get predicted keypoints in FOV
+    // Only the keypoints of the covisible local map of the reference keyframe if >= 0
     void getPredictedKeypoints( const gtsam::Pose3 &pose,
                                 const CameraParameters & camera_param,
                                 std::map<int, pcl::PointUV> &predicted_feature_2d,
-                                std::map<int, gtsam::Point3> &predicted_feature_3d);
+                                std::map<int, gtsam::Point3> &predicted_feature_3d,
+                                int reference_frame = -1 );
     std::map<int, gtsam::Point3> getPredictedKeypoints( const gtsam::Pose3 &pose, const CameraParameters &camera_param );
     std::map<int, gtsam::OrientedPlane3> getPredictedObservation( const Pose3 &pose );
+    // Only the landmarks in the view frustum of the camera
+    std::map<int, gtsam::OrientedPlane3> getPredictedObservation( const Pose3 &pose, const CameraParameters &camera );
 
     void matchObservationWithPredicted( std::map<int, OrientedPlane3> &predicted_observations,
                                         const std::vector<OrientedPlane3> &observations,
@@ -207,13 +241,18 @@ protected:
                                         const Pose3 pose,
                                         std::vector<PlanePair> &pairs);
 
-    bool checkOverlap( const PointCloudTypePtr &landmark_cloud,
-                       const OrientedPlane3 &landmark,
-                       const PointCloudTypePtr &observation,
+    bool checkOverlap( const PlaneType &landmark,
+                       const PlaneType &observation,
                        const Pose3 &pose);
 
     bool checkLandmarksOverlap( const PlaneType &lm1, const PlaneType &lm2);
 
+    // Rebuild the occupancy raster after cloud_voxel changed
+    void updatePlaneRaster( PlaneType *plane );
+
+    // Raster of a plane, built into local for planes without one
+    const PlaneRaster &getPlaneRaster( const PlaneType &plane, PlaneRaster &local );
+
     bool refinePlanarMap();
 
     bool mergeFloorPlane();
@@ -223,12 +262,32 @@ protected:
     void computeLostKeypoints( std::vector<int> &unmatched_landmarks,
                                std::vector<int> &lost_landmarks );
 
-    void removeKeypoints( std::vector<int> &lost_landmarks, FactorIndices &removed_factors );
+    void removeKeypoints( std::vector<int> &lost_landmarks, FastVector<Key> &removed_keys );
 
     void mergeCoplanarLandmarks( std::map<int, std::set<int> > merge_list );
 
     void mergeLandmarkInlier( int from, int to );
 
+    // Pose to landmark factors of the graph go to the covisibility graph
+    void addCovisibility( const NonlinearFactorGraph &graph );
+
+    // Keypoints observed by the keyframe and its covisible neighbours
+    void getLocalKeypoints( int frame_id, std::vector<int> &ids );
+
+    // Keyframes of the recent window whose planes and keypoints are seen enough by the
+    // others. Their factors are swapped for odometry between their neighbours.
+    void cullKeyFrames( int frame_id );
+
+    // Keyframes observing the landmark besides frame_id and the culled ones
+    int otherObservers( gtsam::Key landmark, int frame_id, const std::set<int> &culled ) const;
+
+    // Observations of the planes of frame go to the landmark observation index
+    void addPlaneObservations( const Frame *frame );
+
+    // Merge the new observations into the landmark cloud, rebuild from all of its
+    // observations if forced or if a frame moved beyond the rebuild thresholds
+    void refreshLandmarkInlier( int id, bool rebuild = false );
+
     void projectAndDownsamplePlane( PlaneType *lm );
 
     bool removeLandmarksBadInlier();
@@ -239,6 +298,8 @@ protected:
 
     void updateOptimizedResult();
 
+    void updateLocalMap( int frame_id );
+
     void updateLandmarksInlier( int index = -1 );
 
     void updateOctoMap();
@@ -282,11 +343,12 @@ private:
 
     // ISAM2
     ISAM2Params isam2_parameters_;
-    ISAM2* isam2_;
+    AsyncOptimizer optimizer_;  // owns ISAM2
     // Create a Factor Graph and Values to hold the new data
     NonlinearFactorGraph factor_graph_; // factor graph
     Values initial_estimate_; // initial guess
     FactorIndices removed_factors_; // factors will be removed
+    FastVector<Key> removed_keys_;  // all factors but the first will be removed
     // Buffer
 //    NonlinearFactorGraph factor_graph_buffer_; // factor graph
 //    Values initial_estimate_buffer_; // initial guess
@@ -295,16 +357,24 @@ private:
     int next_plane_id_; // set identical id to plane
     int next_point_id_; // set identical id to point
     int next_frame_id_; // set identical id to frame
-    std::map<int, Frame*> frames_list_;     // frames list
-    std::map<int, PlaneType*> landmarks_list_;  // landmarks list
-    std::map<int, KeyPoint*> keypoints_list_;   // keypoints list
+    SlotMap<Frame*> frames_list_;     // frames list
+    SlotMap<PlaneType*> landmarks_list_;  // landmarks list
+    SlotMap<KeyPoint*> keypoints_list_;   // keypoints list
 //    std_vector_of_eigen_vector4f keypoints_vector_; // Assume keypoints_list_ has all keypoints
-    std::map<int, gtsam::Pose3> optimized_poses_list_;  // optimized pose list
-    std::map<int, gtsam::OrientedPlane3> optimized_landmarks_list_;    // optimized landmarks list
-    std::map<int, gtsam::Point3> optimized_keypoints_list_; // optimized keypoints list
+    SlotMap<gtsam::Pose3> optimized_poses_list_;  // optimized pose list
+    SlotMap<gtsam::OrientedPlane3> optimized_landmarks_list_;    // optimized landmarks list
+    SlotMap<gtsam::Point3> optimized_keypoints_list_; // optimized keypoints list
     //
     std::set<int> frames_optimized_;    // frames of which poses are optimized after optimization
     std::set<int> planes_optimized_;    // planes are optimized
+    SlotMap<std::vector<PlaneObservation> > landmark_observations_;   // landmark -> observations
+    CovisibilityGraph covisibility_;    // keyframes sharing landmarks
+    SlotMap<gtsam::BetweenFactor<gtsam::Pose3>::shared_ptr> odometry_factors_;  // to each keyframe from the one before
+    gtsam::KeySet linked_keys_; // poses with a between factor besides the odometry
+    gtsam::KeySet prior_keys_;  // variables anchored by a prior factor
+    SubmapGraph submaps_;   // finished submaps
+    int submap_first_frame_;    // of the active submap
+    gtsam::Pose3 submap_anchor_;
     //
     PointCloudTypePtr map_cloud_;
     PointCloudTypePtr keypoints_cloud_; // keypoints cloud for visualization
@@ -323,6 +393,8 @@ private:
     std::string map_frame_;
     gtsam::Pose3 last_estimated_pose_;
     tf::Transform last_estimated_pose_tf_;
+    LocalMap local_map_;
+    int local_map_keyframe_;    // keyframe of the local map still to build, or -1
     cv::RNG rng_;
 
     // Parameters
@@ -342,6 +414,9 @@ private:
     double isam2_relinearize_threshold_;
     int isam2_relinearize_skip_;
     ISAM2Params::Factorization isam2_factorization_;
+    bool use_fixed_lag_smoother_;   // applied on reset
+    double fixed_lag_window_;
+    bool fixed_lag_in_keyframes_;   // window in keyframes, else in seconds
     //
     int min_keypoint_correspondences_;
     double keypoint_match_search_radius_;
@@ -354,6 +429,8 @@ private:
     double plane_match_direction_threshold_;
     double plane_match_distance_threshold_;
     bool plane_force_inlier_update_;
+    double plane_inlier_rebuild_translation_;
+    double plane_inlier_rebuild_rotation_;
     bool plane_match_check_overlap_;
     double plane_match_overlap_alpha_;
     double plane_inlier_leaf_size_;
@@ -371,6 +448,12 @@ private:
     double wall_plane_angular_threshold_;
     bool remove_plane_bad_inlier_;
     double planar_bad_inlier_alpha_;
+    PlanePreprocessor plane_preprocessor_;
+    bool use_frustum_culling_;
+    double frustum_max_range_;
+    double frustum_margin_;
+    LandmarkIndex landmark_index_;
+    PlaneBuckets plane_buckets_;
     //
     double map_full_leaf_size_;
     bool map_full_remove_bad_inlier_;
@@ -384,6 +467,25 @@ private:
     bool publish_octomap_;
     bool publish_keypoint_cloud_;
     bool publish_optimized_path_;
+    double local_map_radius_;
+    //
+    bool keyframe_culling_;
+    int keyframe_culling_interval_;
+    int keyframe_culling_window_;
+    int keyframe_culling_min_observers_;
+    double keyframe_culling_redundancy_;
+    int last_culling_frame_;
+    //
+    bool use_covisibility_;
+    int covisibility_min_weight_;
+    int covisibility_max_neighbours_;
+    bool use_analytic_factors_;
+    //
+    bool use_submaps_;
+    int submap_max_keyframes_;
+    double submap_max_radius_;
+    int submap_hot_count_;
+    std::string submap_directory_;
 };
 
 } // end of namespace plane_slam
@@ -0,0 +1,50 @@
+#ifndef INTEGRAL_NORMAL_ESTIMATOR_H
+#define INTEGRAL_NORMAL_ESTIMATOR_H
+
+#include <Eigen/Core>
+#include "utils.h"
+
+namespace plane_slam
+{
+
+// Covariance normals of an organized cloud from integral images of the first and second moments.
+// The window shrinks at depth discontinuities like pcl::IntegralImageNormalEstimation.
+// Output normals point towards the viewpoint, curvature is lambda0 / (lambda0 + lambda1 + lambda2),
+// NaN where there is no valid estimate.
+class IntegralNormalEstimator
+{
+public:
+    IntegralNormalEstimator();
+
+    void compute( const PointCloudType &cloud, NormalCloud &normals );
+
+    // Window size in pixel, as pcl normal smoothing size
+    inline void setSmoothingSize( int size ) { smoothing_size_ = size; }
+    inline void setMaxDepthChangeFactor( float factor ) { max_depth_change_factor_ = factor; }
+
+private:
+    // count, x, y, z, xx, xy, xz, yy, yz, zz
+    enum { CHANNELS = 10 };
+    typedef Eigen::Matrix<double, CHANNELS, 1> Moments;
+
+    void computeIntegral( const PointCloudType &cloud );
+
+    // Chessboard distance to the nearest invalid pixel or depth discontinuity
+    void computeDistanceMap( const PointCloudType &cloud );
+
+private:
+    int smoothing_size_;
+    float max_depth_change_factor_;
+    // Buffers reused between frames
+    std::vector<double> integral_;          // (width+1) x (height+1) x CHANNELS
+    std::vector<unsigned short> distance_;  // width x height
+};
+
+// Remove inlier whose cached normal deviates from the plane or lies on a curved surface.
+// Inlier without a normal estimate are kept.
+void refinePlaneInlier( const NormalCloud &normals, PlaneType &plane,
+                        double angular_threshold, double max_curvature );
+
+} // end of namespace plane_slam
+
+#endif // INTEGRAL_NORMAL_ESTIMATOR_H
@@ -18,6 +18,16 @@ public:
                                            const double direction_threshold = 8.0,
                                            const double distance_threshold = 0.1);
 
+    // Overlap is checked on inlier indices into the organized clouds of the two frames
+    static bool euclidianPlaneCorrespondences(const vector<PlaneType> &planes,
+                                           const PointCloudType &cloud,
+                                           const vector<PlaneType> &last_planes,
+                                           const PointCloudType &last_cloud,
+                                           vector<PlanePair> &pairs,
+                                           const Eigen::Matrix4d &estimated_transform = Eigen::MatrixXd::Identity(4,4),
+                                           const double direction_threshold = 8.0,
+                                           const double distance_threshold = 0.1);
+
     bool iTreeAssociate(const vector<PlaneType> &measurements, const vector<PlaneType> &landmarks, vector<PlanePair> &pairs);
 
     void nearestNeighborAssociate(const vector<PlaneType> &measurements, const vector<PlaneType> &landmarks, vector<PlanePair> &pairs);
@@ -30,6 +40,11 @@ public:
 
     static bool checkPlanesOverlap( const PlaneType &lm1, const PlaneType &lm2, const double &overlap = 0.5);
 
+    // Same check without materialized clouds, inlier of both are projected onto lm1 plane
+    static bool checkPlanesOverlap( const PointCloudType &cloud1, const PlaneType &lm1,
+                                    const PointCloudType &cloud2, const PlaneType &lm2,
+                                    const double &overlap = 0.5);
+
     static void euclidianDistance(const PlaneType &p1, const PlaneType &p2, double &direction, double &distance);
 
     static void euclidianDistance(const PlaneCoefficients &p1, const PlaneCoefficients &p2, double &direction, double &distance);
@@ -95,6 +95,8 @@ public:
 
     bool trackFrameMotion( Frame* last_frame, Frame *frame );
 
+    bool trackLocalMap( Frame *frame );
+
     void recordVisualOdometry( Frame *last_frame, Frame *frame );
 
     void calculateOdomToMapTF( tf::Transform &map_tf, tf::Transform &odom_tf );
@@ -103,6 +105,8 @@ public:
 
     void storeKeyFrame( Frame* &last_frame, Frame* &frame );
 
+    void updateTemporalSeed( Frame *last_frame );
+
     void savePlaneLandmarks( const std::string &filename = "plane_slam_plane_landmarks.txt" );
 
     void saveKeypointLandmarks( const std::string &filename = "plane_slam_keypoint_landmarks.txt" );
@@ -214,12 +218,14 @@ private:
     ORBextractor* orb_extractor_;
     LineBasedPlaneSegmentor* line_based_plane_segmentor_;
     OrganizedPlaneSegmentor* organized_plane_segmentor_;
+    TemporalPlaneSeeder* temporal_seeder_;
     Viewer *viewer_;
     Tracking *tracker_;
     GTMapping *gt_mapping_;
 
     // Plane slam common parameters
     int plane_segment_method_;
+    bool use_temporal_segmentation_;
     bool do_visual_odometry_;
     bool do_mapping_;
     bool do_slam_;
@@ -0,0 +1,73 @@
+#ifndef LANDMARK_INDEX_H
+#define LANDMARK_INDEX_H
+
+#include <Eigen/Core>
+#include <stdint.h>
+#include <unordered_map>
+#include "utils.h"
+
+namespace plane_slam
+{
+
+// Bounding boxes of the landmark inlier hashed into a uniform grid, so association
+// only predicts the landmarks whose box meets the view frustum of the camera.
+// Landmarks without inlier yet or with a box over too many cells are always returned.
+class LandmarkIndex
+{
+public:
+    LandmarkIndex();
+
+    // (Re)insert with the box of the inlier in map frame
+    void update( int id, const PointCloudType &cloud );
+
+    void remove( int id );
+
+    void clear();
+
+    // Landmarks whose box, grown by margin, meets the frustum up to max_range,
+    // pose is the camera in map frame
+    void query( const Eigen::Matrix4d &pose, const CameraParameters &camera,
+                double max_range, double margin, std::vector<int> &ids ) const;
+
+    // Landmarks whose box comes within radius of the center
+    void queryRadius( const Eigen::Vector3f &center, double radius, std::vector<int> &ids ) const;
+
+    inline bool contains( int id ) const { return boxes_.find( id ) != boxes_.end(); }
+    inline int size() const { return boxes_.size(); }
+    // Rehashes the boxes already inserted
+    void setCellSize( double size );
+
+private:
+    struct Box
+    {
+        Eigen::Vector3f min, max;
+        bool bounded;       // false without inlier
+        std::vector<int64_t> cells;
+    };
+
+    inline int cell( float x ) const { return floor( x / cell_size_ ); }
+    static inline int64_t cellKey( int x, int y, int z )
+    {
+        // 21 bits per axis, offset to positive
+        return ((int64_t)(x + (1<<20)) << 42) | ((int64_t)(y + (1<<20)) << 21) | (int64_t)(z + (1<<20));
+    }
+
+    void insert( int id, Box &box );
+
+    // Sorted ids of the grid cells under the box
+    void candidates( const Eigen::Vector3f &min, const Eigen::Vector3f &max, std::vector<int> &ids ) const;
+
+    bool visible( const Box &box, const Eigen::Matrix3f &Rt, const Eigen::Vector3f &t,
+                  const Eigen::Vector3f *normals, double max_range, double margin ) const;
+
+private:
+    double cell_size_;
+    int max_cells_;
+    std::unordered_map<int, Box> boxes_;
+    std::unordered_map<int64_t, std::vector<int> > grid_;
+    std::vector<int> unbounded_;
+};
+
+} // end of namespace plane_slam
+
+#endif // LANDMARK_INDEX_H
@@ -6,6 +6,10 @@
 #include <plane_slam/LineBasedSegmentConfig.h>
 #include <line_based_plane_segmentation.h>
 #include "utils.h"
+#include "integral_normal_estimator.h"
+#include "temporal_plane_seeder.h"
+#include "plane_preprocessor.h"
+#include "worker_pool.h"
 
 namespace plane_slam
 {
@@ -13,14 +17,59 @@ namespace plane_slam
 class LineBasedPlaneSegmentor
 {
 public:
+    enum { LIBRARY = 0, BANDS = 1 };
+
     LineBasedPlaneSegmentor( ros::NodeHandle &nh );
     void updateLineBasedPlaneSegmentParameters();
     void operator()(PointCloudTypePtr &input, std::vector<PlaneType> &planes,
                     CameraParameters &camera_parameters);
+    // Refine inlier with normals computed by computeNormals(), shared with the frame
+    void operator()(PointCloudTypePtr &input, const NormalCloudPtr &normals, std::vector<PlaneType> &planes,
+                    CameraParameters &camera_parameters);
+    void computeNormals( const PointCloudTypePtr &input, NormalCloudPtr &normals );
+    inline void setTemporalSeeder( TemporalPlaneSeeder *seeder ) { temporal_seeder_ = seeder; }
+    inline TemporalPlaneSeeder *temporalSeeder() { return temporal_seeder_; }
+    inline void setPlanePreprocessor( PlanePreprocessor *preprocessor ) { plane_preprocessor_ = preprocessor; }
+    inline PlanePreprocessor *planePreprocessor() { return plane_preprocessor_; }
+    inline bool normalRefineInlier() const { return normal_refine_inlier_; }
 
 protected:
     void lineBasedSegmentReconfigCallback( plane_slam::LineBasedSegmentConfig &config, uint32_t level);
 
+private:
+    // Straight piece of a scanline with the moments of its points
+    struct LineSegment
+    {
+        int line;       // row of a horizontal, column of a vertical segment
+        int begin;      // first and last pixel along the line
+        int end;
+        int count;
+        Eigen::Vector3d sum;
+        Eigen::Matrix3d squared_sum;
+        Eigen::Vector3d centroid;
+        Eigen::Vector3d direction;
+    };
+
+    // Plane of connected coplanar segments
+    struct BandPlane
+    {
+        Eigen::Vector4d coefficients;
+        int u_min, u_max, v_min, v_max;     // search window in pixel
+        std::vector<int> segments;
+    };
+
+    // Scanline bands in parallel, stitched by crossing coplanar segments. Same result for any thread count.
+    void bandSegment( const PointCloudType &cloud, const NormalCloud &normals, std::vector<PlaneType> &planes );
+
+    // Task, rows and columns of band i into the line buffers of the band
+    void extractBandLines( const PointCloudType *cloud, int band, int bands );
+
+    void fitLineSegments( const PointCloudType &cloud, const std::vector<int> &indices, int line,
+                          std::vector<LineSegment> &segments );
+
+    // Task, nearest plane of each pixel in the rows of band i
+    void labelBand( const PointCloudType *cloud, const NormalCloud *normals, int rows, int band );
+
 private:
     ros::NodeHandle private_nh_;
     dynamic_reconfigure::Server<plane_slam::LineBasedSegmentConfig> line_based_segment_config_server_;
@@ -28,6 +77,10 @@ private:
     //
     CameraParameters camera_parameters_;
     line_based_plane_segment::LineBasedPlaneSegmentation plane_segmentor_;
+    IntegralNormalEstimator normal_estimator_;  // buffers reused between frames
+    NormalCloudPtr normal_cloud_;   // for callers without a normal cloud
+    TemporalPlaneSeeder *temporal_seeder_;  // not owned, NULL for full segmentation
+    PlanePreprocessor *plane_preprocessor_; // not owned, NULL leaves preprocessing to the mapper
     bool is_update_line_based_parameters_;
     //
     // LineBased segment
@@ -70,6 +123,21 @@ private:
     int normal_estimate_method_;
     float normal_estimate_depth_change_factor_;
     float normal_estimate_smoothing_size_;
+
+    /** \brief Band-parallel segmentation */
+    int segment_method_;
+    int segment_threads_;
+    WorkerPool pool_;   // segment_threads_ - 1 workers, the caller is the last one
+    std::vector< std::vector<LineSegment> > horizontal_lines_;  // per band, buffers reused between frames
+    std::vector< std::vector<LineSegment> > vertical_lines_;
+    std::vector<BandPlane> band_planes_;
+    std::vector<int> labels_;
+    std::vector<int> regions_;
+
+    /** \brief Inlier refinement with the normal cloud */
+    bool normal_refine_inlier_;
+    float normal_refine_angular_threshold_;
+    float normal_refine_max_curvature_;
 };
 
 } // end of namespace plane_slam
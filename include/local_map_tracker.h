@@ -0,0 +1,102 @@
+#ifndef LOCAL_MAP_TRACKER_H
+#define LOCAL_MAP_TRACKER_H
+
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/geometry/OrientedPlane3.h>
+#include <Eigen/Dense>
+#include "frame.h"
+#include "utils.h"
+
+namespace plane_slam
+{
+
+// Map state copied by the mapper after each optimization, never changed by tracking.
+struct LocalMap
+{
+    bool valid;
+    int frame_id;                           // reference keyframe
+    gtsam::Pose3 pose;                      // optimized pose of the reference keyframe
+    std::vector<int> keypoint_ids;
+    std::vector<gtsam::Point3> keypoints;   // in map frame
+    std::vector<uint64_t> descriptors;      // ORB, 4 words per keypoint
+    std::vector<int> plane_ids;
+    std::vector<gtsam::OrientedPlane3> planes;  // in map frame
+
+    LocalMap() : valid( false ), frame_id( -1 ) {}
+
+    void clear()
+    {
+        valid = false;
+        frame_id = -1;
+        keypoint_ids.clear();
+        keypoints.clear();
+        descriptors.clear();
+        plane_ids.clear();
+        planes.clear();
+    }
+};
+
+// Pose-only tracking of a frame against a local map of keypoints and planes.
+// Gauss-Newton over the camera pose with robust point and plane residuals, no ISAM2.
+class LocalMapTracker
+{
+public:
+    LocalMapTracker();
+
+    // Pose of frame in map frame, initial from frame to frame tracking
+    bool track( const Frame &frame, const LocalMap &map,
+                const gtsam::Pose3 &initial_pose, gtsam::Pose3 &pose );
+
+    inline void setSearchRadius( double radius ) { search_radius_ = radius; }
+    inline void setHammingThreshold( int threshold ) { hamming_threshold_ = threshold; }
+    inline void setIterations( int iterations ) { iterations_ = iterations; }
+    inline void setPointSigma( double sigma ) { point_sigma_ = sigma; }
+    inline void setPlaneSigmas( double direction, double distance ) { plane_direction_sigma_ = direction; plane_distance_sigma_ = distance; }
+    inline void setPlaneThresholds( double direction, double distance ) { plane_direction_threshold_ = direction; plane_distance_threshold_ = distance; }
+    inline void setHuber( double huber ) { huber_ = huber; }
+    inline void setMinInlier( int inlier ) { min_inlier_ = inlier; }
+    inline void setMaxCorrection( double translation, double rotation ) { max_translation_ = translation; max_rotation_ = rotation; }
+    inline void setVerbose( bool verbose ) { verbose_ = verbose; }
+
+private:
+    // Normal equations of one iteration
+    struct System
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        Eigen::Matrix<double, 6, 6> JtJ;
+        Eigen::Matrix<double, 6, 1> Jtr;
+        double error;
+        int point_inlier;
+        int plane_inlier;
+    };
+
+    void matchKeypoints( const Frame &frame, const LocalMap &map, const gtsam::Pose3 &pose );
+
+    void matchPlanes( const Frame &frame, const LocalMap &map, const gtsam::Pose3 &pose );
+
+    // Transform from map to camera
+    void reduce( const Frame &frame, const LocalMap &map, const Eigen::Matrix4d &transform, System &system );
+
+private:
+    bool verbose_;
+    double search_radius_;
+    int hamming_threshold_;
+    int iterations_;
+    double point_sigma_;
+    double plane_direction_sigma_;
+    double plane_distance_sigma_;
+    double plane_direction_threshold_;
+    double plane_distance_threshold_;
+    double huber_;
+    int min_inlier_;
+    double max_translation_;
+    double max_rotation_;
+    // Associations, (frame index, map index), buffers reused between frames
+    std::vector< std::pair<int, int> > keypoint_matches_;
+    std::vector< std::pair<int, int> > plane_matches_;
+    std::vector< std::vector<int> > keypoint_grid_;
+};
+
+} // end of namespace plane_slam
+
+#endif // LOCAL_MAP_TRACKER_H
@@ -6,6 +6,9 @@
 #include <dynamic_reconfigure/server.h>
 #include <plane_slam/OrganizedSegmentConfig.h>
 #include "utils.h"
+#include "integral_normal_estimator.h"
+#include "temporal_plane_seeder.h"
+#include "plane_preprocessor.h"
 
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
@@ -47,8 +50,17 @@ public:
     OrganizedPlaneSegmentor( ros::NodeHandle &nh );
     void updateOrganizedSegmentParameters();
     void operator()( const PointCloudTypePtr &input, std::vector<PlaneType> &planes );
+    // Segment with normals computed by computeNormals(), shared with the frame
+    void operator()( const PointCloudTypePtr &input, const NormalCloudPtr &normals, std::vector<PlaneType> &planes );
+    void computeNormals( const PointCloudTypePtr &input, NormalCloudPtr &normals );
+    inline void setTemporalSeeder( plane_slam::TemporalPlaneSeeder *seeder ) { temporal_seeder_ = seeder; }
+    inline plane_slam::TemporalPlaneSeeder *temporalSeeder() { return temporal_seeder_; }
+    inline void setPlanePreprocessor( plane_slam::PlanePreprocessor *preprocessor ) { plane_preprocessor_ = preprocessor; }
+    inline plane_slam::PlanePreprocessor *planePreprocessor() { return plane_preprocessor_; }
     void segment(const pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &input, VectorPlanarRegion &regions);
     void segment(const pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &input, OrganizedPlaneSegmentResult &result);
+    void segment(const pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &input, const NormalCloudPtr &normals,
+                 OrganizedPlaneSegmentResult &result);
 
 protected:
     void organizedSegmentReconfigCallback( plane_slam::OrganizedSegmentConfig &config, uint32_t level);
@@ -60,6 +72,10 @@ private:
     //
     // Organisized multiple planar segmentation
     pcl::IntegralImageNormalEstimation<pcl::PointXYZRGBA, pcl::Normal> ne_;
+    plane_slam::IntegralNormalEstimator integral_ne_;   // COVARIANCE_MATRIX method, buffers reused
+    NormalCloudPtr normal_cloud_;   // for callers without a normal cloud
+    plane_slam::TemporalPlaneSeeder *temporal_seeder_;  // not owned, NULL for full segmentation
+    plane_slam::PlanePreprocessor *plane_preprocessor_; // not owned, NULL leaves preprocessing to the mapper
     pcl::OrganizedMultiPlaneSegmentation<pcl::PointXYZRGBA, pcl::Normal, pcl::Label> mps_;
 
     //
@@ -0,0 +1,62 @@
+#ifndef PLANE_BUCKETS_H
+#define PLANE_BUCKETS_H
+
+#include <Eigen/Core>
+#include <stdint.h>
+#include <map>
+#include <unordered_map>
+#include "utils.h"
+
+namespace plane_slam
+{
+
+// Planes bucketed by their normal on a grid over the unit cube, cells as wide as the
+// chord of the merge angle, and kept sorted by offset d inside a bucket. Coplanar
+// candidates of a plane are then only read from the neighbouring buckets within a d range.
+class PlaneBuckets
+{
+public:
+    PlaneBuckets();
+
+    // Cell width from the largest angle queried, rehashes the planes already inserted
+    void setAngularResolution( double angle );
+
+    void update( int id, const Eigen::Vector4d &coefficients );
+
+    void remove( int id );
+
+    void clear();
+
+    // Planes whose normal is within angle and offset within distance, sorted by id
+    void query( const Eigen::Vector4d &coefficients, double angle, double distance, std::vector<int> &ids ) const;
+
+    inline int size() const { return entries_.size(); }
+
+private:
+    typedef std::multimap<double, int> Bucket;   // d -> id
+
+    struct Entry
+    {
+        Eigen::Vector3d normal;
+        int64_t cell;
+        Bucket::iterator item;
+    };
+
+    inline int cell( double x ) const { return floor( (x + 1.0) / cell_size_ ); }
+    static inline int64_t cellKey( int x, int y, int z )
+    {
+        return ((int64_t)x << 42) | ((int64_t)y << 21) | (int64_t)z;
+    }
+    int64_t cellKey( const Eigen::Vector3d &normal ) const;
+
+    void insert( int id, Entry &entry, double d );
+
+private:
+    double cell_size_;
+    std::unordered_map<int64_t, Bucket> buckets_;
+    std::unordered_map<int, Entry> entries_;
+};
+
+} // end of namespace plane_slam
+
+#endif // PLANE_BUCKETS_H
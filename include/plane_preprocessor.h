@@ -0,0 +1,52 @@
+#ifndef PLANE_PREPROCESSOR_H
+#define PLANE_PREPROCESSOR_H
+
+#include <Eigen/Core>
+#include <mutex>
+#include "utils.h"
+#include "worker_pool.h"
+
+namespace plane_slam
+{
+
+// Per plane preprocessing that only depends on the frame: voxelized inlier, bad inlier
+// removal, occupancy raster and the ordered convex hull of the boundary. Run by the
+// frame workers after segmentation, so the mapper receives planes ready to associate.
+class PlanePreprocessor
+{
+public:
+    PlanePreprocessor();
+
+    // Planes are processed in parallel, one task each. Without convex_hull the hull
+    // inlier of the segmentation is kept.
+    void process( const PointCloudType &cloud, std::vector<PlaneType> &planes, bool convex_hull = true );
+
+    void process( const PointCloudType &cloud, PlaneType &plane, bool convex_hull = true );
+
+    inline void setRunInFrame( bool run ) { run_in_frame_ = run; }
+    inline bool runInFrame() const { return run_in_frame_; }
+    inline void setLeafSize( double size ) { leaf_size_ = size; }
+    inline void setRemoveBadInlier( bool remove ) { remove_bad_inlier_ = remove; }
+    inline void setBadInlierAlpha( double alpha ) { bad_inlier_alpha_ = alpha; }
+    inline void setThreads( int threads ) { threads_ = threads; }
+
+private:
+    void processTask( const PointCloudType *cloud, std::vector<PlaneType> *planes, bool convex_hull, int index );
+
+private:
+    bool run_in_frame_;
+    double leaf_size_;
+    bool remove_bad_inlier_;
+    double bad_inlier_alpha_;
+    int threads_;
+    std::mutex mutex_;  // frame and mapper may both process
+    WorkerPool pool_;   // threads_ - 1 workers, the caller is the last one
+};
+
+// Convex hull of the boundary inlier on the plane, counter clockwise around the normal
+void computeHullInlier( const PointCloudType &cloud, const std::vector<int> &boundary,
+                        const Eigen::Vector4d &coefficients, std::vector<int> &hull );
+
+} // end of namespace plane_slam
+
+#endif // PLANE_PREPROCESSOR_H
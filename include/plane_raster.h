@@ -0,0 +1,45 @@
+#ifndef PLANE_RASTER_H
+#define PLANE_RASTER_H
+
+#include <Eigen/Core>
+#include <stdint.h>
+#include "utils.h"
+
+namespace plane_slam
+{
+
+// Occupancy bitmap of a plane's extent in its own 2D coordinates, one bit per cell and
+// 64 cells per word. Overlap of two planes maps the occupied cells of one raster into
+// the other and tests each against the occupied bits, without a scratch raster.
+class PlaneRaster
+{
+public:
+    PlaneRaster();
+
+    // Occupied cells of the points projected onto the plane
+    void build( const PointCloudType &cloud, const Eigen::Vector4d &coefficients, double resolution );
+
+    // Number of occupied cells of other that land on occupied cells of this raster,
+    // transform maps the frame of other into the frame of this raster
+    int intersect( const PlaneRaster &other, const Eigen::Matrix4d &transform = Eigen::Matrix4d::Identity() ) const;
+
+    // Ratio of the occupied cells of other that fall on occupied cells of this raster
+    double overlap( const PlaneRaster &other, const Eigen::Matrix4d &transform = Eigen::Matrix4d::Identity() ) const;
+
+    inline int count() const { return count_; }
+    inline bool empty() const { return count_ == 0; }
+
+private:
+    Eigen::Vector3d origin_;    // on the plane
+    Eigen::Vector3d u_;         // in-plane axes, u x v along the normal
+    Eigen::Vector3d v_;
+    double resolution_;
+    int u0_, v0_;               // cell of the first bit
+    int rows_, cols_, words_;   // words per row
+    std::vector<uint64_t> bits_;
+    int count_;
+};
+
+} // end of namespace plane_slam
+
+#endif // PLANE_RASTER_H
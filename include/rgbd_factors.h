@@ -0,0 +1,70 @@
+#ifndef RGBD_FACTORS_H
+#define RGBD_FACTORS_H
+
+#include <Eigen/Core>
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/geometry/Point3.h>
+#include <gtsam/geometry/OrientedPlane3.h>
+#include <gtsam/nonlinear/NonlinearFactor.h>
+
+namespace plane_slam
+{
+
+// Plane measured in the camera frame against a plane landmark in the world. The error is
+// the predicted normal in the tangent plane of the measured normal, and the distance.
+// The tangent basis and the whitening only depend on the measurement and are computed
+// once, the Jacobians are analytic and come out whitened, the noise model is unit.
+class RGBDPlaneFactor : public gtsam::NoiseModelFactor2<gtsam::Pose3, gtsam::OrientedPlane3>
+{
+public:
+    typedef boost::shared_ptr<RGBDPlaneFactor> shared_ptr;
+
+    RGBDPlaneFactor() {}
+
+    // Coefficients a, b, c, d of ax + by + cz + d = 0, sigmas of the normal and distance
+    RGBDPlaneFactor( const gtsam::Vector4 &coefficients, const gtsam::Vector3 &sigmas,
+                     gtsam::Key pose, gtsam::Key plane );
+
+    virtual gtsam::NonlinearFactor::shared_ptr clone() const;
+
+    virtual gtsam::Vector evaluateError( const gtsam::Pose3 &pose, const gtsam::OrientedPlane3 &plane,
+                                         boost::optional<gtsam::Matrix&> H1 = boost::none,
+                                         boost::optional<gtsam::Matrix&> H2 = boost::none ) const;
+
+    gtsam::Vector4 measured() const;
+
+private:
+    gtsam::Vector3 normal_;
+    double distance_;
+    gtsam::Vector3 basis1_, basis2_;    // tangent plane of the normal
+    gtsam::Vector3 sqrt_information_;   // 1/sigmas
+};
+
+// Point measured in the camera frame against a point landmark in the world, error in
+// the camera frame. The square root information is factored once from the covariance.
+class RGBDPointFactor : public gtsam::NoiseModelFactor2<gtsam::Pose3, gtsam::Point3>
+{
+public:
+    typedef boost::shared_ptr<RGBDPointFactor> shared_ptr;
+
+    RGBDPointFactor() {}
+
+    RGBDPointFactor( const gtsam::Point3 &measured, const Eigen::Matrix3d &covariance,
+                     gtsam::Key pose, gtsam::Key point );
+
+    virtual gtsam::NonlinearFactor::shared_ptr clone() const;
+
+    virtual gtsam::Vector evaluateError( const gtsam::Pose3 &pose, const gtsam::Point3 &point,
+                                         boost::optional<gtsam::Matrix&> H1 = boost::none,
+                                         boost::optional<gtsam::Matrix&> H2 = boost::none ) const;
+
+    const gtsam::Point3 &measured() const { return measured_; }
+
+private:
+    gtsam::Point3 measured_;
+    Eigen::Matrix3d sqrt_information_;  // upper triangular, R'R = covariance^-1
+};
+
+} // end of namespace plane_slam
+
+#endif // RGBD_FACTORS_H
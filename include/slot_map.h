@@ -0,0 +1,245 @@
+#ifndef SLOT_MAP_H
+#define SLOT_MAP_H
+
+#include <stdint.h>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <Eigen/Core>
+
+namespace plane_slam
+{
+
+// Id keyed container for the mapping state. Ids are small and handed out in increasing
+// order, so a slot per id points straight into a dense array of (id, value) kept sorted
+// by id. Lookup is O(1) and iteration walks contiguous memory in the order of std::map.
+// Erasing leaves a hole that iteration skips, so iterators stay valid on erase. Holes are
+// squeezed out by the next insert once they outnumber the live entries, inserting a new
+// id may therefore move entries and invalidates iterators and references.
+// A slot's generation is bumped whenever its entry goes away, so a Handle taken before
+// an erase or clear() no longer resolves even if the id is used again after reset.
+template <typename T>
+class SlotMap
+{
+public:
+    typedef std::pair<int, T> value_type;
+    // aligned, values may hold fixed size Eigen members
+    typedef std::vector<value_type, Eigen::aligned_allocator<value_type> > Dense;
+
+    struct Handle
+    {
+        int id;
+        uint32_t generation;
+    };
+
+    template <typename V, typename D>
+    class Iterator
+    {
+    public:
+        Iterator() : dense_( 0 ), index_( 0 ) {}
+        Iterator( D *dense, size_t index ) : dense_( dense ), index_( index ) { skip(); }
+        // iterator to const_iterator
+        template <typename V2, typename D2>
+        Iterator( const Iterator<V2, D2> &it ) : dense_( it.dense_ ), index_( it.index_ ) {}
+
+        V &operator*() const { return (*dense_)[index_]; }
+        V *operator->() const { return &(*dense_)[index_]; }
+        Iterator &operator++() { index_++; skip(); return *this; }
+        Iterator operator++( int ) { Iterator it = *this; ++(*this); return it; }
+        bool operator==( const Iterator &it ) const { return index_ == it.index_; }
+        bool operator!=( const Iterator &it ) const { return index_ != it.index_; }
+
+    private:
+        template <typename V2, typename D2> friend class Iterator;
+        friend class SlotMap;
+        void skip() { while( index_ < dense_->size() && (*dense_)[index_].first < 0 ) index_++; }
+
+        D *dense_;
+        size_t index_;
+    };
+
+    typedef Iterator<value_type, Dense> iterator;
+    typedef Iterator<const value_type, const Dense> const_iterator;
+
+    SlotMap() : size_( 0 ), holes_( 0 ), back_id_( -1 ) {}
+
+    inline int size() const { return size_; }
+    inline bool empty() const { return size_ == 0; }
+
+    inline iterator begin() { return iterator( &dense_, 0 ); }
+    inline iterator end() { return iterator( &dense_, dense_.size() ); }
+    inline const_iterator begin() const { return const_iterator( &dense_, 0 ); }
+    inline const_iterator end() const { return const_iterator( &dense_, dense_.size() ); }
+
+    inline iterator find( int id )
+    {
+        const int index = indexOf( id );
+        return index < 0 ? end() : iterator( &dense_, index );
+    }
+    inline const_iterator find( int id ) const
+    {
+        const int index = indexOf( id );
+        return index < 0 ? end() : const_iterator( &dense_, index );
+    }
+    inline int count( int id ) const { return indexOf( id ) < 0 ? 0 : 1; }
+
+    inline T &at( int id )
+    {
+        const int index = indexOf( id );
+        if( index < 0 )
+            throw std::out_of_range( "SlotMap::at" );
+        return dense_[index].second;
+    }
+    inline const T &at( int id ) const
+    {
+        const int index = indexOf( id );
+        if( index < 0 )
+            throw std::out_of_range( "SlotMap::at" );
+        return dense_[index].second;
+    }
+
+    // Default constructed value for a new id
+    T &operator[]( int id )
+    {
+        const int index = indexOf( id );
+        if( index >= 0 )
+            return dense_[index].second;
+        return dense_[insert( id )].second;
+    }
+
+    iterator erase( iterator it )
+    {
+        iterator next = it;
+        ++next;
+        eraseIndex( it.index_ );
+        return next;
+    }
+
+    int erase( int id )
+    {
+        const int index = indexOf( id );
+        if( index < 0 )
+            return 0;
+        eraseIndex( index );
+        return 1;
+    }
+
+    void clear()
+    {
+        for( size_t i = 0; i < dense_.size(); i++)
+        {
+            if( dense_[i].first >= 0 )
+                release( dense_[i].first );
+        }
+        dense_.clear();
+        size_ = 0;
+        holes_ = 0;
+        back_id_ = -1;
+    }
+
+    inline Handle handle( int id ) const
+    {
+        Handle h = { id, id < (int)slots_.size() ? slots_[id].generation : 0 };
+        return h;
+    }
+
+    // NULL if the entry of the handle was erased since
+    inline T *get( const Handle &h )
+    {
+        const int index = indexOf( h.id );
+        if( index < 0 || slots_[h.id].generation != h.generation )
+            return 0;
+        return &dense_[index].second;
+    }
+
+    // Squeeze out the holes, keeps the id order
+    void compact()
+    {
+        size_t n = 0;
+        for( size_t i = 0; i < dense_.size(); i++)
+        {
+            if( dense_[i].first < 0 )
+                continue;
+            if( n != i )
+                dense_[n] = dense_[i];
+            slots_[dense_[n].first].index = n;
+            n++;
+        }
+        dense_.resize( n );
+        holes_ = 0;
+        back_id_ = n ? dense_.back().first : -1;
+    }
+
+private:
+    struct Slot
+    {
+        int index;      // into dense, -1 if absent
+        uint32_t generation;
+    };
+
+    inline int indexOf( int id ) const
+    {
+        return id >= 0 && id < (int)slots_.size() ? slots_[id].index : -1;
+    }
+
+    inline void release( int id )
+    {
+        slots_[id].index = -1;
+        slots_[id].generation ++;
+    }
+
+    void eraseIndex( size_t index )
+    {
+        release( dense_[index].first );
+        dense_[index].first = -1;
+        dense_[index].second = T();
+        size_ --;
+        holes_ ++;
+    }
+
+    int insert( int id )
+    {
+        if( id < 0 )
+            throw std::out_of_range( "SlotMap: negative id" );
+        if( id >= (int)slots_.size() )
+        {
+            Slot empty = { -1, 0 };
+            slots_.resize( std::max( (size_t)id + 1, slots_.size() * 2 ), empty );
+        }
+        if( holes_ > 16 && holes_ > size_ )
+            compact();
+
+        size_ ++;
+        if( id > back_id_ )
+        {
+            // ids come in increasing order, the usual case
+            back_id_ = id;
+            slots_[id].index = dense_.size();
+            dense_.push_back( value_type( id, T() ) );
+            return slots_[id].index;
+        }
+
+        // Older id, keep the order
+        compact();
+        typename Dense::iterator pos = std::lower_bound( dense_.begin(), dense_.end(), id, lessId );
+        const size_t index = pos - dense_.begin();
+        dense_.insert( pos, value_type( id, T() ) );
+        for( size_t i = index; i < dense_.size(); i++)
+            slots_[dense_[i].first].index = i;
+        return index;
+    }
+
+    static inline bool lessId( const value_type &v, int id ) { return v.first < id; }
+
+private:
+    Dense dense_;
+    std::vector<Slot> slots_;
+    int size_;
+    int holes_;
+    int back_id_;   // largest id in dense
+};
+
+} // end of namespace plane_slam
+
+#endif // SLOT_MAP_H
@@ -0,0 +1,91 @@
+#ifndef SUBMAP_GRAPH_H
+#define SUBMAP_GRAPH_H
+
+#include <string>
+#include <vector>
+#include <geometry_msgs/PoseStamped.h>
+#include <octomap/OcTree.h>
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/geometry/OrientedPlane3.h>
+#include <gtsam/nonlinear/NonlinearFactorGraph.h>
+#include <gtsam/nonlinear/Values.h>
+#include <gtsam/linear/NoiseModel.h>
+#include "utils.h"
+#include "frame.h"
+
+namespace plane_slam
+{
+
+// Finished local map, moved out of the mapping when the next one starts. Its ISAM2 is
+// gone, the estimates are final in the frame the submap was built in.
+// A hot submap keeps everything in memory. A cold one only keeps the trajectory and the
+// plane coefficients, its map cloud and octree are written to disk if a directory is set.
+struct Submap
+{
+    Submap();
+    ~Submap();
+
+    // Drop the frames, landmarks and octree
+    void evict( const std::string &directory );
+
+    int id;
+    int first_frame;
+    int last_frame;
+    gtsam::Pose3 anchor;        // prior of the first keyframe, pose in the previous submap
+    gtsam::Pose3 first_pose;    // final estimate of the first keyframe
+    SlotMap<gtsam::Pose3> poses;
+    SlotMap<std_msgs::Header> headers;
+    SlotMap<gtsam::OrientedPlane3> planes;
+    // Hot only
+    bool hot;
+    SlotMap<Frame*> frames;
+    SlotMap<PlaneType*> landmarks;
+    SlotMap<KeyPoint*> keypoints;
+    SlotMap<gtsam::Point3> points;
+    PointCloudTypePtr cloud;    // colored landmark inlier
+    octomap::OcTree *octree;
+};
+
+// Top level pose graph of the submaps, a node per submap at its anchor. Consecutive
+// submaps are tied by the final pose of the first keyframe of the older one against the
+// anchor of the newer one. Corrections of the anchors place the finished submaps in the
+// frame of the active one, the one the tracking runs in.
+class SubmapGraph
+{
+public:
+    SubmapGraph() {}
+    ~SubmapGraph();
+
+    // Takes the submap, ties it to the previous one and optimizes
+    void add( Submap *submap, const gtsam::SharedNoiseModel &noise );
+
+    // Keep the newest hot_count submaps hot
+    void evict( int hot_count, const std::string &directory );
+
+    void clear();
+
+    // Transform from the frame of the submap to the frame of the active one
+    gtsam::Pose3 placement( const Submap &submap ) const;
+
+    // Landmark inlier of the hot submaps, placed
+    void getCloud( PointCloudType &cloud ) const;
+
+    // Keyframe poses of all submaps, placed
+    void getPath( std::vector<geometry_msgs::PoseStamped> &poses ) const;
+
+    inline int size() const { return submaps_.size(); }
+    inline const Submap &at( int id ) const { return *submaps_[id]; }
+
+private:
+    // Optimized anchor relative to the prior
+    gtsam::Pose3 correction( const Submap &submap ) const;
+
+private:
+    std::vector<Submap*> submaps_;
+    gtsam::NonlinearFactorGraph graph_;
+    gtsam::Values estimate_;
+};
+
+} // end of namespace plane_slam
+
+#endif // SUBMAP_GRAPH_H
@@ -0,0 +1,67 @@
+#ifndef TEMPORAL_PLANE_SEEDER_H
+#define TEMPORAL_PLANE_SEEDER_H
+
+#include <Eigen/Core>
+#include "utils.h"
+
+namespace plane_slam
+{
+
+// Incremental segmentation, planes of the last frame are predicted into the new frame,
+// verified over their projected masks and grown. Only the unexplained pixels are left
+// for full segmentation.
+class TemporalPlaneSeeder
+{
+public:
+    TemporalPlaneSeeder();
+
+    // Motion maps points of the next frame into the last frame, as RESULT_OF_MOTION
+    void setSeed( const std::vector<PlaneType> &planes, const PointCloudType &cloud,
+                  const Eigen::Matrix4d &motion );
+
+    void clear();
+
+    inline bool isValid() const { return !seeds_.empty(); }
+
+    // Append verified planes, returns valid pixels left in remaining()
+    int seed( const PointCloudType &cloud, const NormalCloud &normals,
+              const CameraParameters &camera, std::vector<PlaneType> &planes );
+
+    // Input cloud with the explained pixels set to NaN
+    inline const PointCloudTypePtr &remaining() const { return remaining_; }
+
+    inline void setSeedDistanceThreshold( double distance ) { seed_distance_threshold_ = distance; }
+    inline void setDistanceThreshold( double distance ) { distance_threshold_ = distance; }
+    inline void setAngularThreshold( double angle ) { angular_threshold_ = angle; }
+    inline void setNeighborThreshold( double distance ) { neighbor_threshold_ = distance; }
+    inline void setMinSupport( double ratio ) { min_support_ = ratio; }
+    inline void setMinInlier( int inlier ) { min_inlier_ = inlier; }
+    inline int minInlier() const { return min_inlier_; }
+    inline void setVerbose( bool verbose ) { verbose_ = verbose; }
+
+private:
+    struct Seed
+    {
+        Eigen::Vector4d coefficients;           // in the next frame
+        std::vector<Eigen::Vector3f> points;    // inlier, in the next frame
+    };
+
+private:
+    bool verbose_;
+    double seed_distance_threshold_;
+    double distance_threshold_;
+    double angular_threshold_;
+    double neighbor_threshold_;
+    double min_support_;
+    int min_inlier_;
+    std::vector<Seed> seeds_;
+    // Buffers reused between frames
+    std::vector<int> regions_;
+    std::vector<int> projected_;
+    std::vector<int> queue_;
+    PointCloudTypePtr remaining_;
+};
+
+} // end of namespace plane_slam
+
+#endif // TEMPORAL_PLANE_SEEDER_H
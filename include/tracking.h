@@ -11,12 +11,18 @@
 #include "utils.h"
 #include "itree.h"
 #include "viewer.h"
+#include "dense_odometry.h"
+#include "local_map_tracker.h"
+#include "worker_pool.h"
 
 namespace plane_slam
 {
 
 class Tracking
 {
+public:
+    enum { Exhaustive = 0, Guided = 1 }; // define plane triple search method
+
 public:
     Tracking(ros::NodeHandle &nh, Viewer * viewer );
 
@@ -26,14 +32,30 @@ public:
     bool track( const Frame &source, const Frame &target, RESULT_OF_MOTION &motion,
                 const Eigen::Matrix4d estimated_transform = Eigen::MatrixXd::Identity(4,4) );
 
-    void findPlaneCorrespondence( const std::vector<PlaneType> *planes,
-                                  const std::vector<PlaneType> *last_planes,
+    void findPlaneCorrespondence( const Frame *source, const Frame *target,
                                   const Eigen::Matrix4d estimated_transform,
                                   std::vector<PlanePair> *pairs );
 
     void findKeypointCorrespondence( const Frame *source, const Frame *target, std::vector<cv::DMatch> *good_matches );
 
-    void inline setVerbose( bool verbose ) { verbose_ = verbose; }
+    // Predicted motion of target respect to source, constant velocity if source is the last tracked frame,
+    // otherwise the given estimate if any.
+    bool predictMotion( const Frame &source, const Frame &target,
+                        const Eigen::Matrix4d &estimated_transform,
+                        gtsam::Pose3 &prior );
+
+    // Constant velocity motion of the frame after source, same interval as the last one
+    bool predictNextMotion( const Frame &source, gtsam::Pose3 &prior );
+
+    void updateVelocity( const Frame &source, const Frame &target, const RESULT_OF_MOTION &motion );
+
+    inline bool isLocalMapTracking() const { return use_local_map_tracking_; }
+
+    // Pose-only refinement against the local map, between keyframes
+    bool trackLocalMap( const Frame &frame, const LocalMap &map,
+                        const gtsam::Pose3 &initial_pose, gtsam::Pose3 &pose );
+
+    void inline setVerbose( bool verbose ) { verbose_ = verbose; dense_odometry_.setVerbose( verbose ); local_map_tracker_.setVerbose( verbose ); }
 
     void saveRuntimes( const std::string &filename );
 
@@ -46,6 +68,12 @@ public:
                                        RESULT_OF_MOTION &result,
                                        std::vector<PlanePair> &return_inlier );
 
+    bool solveRelativeTransformPlanesGuided( const Frame &source,
+                                             const Frame &target,
+                                             const std::vector<PlanePair> &pairs,
+                                             RESULT_OF_MOTION &result,
+                                             std::vector<PlanePair> &return_inlier );
+
     bool solveRelativeTransformPlanesPointsRansac( const Frame &source,
                                                    const Frame &target,
                                                    const std::vector<PlanePair> &pairs,
@@ -70,6 +98,16 @@ public:
                                     const Frame &target,
                                     RESULT_OF_MOTION &result);
 
+    bool solveRelativeTransformProjectiveIcp( const Frame &source,
+                                              const Frame &target,
+                                              RESULT_OF_MOTION &result,
+                                              const Eigen::Matrix4d &estimated_transform = Eigen::Matrix4d::Identity() );
+
+    bool solveRelativeTransformDense( const Frame &source,
+                                      const Frame &target,
+                                      RESULT_OF_MOTION &result,
+                                      const Eigen::Matrix4d &estimated_transform = Eigen::Matrix4d::Identity() );
+
     bool solveRelativeTransformPnP( const Frame& source,
                                     const Frame& target,
                                     const std::vector<cv::DMatch> &good_matches,
@@ -96,16 +134,24 @@ public:
                              double good_match_threshold = 4.0,
                              int min_match_size = 0);
 
+    // Search only around the location predicted by prior
+    void matchImageFeaturesWindow( const Frame& source,
+                                   const Frame& target,
+                                   const Eigen::Matrix4d &prior,
+                                   vector< cv::DMatch > &good_matches,
+                                   double good_match_threshold = 4.0,
+                                   int min_match_size = 0);
+
     void matchImageFeatures( const cv::Mat &feature_descriptor,
                              const std::vector<cv::DMatch> &kp_inlier,
-                             const std::map<int, KeyPoint*> &keypoints_list,
+                             const SlotMap<KeyPoint*> &keypoints_list,
                              const std::map<int, gtsam::Point3> &predicted_keypoints,
                              vector<cv::DMatch> &good_matches,
                              double good_match_threshold = 4.0,
                              int min_match_size = 0);
 
     void matchImageFeatures( const Frame &frame,
-                             const std::map<int, KeyPoint*> &keypoints_list,
+                             const SlotMap<KeyPoint*> &keypoints_list,
                              const std::map<int, gtsam::Point3> &predicted_keypoints,
                              vector<cv::DMatch> &good_matches,
                              double good_match_threshold = 4.0,
@@ -163,6 +209,27 @@ public:
                         const std::vector<PlaneCoefficients> &after,
                             RESULT_OF_MOTION &result);
 
+    // Closed-form solvers on fixed-size accumulators, no heap allocation in ransac loops
+    Eigen::Matrix4f solveRtPoints( const std_vector_of_eigen_vector4f &query_points,
+                                   const std_vector_of_eigen_vector4f &train_points,
+                                   const std::vector<cv::DMatch> &matches,
+                                   bool &valid );
+
+    bool solveRtPlanes( const PlaneCoefficients &last1, const PlaneCoefficients &last2, const PlaneCoefficients &last3,
+                        const PlaneCoefficients &plane1, const PlaneCoefficients &plane2, const PlaneCoefficients &plane3,
+                        RESULT_OF_MOTION &result );
+
+    void solveRtWeighted( const PlaneCoefficients *last_planes,
+                          const PlaneCoefficients *planes,
+                          const double *plane_weights,
+                          const int num_planes,
+                          const Eigen::Vector3d *last_points,
+                          const Eigen::Vector3d *points,
+                          const double *point_weights,
+                          const int num_points,
+                          RESULT_OF_MOTION &result,
+                          const double point_translation_scale = 1.0 );
+
     Eigen::Matrix4f solveRtPlanesPoints( const std::vector<PlaneType> &last_planes,
                                          const std::vector<PlaneType> &planes,
                                          const std::vector<PlanePair> &pairs,
@@ -191,6 +258,100 @@ public:
 
 
 private:
+    Eigen::Matrix3d umeyamaRotation( const Eigen::Matrix3d &sigma );
+
+    // Refined point ransac hypothesis, or the best of a run
+    struct RansacHypothesis
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        Eigen::Matrix4f transform;
+        std::vector<cv::DMatch> matches;
+        double rmse;
+        int real_iterations;
+        int valid_iterations;
+    };
+
+    // Best hypothesis found by one plane triple task
+    struct PlaneHypothesis
+    {
+        RESULT_OF_MOTION motion;
+        std::vector<PlanePair> inlier;
+        int triple;     // index of the triple, -1 for none
+        int real_iterations;
+        int valid_iterations;
+    };
+
+    void planesRansacWorker( const std::vector<PlaneType> *last_planes_ptr,
+                             const std::vector<PlaneType> *planes_ptr,
+                             const std::vector<PlanePair> *pairs_ptr,
+                             const int task,
+                             const int tasks,
+                             PlaneHypothesis *bests );
+
+    // Hypothesis (first_index + task) into hypotheses[task]
+    void pointsRansacHypothesis( const std_vector_of_eigen_vector4f *source_feature_3d_ptr,
+                                 const std_vector_of_eigen_vector4f *target_feature_3d_ptr,
+                                 const std::vector<cv::DMatch> *good_matches_ptr,
+                                 const unsigned int min_inlier_threshold,
+                                 const int first_index,
+                                 const int task,
+                                 RansacHypothesis *hypotheses );
+
+    bool pointsPriorHypothesis( const std_vector_of_eigen_vector4f &source_feature_3d,
+                                const std_vector_of_eigen_vector4f &target_feature_3d,
+                                const std::vector<cv::DMatch> &good_matches,
+                                const unsigned int min_inlier_threshold,
+                                RansacHypothesis &hypothesis );
+
+    bool planesPriorHypothesis( const std::vector<PlaneType> &last_planes,
+                                const std::vector<PlaneType> &planes,
+                                const std::vector<PlanePair> &pairs,
+                                RESULT_OF_MOTION &motion,
+                                std::vector<PlanePair> &inlier );
+
+    void selectGoodMatches( const Frame& source,
+                            const Frame& target,
+                            std::vector< cv::DMatch > &matches,
+                            std::vector< cv::DMatch > &good_matches,
+                            double good_match_threshold,
+                            int min_match_size );
+
+    void pointsRansacParallel( const std_vector_of_eigen_vector4f &source_feature_3d,
+                               const std_vector_of_eigen_vector4f &target_feature_3d,
+                               const std::vector<cv::DMatch> &good_matches,
+                               const unsigned int min_inlier_threshold,
+                               RansacHypothesis &result );
+
+    // Normal equations of one projective icp reduction
+    struct IcpSystem
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        Eigen::Matrix<double, 6, 6> JtJ;
+        Eigen::Matrix<double, 6, 1> Jtr;
+        double error;
+        int count;
+    };
+
+    // Fallback for frames without a normal cloud
+    void computeOrganizedNormals( const Frame &frame, std::vector<Eigen::Vector3f> &normals );
+
+    void projectiveIcpReduce( const Frame &source,
+                              const Frame &target,
+                              const Eigen::Matrix4d &transform,
+                              const int stride,
+                              const double max_distance,
+                              IcpSystem &system );
+
+    // Reduces the band of rows into systems[band]
+    void projectiveIcpWorker( const Frame *source,
+                              const Frame *target,
+                              const Eigen::Matrix4d *transform,
+                              const int rows,
+                              const int stride,
+                              const double max_distance,
+                              const int band,
+                              IcpSystem *systems );
+
     // Random pick
     std::vector<PlanePair> randomChoosePlanePairsPreferGood( const std::vector< std::vector<PlanePair> > &sample_pairs );
 
@@ -199,6 +360,10 @@ private:
     std::vector<cv::DMatch> randomChooseMatchesPreferGood( const unsigned int sample_size,
                                                         const vector< cv::DMatch > &matches_with_depth );
 
+    std::vector<cv::DMatch> randomChooseMatchesPreferGood( const unsigned int sample_size,
+                                                        const vector< cv::DMatch > &matches_with_depth,
+                                                        cv::RNG &rng );
+
     std::vector<cv::DMatch> randomChooseMatches( const unsigned int sample_size,
                                                 const vector< cv::DMatch > &matches );
 
@@ -217,17 +382,51 @@ private:
     // Feature match
     double feature_good_match_threshold_;
     int feature_min_good_match_size_;
+    // Plane ransac
+    int plane_ransac_method_;
+    int plane_ransac_iterations_;
+    double plane_ransac_inlier_ratio_;
     // Point ransac
     int ransac_sample_size_;
     int ransac_iterations_;
     int ransac_min_inlier_;
     double ransac_inlier_max_mahal_distance_;
+    int ransac_threads_;
+    int ransac_seed_;
+    WorkerPool ransac_pool_;    // ransac_threads_ - 1 workers, the caller is the last one
+    // Motion prior
+    bool use_motion_prior_;
+    double prior_search_radius_;
+    double prior_plane_direction_threshold_;
+    double prior_plane_distance_threshold_;
+    double prior_inlier_ratio_;
+    double prior_max_interval_;
+    bool has_motion_prior_;     // set during one tracking call
+    gtsam::Pose3 motion_prior_;
+    bool velocity_valid_;
+    gtsam::Pose3 velocity_;     // last consecutive motion
+    double velocity_interval_;
+    ros::Time velocity_stamp_;  // stamp of the last tracked frame
+    std::vector< std::vector<int> > keypoint_grid_; // reused by window matching
     // ICP
     double icp_max_distance_;
     int icp_iterations_;
     double icp_tf_epsilon_;
     int icp_min_indices_;
     double icp_score_threshold_;
+    // Projective ICP
+    bool use_projective_icp_;
+    int projective_icp_strides_;
+    int projective_icp_iterations_;
+    int projective_icp_threads_;
+    WorkerPool icp_pool_;       // projective_icp_threads_ - 1 workers, the caller is the last one
+    std::vector<Eigen::Vector3f> icp_model_normals_;   // per pixel of the source cloud, reused
+    // Dense odometry
+    bool use_dense_odometry_;
+    DenseOdometry dense_odometry_;
+    // Local map tracking
+    bool use_local_map_tracking_;
+    LocalMapTracker local_map_tracker_;
     // PnP
     int pnp_iterations_;
     int pnp_min_inlier_;
@@ -33,6 +33,7 @@
 #include <gtsam/sam/BearingRangeFactor.h>
 
 #include <line_based_plane_segmentation.h>
+#include "slot_map.h"
 
 #include <Eigen/Core>
 #include <Eigen/Geometry>
@@ -61,6 +62,9 @@ typedef pcl::PointCloud< PointType > PointCloudType;
 typedef PointCloudType::Ptr PointCloudTypePtr;
 typedef PointCloudType::ConstPtr PointCloudTypeConstPtr;
 
+typedef pcl::PointCloud< pcl::Normal > NormalCloud;
+typedef NormalCloud::Ptr NormalCloudPtr;
+
 typedef boost::shared_ptr<const pcl::PointRepresentation< PointType > > PointRepresentationConstPtr;
 typedef std::vector<Eigen::Vector4f, Eigen::aligned_allocator<Eigen::Vector4f> > std_vector_of_eigen_vector4f;
 typedef Eigen::Vector4d PlaneCoefficients;
@@ -83,6 +87,9 @@ typedef union
 } RGBValue;
 
 
+namespace plane_slam { class PlaneRaster; }
+typedef boost::shared_ptr<plane_slam::PlaneRaster> PlaneRasterPtr;
+
 /*
  * \brief Plane parameters
   N*P + d = 0
@@ -93,14 +100,18 @@ struct PlaneType
     PointType centroid;
     Eigen::Vector4d coefficients;
     Eigen::Vector3d sigmas;
+    // sufficient statistics of the inlier
+    int count;
+    Eigen::Matrix3d scatter;
     //
-    std::vector<int> inlier;
+    std::vector<int> inlier;    // indices into the organized cloud of the frame
     std::vector<int> boundary_inlier;
     std::vector<int> hull_inlier;
-    PointCloudTypePtr cloud;
-    PointCloudTypePtr cloud_boundary;
-    PointCloudTypePtr cloud_hull;
+    PointCloudTypePtr cloud;    // projected inlier, NULL until a landmark accumulates it
+    PointCloudTypePtr cloud_boundary;   // NULL unless filled
+    PointCloudTypePtr cloud_hull;       // NULL unless filled
     PointCloudTypePtr cloud_voxel;
+    PlaneRasterPtr raster;      // occupancy of cloud_voxel, NULL until built
     RGBValue color;
     bool valid;
     //
@@ -111,17 +122,15 @@ struct PlaneType
     // semantic label
     std::string semantic_label; // NONE or "", FLOOR, WALL, DOOR, TABLE
 
-    PlaneType() : cloud( new PointCloudType)
-      , cloud_boundary( new PointCloudType)
-      , cloud_hull( new PointCloudType)
+    PlaneType() : count(0)
+      , scatter( Eigen::Matrix3d::Zero() )
       , cloud_voxel( new PointCloudType)
       , mask()
       , valid(true)
     {   color.Blue = 255; color.Green = 255; color.Red = 255; color.Alpha = 255;}
 
-    PlaneType( bool is_valid ) : cloud( new PointCloudType)
-      , cloud_boundary( new PointCloudType)
-      , cloud_hull( new PointCloudType)
+    PlaneType( bool is_valid ) : count(0)
+      , scatter( Eigen::Matrix3d::Zero() )
       , cloud_voxel( new PointCloudType)
       , mask()
       , valid(is_valid)
@@ -129,6 +138,7 @@ struct PlaneType
 
     void setId( int _id ) { landmark_id = _id; }
     int &id() { return landmark_id;}
+    int id() const { return landmark_id;}
 };
 
 struct PlanePair
@@ -170,6 +180,7 @@ struct KeyPoint
     }
     void setId( int _id ) { keypoint_id = _id; }
     int &id() { return keypoint_id;}
+    int id() const { return keypoint_id;}
 };
 
 // PnP Result
@@ -317,6 +328,20 @@ void projectPoints ( const PointCloudType &input, const std::vector<int> &inlier
 void projectPoints ( const PointCloudType &input, const std::vector<int> &inlier,
                      const Eigen::Vector4f &model_coefficients, PointCloudType &projected_points );
 
+// Least squares plane of the indexed points, normal towards the viewpoint
+bool fitPlane( const PointCloudType &input, const std::vector<int> &inlier,
+               Eigen::Vector4d &coefficients, Eigen::Vector3d &centroid );
+
+// Centroid, scatter matrix and count of the indexed points
+void computePlaneStatistics( const PointCloudType &input, PlaneType &plane );
+
+// Projected inlier of a plane, plane.cloud if filled, otherwise projected from the organized cloud
+PointCloudTypePtr getPlaneCloud( const PointCloudType &input, const PlaneType &plane );
+
+// Inlier of an organized label image on the border or next to another label
+void extractRegionBoundary( const std::vector<int> &labels, int label, int width, int height,
+                            const std::vector<int> &inlier, std::vector<int> &boundary );
+
 void getPointCloudFromIndices( const PointCloudTypePtr &input,
                                const pcl::PointIndices &indices,
                                PointCloudTypePtr &output);
@@ -387,8 +412,14 @@ tf::Transform motionToTf( const RESULT_OF_MOTION &motion );
 gtsam::Pose3 motionToPose3( RESULT_OF_MOTION &motion);
 
 
+// Hamming distance of two 256 bit ORB descriptors
+inline int hamming_distance_orb32x8_popcountll(const uint64_t* v1, const uint64_t* v2) {
+  return (__builtin_popcountll(v1[0] ^ v2[0]) + __builtin_popcountll(v1[1] ^ v2[1])) +
+         (__builtin_popcountll(v1[2] ^ v2[2]) + __builtin_popcountll(v1[3] ^ v2[3]));
+}
+
 int bruteForceSearchORB(const uint64_t* v, const uint64_t* search_array, const unsigned int& size, int& result_index);
-int bruteForceSearchORB(const uint64_t* v, const std::map<int, KeyPoint*> &keypoints_list,
+int bruteForceSearchORB(const uint64_t* v, const plane_slam::SlotMap<KeyPoint*> &keypoints_list,
                         const std::map<int, gtsam::Point3> &predicted_keypoints, int& result_index);
 
 double getIntervalMS( ros::Time &start );
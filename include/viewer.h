@@ -50,7 +50,7 @@ public:
 
     void displayMapLandmarks( const PointCloudTypePtr &keypoints_cloud, const std::string &prefix = "point_landmark" );
 
-    void displayMapLandmarks( std::map<int, PlaneType*> &landmarks, const std::string &prefix = "plane_landmark" );
+    void displayMapLandmarks( SlotMap<PlaneType*> &landmarks, const std::string &prefix = "plane_landmark" );
 
     void displayMapLandmarks( const std::vector<PlaneType> &landmarks, const std::string &prefix = "landmark" );
 
@@ -61,7 +61,7 @@ public:
 
     void displayPath( const std::vector<geometry_msgs::PoseStamped> &poses, const std::string &prefix = "path", double r = 255, double g = 0, double b = 0 );
 
-    void displayPath( const std::map<int, gtsam::Pose3> &optimized_poses, const std::string &prefix = "optimized_path", double r = 255, double g = 0, double b = 0 );
+    void displayPath( const SlotMap<gtsam::Pose3> &optimized_poses, const std::string &prefix = "optimized_path", double r = 255, double g = 0, double b = 0 );
 
     void displayPlanes( const PointCloudTypePtr &input, const std::vector<PlaneType> &planes, const std::string &prefix, int viewport);
 
@@ -0,0 +1,53 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <boost/function.hpp>
+
+namespace plane_slam
+{
+
+// Threads kept for the life of the owner. run() hands the task indices out in increasing
+// order to the workers and the calling thread, and returns once all of them are done.
+// Only one thread may call run() and resize().
+class WorkerPool
+{
+public:
+    typedef boost::function<void( int )> Task;
+
+    WorkerPool( int threads = 0 );
+    ~WorkerPool();
+
+    // Threads besides the caller
+    void resize( int threads );
+    inline int size() const { return workers_.size(); }
+
+    // task( i ) for i in [0, count)
+    void run( const Task &task, int count );
+
+private:
+    void loop();
+
+    // Run tasks until none is left
+    void work();
+
+private:
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable start_condition_;
+    std::condition_variable done_condition_;
+    const Task *task_;
+    int count_;
+    int next_;
+    int pending_;
+    unsigned int generation_;
+    bool stop_;
+};
+
+} // end of namespace plane_slam
+
+#endif // WORKER_POOL_H
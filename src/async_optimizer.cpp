@@ -0,0 +1,397 @@
+#include "async_optimizer.h"
+#include <set>
+#include <gtsam/inference/Symbol.h>
+#include "utils.h"
+
+namespace plane_slam
+{
+
+AsyncOptimizer::AsyncOptimizer()
+    : isam2_( new gtsam::ISAM2() )
+    , smoother_( 0 )
+    , latest_timestamp_( 0 )
+    , async_( false )
+    , refresh_threshold_( 0 )
+    , full_refresh_interval_( 10 )
+    , updates_since_refresh_( 0 )
+    , busy_( false )
+    , stop_( false )
+{
+    worker_ = std::thread( &AsyncOptimizer::run, this );
+}
+
+AsyncOptimizer::~AsyncOptimizer()
+{
+    {
+        std::unique_lock<std::mutex> lock( mutex_ );
+        stop_ = true;
+    }
+    queue_condition_.notify_all();
+    worker_.join();
+    delete isam2_;
+    delete smoother_;
+}
+
+void AsyncOptimizer::reset( const gtsam::ISAM2Params &params, double lag )
+{
+    {
+        std::unique_lock<std::mutex> lock( mutex_ );
+        queue_.clear();
+    }
+    wait();
+
+    // Status of the touched variables
+    gtsam::ISAM2Params isam2_params = params;
+    isam2_params.enableDetailedResults = true;
+    delete isam2_;
+    delete smoother_;
+    isam2_ = 0;
+    smoother_ = 0;
+    if( lag > 0 )
+        smoother_ = new gtsam::IncrementalFixedLagSmoother( lag, isam2_params );
+    else
+        isam2_ = new gtsam::ISAM2( isam2_params );
+    latest_timestamp_ = 0;
+    estimate_.clear();
+    last_delta_.clear();
+    updates_since_refresh_ = 0;
+    {
+        std::unique_lock<std::mutex> lock( mutex_ );
+        changes_.clear();
+        error_ = std::exception_ptr();
+    }
+}
+
+void AsyncOptimizer::setLag( double lag )
+{
+    if( !smoother_ || lag <= 0 )
+        return;
+    flush();
+    smoother_->smootherLag() = lag;
+}
+
+void AsyncOptimizer::setAsync( bool async )
+{
+    if( async == async_ )
+        return;
+    flush();
+    async_ = async;
+}
+
+void AsyncOptimizer::push( const gtsam::NonlinearFactorGraph &graph,
+                           const gtsam::Values &values,
+                           const gtsam::FactorIndices &removed_factors,
+                           const gtsam::FastVector<gtsam::Key> &prune_keys,
+                           double timestamp )
+{
+    Job job;
+    job.graph = graph;
+    job.values = values;
+    job.removed_factors = removed_factors;
+    job.prune_keys = prune_keys;
+    job.timestamp = timestamp;
+    enqueue( job );
+}
+
+void AsyncOptimizer::rekey( const std::map<gtsam::Key, gtsam::Key> &mapping )
+{
+    Job job;
+    job.rekey = mapping;
+    enqueue( job );
+}
+
+void AsyncOptimizer::remove( const gtsam::FastVector<gtsam::Key> &keys,
+                             const gtsam::NonlinearFactorGraph &graph )
+{
+    Job job;
+    job.graph = graph;
+    job.remove_keys = keys;
+    enqueue( job );
+}
+
+void AsyncOptimizer::enqueue( const Job &job )
+{
+    if( !async_ )
+    {
+        Job sync = job;
+        update( sync );
+        std::unique_lock<std::mutex> lock( mutex_ );
+        rethrowError();
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock( mutex_ );
+        queue_.push_back( job );
+    }
+    queue_condition_.notify_one();
+}
+
+void AsyncOptimizer::flush()
+{
+    std::unique_lock<std::mutex> lock( mutex_ );
+    while( busy_ || !queue_.empty() )
+        idle_condition_.wait( lock );
+    rethrowError();
+}
+
+void AsyncOptimizer::wait()
+{
+    std::unique_lock<std::mutex> lock( mutex_ );
+    while( busy_ || !queue_.empty() )
+        idle_condition_.wait( lock );
+}
+
+void AsyncOptimizer::rethrowError()
+{
+    if( !error_ )
+        return;
+    std::exception_ptr error = error_;
+    error_ = std::exception_ptr();
+    std::rethrow_exception( error );
+}
+
+void AsyncOptimizer::takeChanges( gtsam::Values &changes )
+{
+    changes.clear();
+    std::unique_lock<std::mutex> lock( mutex_ );
+    changes.swap( changes_ );
+    rethrowError();
+}
+
+const gtsam::ISAM2 *AsyncOptimizer::isam2()
+{
+    flush();
+    return smoother_ ? &smoother_->getISAM2() : isam2_;
+}
+
+bool AsyncOptimizer::empty()
+{
+    return isam2()->empty();
+}
+
+void AsyncOptimizer::run()
+{
+    std::unique_lock<std::mutex> lock( mutex_ );
+    while( true )
+    {
+        while( !stop_ && queue_.empty() )
+            queue_condition_.wait( lock );
+        if( stop_ )
+            break;
+
+        /// 1: Fold the queued jobs into one update, up to the next one resolving keys
+        ///    against the graph, which has to see the factors of the jobs before it
+        Job job = queue_.front();
+        queue_.pop_front();
+        while( !queue_.empty() && !queue_.front().resolvesKeys() )
+        {
+            const Job &next = queue_.front();
+            job.graph.push_back( next.graph.begin(), next.graph.end() );
+            job.values.insert( next.values );
+            job.removed_factors.insert( job.removed_factors.end(), next.removed_factors.begin(), next.removed_factors.end() );
+            job.prune_keys.insert( job.prune_keys.end(), next.prune_keys.begin(), next.prune_keys.end() );
+            job.timestamp = std::max( job.timestamp, next.timestamp );
+            queue_.pop_front();
+        }
+        busy_ = true;
+        lock.unlock();
+
+        /// 2: Update outside of the lock
+        update( job );
+
+        lock.lock();
+        busy_ = false;
+        if( queue_.empty() )
+            idle_condition_.notify_all();
+    }
+}
+
+void AsyncOptimizer::resolveKeys( Job &job )
+{
+    const gtsam::ISAM2 &isam2 = smoother_ ? smoother_->getISAM2() : *isam2_;
+    const gtsam::VariableIndex &variable_index = isam2.getVariableIndex();
+    const gtsam::NonlinearFactorGraph &factors = isam2.getFactorsUnsafe();
+    std::set<size_t> removed( job.removed_factors.begin(), job.removed_factors.end() );
+
+    /// 1: Factors of the pruned keys, only preserve the first one
+    for( int i = 0; i < job.prune_keys.size(); i++)
+    {
+        gtsam::VariableIndex::Factors indices;
+        try{
+            indices = variable_index[job.prune_keys[i]];
+        }catch( std::invalid_argument &e){
+            continue;
+        }
+        for( int k = 1; k < indices.size(); k ++)
+        {
+            if( removed.insert( indices.at(k) ).second )
+                job.removed_factors.push_back( indices.at(k) );
+        }
+    }
+
+    /// 2: All factors of the removed keys
+    for( int i = 0; i < job.remove_keys.size(); i++)
+    {
+        gtsam::VariableIndex::Factors indices;
+        try{
+            indices = variable_index[job.remove_keys[i]];
+        }catch( std::invalid_argument &e){
+            continue;
+        }
+        for( gtsam::VariableIndex::Factors::const_iterator it = indices.begin(); it != indices.end(); it++)
+        {
+            if( removed.insert( *it ).second )
+                job.removed_factors.push_back( *it );
+        }
+    }
+
+    /// 3: Factors of the old keys, added again on the new ones
+    for( std::map<gtsam::Key, gtsam::Key>::const_iterator itk = job.rekey.begin(); itk != job.rekey.end(); itk++)
+    {
+        gtsam::VariableIndex::Factors indices;
+        try{
+            indices = variable_index[itk->first];
+        }catch( std::invalid_argument &e){
+            continue;
+        }
+        for( gtsam::VariableIndex::Factors::const_iterator it = indices.begin(); it != indices.end(); it++)
+        {
+            const gtsam::NonlinearFactor::shared_ptr &factor = factors.at( *it );
+            if( !factor || !removed.insert( *it ).second )
+                continue;
+            job.removed_factors.push_back( *it );
+            job.graph.push_back( factor->rekey( job.rekey ) );
+        }
+    }
+}
+
+void AsyncOptimizer::update( Job &job )
+{
+    gtsam::Values changed;
+    try{
+        if( job.resolvesKeys() )
+            resolveKeys( job );
+
+        gtsam::ISAM2Result result;
+        try{
+            if( smoother_ )
+                result = updateSmoother( job );
+            else
+                result = isam2_->update( job.graph, job.values, job.removed_factors );}
+        catch(gtsam::IndeterminantLinearSystemException &e){
+            gtsam::Symbol sym = gtsam::Symbol(e.nearbyVariable());
+            cout << "ISAM update error: key ch = " << (char)(sym.chr()) << ", index = " << sym.index() << endl;
+            fflush(stdout);
+        }
+
+        refresh( result, changed );
+    }
+    catch( std::exception &e ){
+        // Would terminate the worker thread, kept for the frontend instead
+        cout << RED << "ISAM update failed: " << e.what() << RESET << endl;
+        std::unique_lock<std::mutex> lock( mutex_ );
+        if( !error_ )
+            error_ = std::current_exception();
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock( mutex_ );
+    for( gtsam::Values::const_iterator it = changed.begin(); it != changed.end(); it++)
+        upsert( changes_, it->key, it->value );
+}
+
+gtsam::ISAM2Result AsyncOptimizer::updateSmoother( Job &job )
+{
+    if( job.timestamp >= 0 )
+        latest_timestamp_ = std::max( latest_timestamp_, job.timestamp );
+    const gtsam::Values &theta = smoother_->getLinearizationPoint();
+
+    /// 1: Variables of the new factors are active now, marginalized ones come back
+    ///    into the window from their last estimate
+    gtsam::FixedLagSmoother::KeyTimestampMap timestamps;
+    const gtsam::KeySet keys = job.graph.keys();
+    for( gtsam::KeySet::const_iterator it = keys.begin(); it != keys.end(); it++)
+    {
+        const bool active = theta.exists( *it );
+        if( !active && !job.values.exists( *it ) )
+        {
+            if( !estimate_.exists( *it ) )
+                continue;
+            job.values.insert( *it, estimate_.at( *it ) );
+        }
+        if( job.timestamp >= 0 || !active )
+            timestamps[*it] = latest_timestamp_;
+    }
+    for( gtsam::Values::const_iterator it = job.values.begin(); it != job.values.end(); it++)
+    {
+        if( !timestamps.count( it->key ) )
+            timestamps[it->key] = latest_timestamp_;
+    }
+
+    /// 2: Update, marginalizes the variables out of the window
+    smoother_->update( job.graph, job.values, timestamps, job.removed_factors );
+    return smoother_->getISAM2Result();
+}
+
+bool AsyncOptimizer::refresh( const gtsam::ISAM2Result &result, gtsam::Values &changed )
+{
+    updates_since_refresh_ ++;
+    const bool full = !result.detail || updates_since_refresh_ >= full_refresh_interval_;
+
+    /// 1: Estimates to compare
+    gtsam::Values values;
+    const gtsam::ISAM2 &isam2 = smoother_ ? smoother_->getISAM2() : *isam2_;
+    if( full )
+    {
+        values = isam2.calculateBestEstimate();
+        updates_since_refresh_ = 0;
+    }
+    else
+    {
+        // The back-substitution also moves variables below the re-eliminated cliques,
+        // the detailed result does not report those, their delta changes
+        const gtsam::Values &theta = isam2.getLinearizationPoint();
+        const gtsam::VectorValues &delta = isam2.getDelta();
+        const gtsam::ISAM2Result::DetailedResults::StatusMap &status = result.detail->variableStatus;
+        for( gtsam::VectorValues::const_iterator it = delta.begin(); it != delta.end(); it++)
+        {
+            gtsam::ISAM2Result::DetailedResults::StatusMap::const_iterator its = status.find( it->first );
+            const bool relinearized = its != status.end() && (its->second.isNew || its->second.isRelinearized);
+            gtsam::VectorValues::const_iterator itd = last_delta_.find( it->first );
+            if( !relinearized && itd != last_delta_.end() && itd->second == it->second )
+                continue;
+            if( !theta.exists( it->first ) )    // removed
+                continue;
+            // calculateEstimate( key ), for any value type
+            gtsam::Value *value = theta.at( it->first ).retract_( it->second );
+            values.insert( it->first, *value );
+            value->deallocate_();
+        }
+    }
+    last_delta_ = isam2.getDelta();
+
+    /// 2: Keep the ones moved beyond the threshold
+    for( gtsam::Values::const_iterator it = values.begin(); it != values.end(); it++)
+    {
+        if( estimate_.exists( it->key ) && estimate_.at( it->key ).equals_( it->value, refresh_threshold_ ) )
+            continue;
+        changed.insert( it->key, it->value );
+        if( !full || smoother_ )
+            upsert( estimate_, it->key, it->value );
+    }
+    if( full && !smoother_ )    // also drops the removed variables, marginalized ones stay
+        estimate_.swap( values );
+
+    return full;
+}
+
+void AsyncOptimizer::upsert( gtsam::Values &values, gtsam::Key key, const gtsam::Value &value )
+{
+    if( values.exists( key ) )
+        values.update( key, value );
+    else
+        values.insert( key, value );
+}
+
+} // end of namespace plane_slam
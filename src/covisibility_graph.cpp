@@ -0,0 +1,156 @@
+#include "covisibility_graph.h"
+#include <algorithm>
+
+namespace plane_slam
+{
+
+static const std::vector<gtsam::Key> no_landmarks;
+static const std::vector<int> no_frames;
+
+bool CovisibilityGraph::addObservation( int frame, gtsam::Key landmark )
+{
+    std::vector<int> &frames = landmark_frames_[landmark];
+    if( std::find( frames.begin(), frames.end(), frame ) != frames.end() )
+        return false;
+
+    for( int i = 0; i < frames.size(); i++)
+    {
+        weights_[frame][frames[i]] ++;
+        weights_[frames[i]][frame] ++;
+    }
+    frames.push_back( frame );
+    frame_landmarks_[frame].push_back( landmark );
+    return true;
+}
+
+void CovisibilityGraph::removeObservation( int frame, gtsam::Key landmark )
+{
+    std::unordered_map<gtsam::Key, std::vector<int> >::iterator itl = landmark_frames_.find( landmark );
+    if( itl == landmark_frames_.end() )
+        return;
+    std::vector<int> &frames = itl->second;
+    std::vector<int>::iterator itf = std::find( frames.begin(), frames.end(), frame );
+    if( itf == frames.end() )
+        return;
+    frames.erase( itf );
+
+    /// 1: Weights to the other observers
+    for( int i = 0; i < frames.size(); i++)
+    {
+        std::unordered_map<int, int> &w1 = weights_[frame];
+        std::unordered_map<int, int> &w2 = weights_[frames[i]];
+        if( --w1[frames[i]] <= 0 )
+            w1.erase( frames[i] );
+        if( --w2[frame] <= 0 )
+            w2.erase( frame );
+    }
+    if( frames.empty() )
+        landmark_frames_.erase( itl );
+
+    /// 2: Landmark of the frame
+    std::vector<gtsam::Key> &landmarks = frame_landmarks_[frame];
+    landmarks.erase( std::find( landmarks.begin(), landmarks.end(), landmark ) );
+}
+
+void CovisibilityGraph::removeFrame( int frame )
+{
+    std::unordered_map<int, std::vector<gtsam::Key> >::iterator it = frame_landmarks_.find( frame );
+    if( it == frame_landmarks_.end() )
+        return;
+    const std::vector<gtsam::Key> landmarks = it->second;
+    for( int i = 0; i < landmarks.size(); i++)
+        removeObservation( frame, landmarks[i] );
+    frame_landmarks_.erase( frame );
+    weights_.erase( frame );
+}
+
+void CovisibilityGraph::removeLandmark( gtsam::Key landmark )
+{
+    std::unordered_map<gtsam::Key, std::vector<int> >::iterator it = landmark_frames_.find( landmark );
+    if( it == landmark_frames_.end() )
+        return;
+    const std::vector<int> frames = it->second;
+    for( int i = 0; i < frames.size(); i++)
+        removeObservation( frames[i], landmark );
+}
+
+void CovisibilityGraph::mergeLandmark( gtsam::Key from, gtsam::Key to )
+{
+    const std::vector<int> frames = observers( from );
+    removeLandmark( from );
+    for( int i = 0; i < frames.size(); i++)
+        addObservation( frames[i], to );
+}
+
+void CovisibilityGraph::clear()
+{
+    frame_landmarks_.clear();
+    landmark_frames_.clear();
+    weights_.clear();
+}
+
+int CovisibilityGraph::weight( int frame1, int frame2 ) const
+{
+    std::unordered_map<int, std::unordered_map<int, int> >::const_iterator it = weights_.find( frame1 );
+    if( it == weights_.end() )
+        return 0;
+    std::unordered_map<int, int>::const_iterator itw = it->second.find( frame2 );
+    return itw == it->second.end() ? 0 : itw->second;
+}
+
+static inline bool heavier( const std::pair<int, int> &a, const std::pair<int, int> &b )
+{
+    return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+void CovisibilityGraph::neighbours( int frame, int min_weight, int max_count, std::vector<int> &frames ) const
+{
+    frames.clear();
+    std::unordered_map<int, std::unordered_map<int, int> >::const_iterator it = weights_.find( frame );
+    if( it == weights_.end() )
+        return;
+
+    std::vector<std::pair<int, int> > weighted;   // weight, frame
+    for( std::unordered_map<int, int>::const_iterator itw = it->second.begin(); itw != it->second.end(); itw++)
+    {
+        if( itw->second >= min_weight )
+            weighted.push_back( std::make_pair( itw->second, itw->first ) );
+    }
+    std::sort( weighted.begin(), weighted.end(), heavier );
+    if( max_count >= 0 && weighted.size() > max_count )
+        weighted.resize( max_count );
+
+    frames.reserve( weighted.size() );
+    for( int i = 0; i < weighted.size(); i++)
+        frames.push_back( weighted[i].second );
+}
+
+void CovisibilityGraph::localMap( int frame, int min_weight, int max_neighbours,
+                                  std::vector<int> &frames, std::vector<gtsam::Key> &landmarks ) const
+{
+    neighbours( frame, min_weight, max_neighbours, frames );
+    frames.insert( frames.begin(), frame );
+
+    landmarks.clear();
+    for( int i = 0; i < frames.size(); i++)
+    {
+        const std::vector<gtsam::Key> &observed = this->landmarks( frames[i] );
+        landmarks.insert( landmarks.end(), observed.begin(), observed.end() );
+    }
+    std::sort( landmarks.begin(), landmarks.end() );
+    landmarks.erase( std::unique( landmarks.begin(), landmarks.end() ), landmarks.end() );
+}
+
+const std::vector<gtsam::Key> &CovisibilityGraph::landmarks( int frame ) const
+{
+    std::unordered_map<int, std::vector<gtsam::Key> >::const_iterator it = frame_landmarks_.find( frame );
+    return it == frame_landmarks_.end() ? no_landmarks : it->second;
+}
+
+const std::vector<int> &CovisibilityGraph::observers( gtsam::Key landmark ) const
+{
+    std::unordered_map<gtsam::Key, std::vector<int> >::const_iterator it = landmark_frames_.find( landmark );
+    return it == landmark_frames_.end() ? no_frames : it->second;
+}
+
+} // end of namespace plane_slam
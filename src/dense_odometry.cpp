@@ -0,0 +1,280 @@
+#include "dense_odometry.h"
+#include <boost/bind.hpp>
+
+namespace plane_slam
+{
+
+static inline float interpolate( const cv::Mat &image, const float x, const float y )
+{
+    const int x0 = (int)x;
+    const int y0 = (int)y;
+    const float ax = x - x0;
+    const float ay = y - y0;
+    const float *row0 = image.ptr<float>(y0);
+    const float *row1 = image.ptr<float>(y0+1);
+    return (1-ay) * ( (1-ax) * row0[x0] + ax * row0[x0+1] )
+            + ay * ( (1-ax) * row1[x0] + ax * row1[x0+1] );
+}
+
+static inline bool validDepth( const cv::Mat &depth, const int x0, const int y0 )
+{
+    const float *row0 = depth.ptr<float>(y0);
+    const float *row1 = depth.ptr<float>(y0+1);
+    return row0[x0] > 0 && row0[x0+1] > 0 && row1[x0] > 0 && row1[x0+1] > 0;
+}
+
+DenseOdometry::DenseOdometry()
+    : verbose_( false )
+    , levels_( 3 )
+    , iterations_( 10 )
+    , threads_( 4 )
+    , depth_weight_( 1.0 )
+    , intensity_huber_( 0.1 )
+    , depth_huber_( 0.05 )
+    , min_pixels_( 500 )
+    , max_rmse_( 0.1 )
+{
+}
+
+bool DenseOdometry::align( const Frame &source, const Frame &target, RESULT_OF_MOTION &result,
+                           const Eigen::Matrix4d &estimated_transform )
+{
+    result.valid = false;
+
+    if( !source.cloud_downsampled_->size() || !target.cloud_downsampled_->size()
+            || source.cloud_downsampled_->width != target.cloud_downsampled_->width
+            || source.cloud_downsampled_->height != target.cloud_downsampled_->height )
+        return false;
+
+    /// 1: Pyramids, last target is the usual source
+    if( source_pyramid_.levels.size() != levels_ || target_pyramid_.levels.size() != levels_
+            || target_pyramid_.stamp != source.stamp_ )
+        buildPyramid( source, source_pyramid_ );
+    else
+        std::swap( source_pyramid_, target_pyramid_ );
+    buildPyramid( target, target_pyramid_ );
+
+    /// 2: Gauss-Newton, coarse to fine
+    Eigen::Matrix4d T = estimated_transform;
+    System system;
+    for( int level = levels_-1; level >= 0; level-- )
+    {
+        for( int it = 0; it < iterations_; it++ )
+        {
+            reduce( level, T, system );
+            if( system.count < 6 )
+                return false;
+
+            const Eigen::Matrix<double, 6, 1> xi = system.JtJ.ldlt().solve( -system.Jtr );
+            if( xi != xi )
+                return false;
+            T = gtsam::Pose3::Expmap( xi ).matrix() * T;
+            if( xi.norm() < 1e-5 )
+                break;
+        }
+    }
+
+    /// 3: Residual at the finest level
+    reduce( 0, T, system );
+    result.setTransform4d( T );
+    result.inlier = system.count;
+    result.rmse = system.count ? sqrt( system.error / system.count ) : 1e9;
+    result.score = result.rmse;
+    result.valid = system.count >= min_pixels_ && result.rmse < max_rmse_;
+
+    if( verbose_ )
+        cout << GREEN << " Dense odometry pixels = " << system.count << ", rmse = " << result.rmse << RESET << endl;
+
+    return result.valid;
+}
+
+void DenseOdometry::buildPyramid( const Frame &frame, Pyramid &pyramid )
+{
+    const PointCloudType &cloud = *frame.cloud_downsampled_;
+    const CameraParameters &camera = frame.camera_params_downsampled_;
+    const int width = cloud.width;
+    const int height = cloud.height;
+
+    pyramid.stamp = frame.stamp_;
+    pyramid.levels.resize( levels_ );
+
+    /// 1: Finest level from the organized cloud
+    Level &base = pyramid.levels[0];
+    base.intensity.create( height, width, CV_32F );
+    base.depth.create( height, width, CV_32F );
+    for( int v = 0; v < height; v++)
+    {
+        float *intensity = base.intensity.ptr<float>(v);
+        float *depth = base.depth.ptr<float>(v);
+        for( int u = 0; u < width; u++)
+        {
+            const PointType &pt = cloud.points[v*width + u];
+            intensity[u] = (0.299f * pt.r + 0.587f * pt.g + 0.114f * pt.b) / 255.0f;
+            depth[u] = std::isnan(pt.z) ? 0 : pt.z;
+        }
+    }
+    base.fx = camera.fx;
+    base.fy = camera.fy;
+    base.cx = camera.cx;
+    base.cy = camera.cy;
+
+    /// 2: Coarser levels, intensity with pyrDown, depth averaged over valid pixels
+    for( int l = 1; l < levels_; l++)
+    {
+        const Level &fine = pyramid.levels[l-1];
+        Level &coarse = pyramid.levels[l];
+        const int w = fine.depth.cols / 2;
+        const int h = fine.depth.rows / 2;
+        cv::pyrDown( fine.intensity, coarse.intensity, cv::Size( w, h ) );
+        coarse.depth.create( h, w, CV_32F );
+        for( int v = 0; v < h; v++)
+        {
+            const float *row0 = fine.depth.ptr<float>(2*v);
+            const float *row1 = fine.depth.ptr<float>(2*v+1);
+            float *depth = coarse.depth.ptr<float>(v);
+            for( int u = 0; u < w; u++)
+            {
+                const float d[4] = { row0[2*u], row0[2*u+1], row1[2*u], row1[2*u+1] };
+                float sum = 0;
+                int n = 0;
+                for( int k = 0; k < 4; k++)
+                    if( d[k] > 0 ) { sum += d[k]; n++; }
+                depth[u] = n ? sum / n : 0;
+            }
+        }
+        coarse.fx = fine.fx / 2;
+        coarse.fy = fine.fy / 2;
+        coarse.cx = fine.cx / 2;
+        coarse.cy = fine.cy / 2;
+    }
+
+    /// 3: Central difference gradients, depth gradient only between valid pixels
+    for( int l = 0; l < levels_; l++)
+    {
+        Level &level = pyramid.levels[l];
+        const int w = level.depth.cols;
+        const int h = level.depth.rows;
+        cv::Sobel( level.intensity, level.gradient_x, CV_32F, 1, 0, 1, 0.5 );
+        cv::Sobel( level.intensity, level.gradient_y, CV_32F, 0, 1, 1, 0.5 );
+        level.depth_gradient_x.create( h, w, CV_32F );
+        level.depth_gradient_y.create( h, w, CV_32F );
+        level.depth_gradient_x.setTo( 0 );
+        level.depth_gradient_y.setTo( 0 );
+        for( int v = 1; v < h-1; v++)
+        {
+            const float *up = level.depth.ptr<float>(v-1);
+            const float *row = level.depth.ptr<float>(v);
+            const float *down = level.depth.ptr<float>(v+1);
+            float *gx = level.depth_gradient_x.ptr<float>(v);
+            float *gy = level.depth_gradient_y.ptr<float>(v);
+            for( int u = 1; u < w-1; u++)
+            {
+                if( row[u-1] > 0 && row[u+1] > 0 )
+                    gx[u] = 0.5f * (row[u+1] - row[u-1]);
+                if( up[u] > 0 && down[u] > 0 )
+                    gy[u] = 0.5f * (down[u] - up[u]);
+            }
+        }
+    }
+}
+
+void DenseOdometry::reduce( const int level, const Eigen::Matrix4d &transform, System &system )
+{
+    const int height = target_pyramid_.levels[level].depth.rows;
+    const int bands = std::max( 1, std::min( threads_, height / 8 ) );
+    const int rows = (height + bands - 1) / bands;
+
+    // Each task reduces a band of rows, summed in band order
+    pool_.resize( threads_ - 1 );
+    std::vector<System, Eigen::aligned_allocator<System> > systems( bands );
+    pool_.run( boost::bind( &DenseOdometry::reduceRows, this, level, &transform, rows, _1, &systems[0] ), bands );
+
+    system = systems[0];
+    for( int i = 1; i < bands; i++ )
+    {
+        system.JtJ += systems[i].JtJ;
+        system.Jtr += systems[i].Jtr;
+        system.error += systems[i].error;
+        system.count += systems[i].count;
+    }
+}
+
+void DenseOdometry::reduceRows( const int level, const Eigen::Matrix4d *transform,
+                                const int rows, const int band, System *systems )
+{
+    const Level &src = source_pyramid_.levels[level];
+    const Level &tgt = target_pyramid_.levels[level];
+    const int width = tgt.depth.cols;
+    const int height = tgt.depth.rows;
+    const int row_begin = band * rows;
+    const int row_end = std::min( height, row_begin + rows );
+    System *system = &systems[band];
+    const Eigen::Matrix3f R = transform->topLeftCorner<3,3>().cast<float>();
+    const Eigen::Vector3f t = transform->topRightCorner<3,1>().cast<float>();
+    const double depth_weight = depth_weight_;
+    const double intensity_huber = intensity_huber_;
+    const double depth_huber = depth_huber_;
+
+    system->JtJ.setZero();
+    system->Jtr.setZero();
+    system->error = 0;
+    system->count = 0;
+
+    Eigen::Matrix<double, 6, 1> J;
+    for( int v = row_begin; v < row_end; v++)
+    {
+        const float *depth = tgt.depth.ptr<float>(v);
+        const float *intensity = tgt.intensity.ptr<float>(v);
+        for( int u = 0; u < width; u++)
+        {
+            const float z = depth[u];
+            if( z <= 0 )
+                continue;
+
+            // warp target pixel into source image
+            const Eigen::Vector3f p = R * Eigen::Vector3f( (u - tgt.cx) * z / tgt.fx, (v - tgt.cy) * z / tgt.fy, z ) + t;
+            if( p(2) <= 0 )
+                continue;
+            const float inv_z = 1.0f / p(2);
+            const float x = src.fx * p(0) * inv_z + src.cx;
+            const float y = src.fy * p(1) * inv_z + src.cy;
+            if( x < 0 || y < 0 || x >= width-1 || y >= height-1 )
+                continue;
+
+            // d(x, y) / d(p)
+            Eigen::Matrix<float, 2, 3> J_pi;
+            J_pi << src.fx * inv_z, 0, -src.fx * p(0) * inv_z * inv_z,
+                    0, src.fy * inv_z, -src.fy * p(1) * inv_z * inv_z;
+
+            /// 1: Photometric, r = I_src(x, y) - I_tgt(u, v)
+            {
+                const double r = interpolate( src.intensity, x, y ) - intensity[u];
+                const Eigen::Vector3f Jw = J_pi.transpose() * Eigen::Vector2f( interpolate( src.gradient_x, x, y ),
+                                                                               interpolate( src.gradient_y, x, y ) );
+                const double w = fabs(r) <= intensity_huber ? 1.0 : intensity_huber / fabs(r);
+                J.head<3>() = p.cross( Jw ).cast<double>();
+                J.tail<3>() = Jw.cast<double>();
+                system->JtJ += w * J * J.transpose();
+                system->Jtr += w * r * J;
+                system->error += r * r;
+                system->count ++;
+            }
+
+            /// 2: Depth, r = Z_src(x, y) - p.z
+            if( depth_weight > 0 && validDepth( src.depth, (int)x, (int)y ) )
+            {
+                const double r = interpolate( src.depth, x, y ) - p(2);
+                const Eigen::Vector3f Jz = J_pi.transpose() * Eigen::Vector2f( interpolate( src.depth_gradient_x, x, y ),
+                                                                               interpolate( src.depth_gradient_y, x, y ) )
+                        - Eigen::Vector3f::UnitZ();
+                const double w = depth_weight * ( fabs(r) <= depth_huber ? 1.0 : depth_huber / fabs(r) );
+                J.head<3>() = p.cross( Jz ).cast<double>();
+                J.tail<3>() = Jz.cast<double>();
+                system->JtJ += w * J * J.transpose();
+                system->Jtr += w * r * J;
+            }
+        }
+    }
+}
+
+} // end of namespace plane_slam
@@ -6,11 +6,13 @@ namespace plane_slam
 Frame::Frame()
     : valid_(false),
       key_frame_(false),
+      planes_preprocessed_(false),
       camera_params_(),
       pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       odom_pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       world_pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       cloud_downsampled_( new PointCloudType ),
+      normal_cloud_( new NormalCloud ),
       feature_cloud_( new PointCloudXYZ ),
       keypoint_type_("")
 {
@@ -21,10 +23,12 @@ Frame::Frame( PointCloudTypePtr &input, CameraParameters &camera_params,
               LineBasedPlaneSegmentor* line_based_plane_segmentor)
     : valid_(false),
       key_frame_(false),
+      planes_preprocessed_(false),
       camera_params_(),
       pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       odom_pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       cloud_downsampled_( new PointCloudType ),
+      normal_cloud_( new NormalCloud ),
       feature_cloud_( new PointCloudXYZ ),
       keypoint_type_(""),
       line_based_plane_segmentor_(line_based_plane_segmentor)
@@ -44,10 +48,12 @@ Frame::Frame( cv::Mat &visual, PointCloudTypePtr &input, CameraParameters &camer
               ORBextractor* orb_extractor, LineBasedPlaneSegmentor* line_based_plane_segmentor)
     : valid_(false),
       key_frame_(false),
+      planes_preprocessed_(false),
       camera_params_(),
       pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       odom_pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       cloud_downsampled_( new PointCloudType ),
+      normal_cloud_( new NormalCloud ),
       feature_cloud_( new PointCloudXYZ ),
       keypoint_type_( "ORB" ),
       orb_extractor_(orb_extractor),
@@ -73,10 +79,12 @@ Frame::Frame( cv::Mat &visual, cv::Mat &depth, CameraParameters &camera_params,
               LineBasedPlaneSegmentor* line_based_plane_segmentor )
     : valid_(false),
       key_frame_(false),
+      planes_preprocessed_(false),
       camera_params_(),
       pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       odom_pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       cloud_downsampled_( new PointCloudType ),
+      normal_cloud_( new NormalCloud ),
       feature_cloud_( new PointCloudXYZ ),
       keypoint_type_( "SURF" ),
       surf_detector_( surf_detector ),
@@ -108,10 +116,12 @@ Frame::Frame( cv::Mat &visual, cv::Mat &depth, CameraParameters &camera_params,
               ORBextractor* orb_extractor, LineBasedPlaneSegmentor* line_based_plane_segmentor )
     : valid_(false),
       key_frame_(false),
+      planes_preprocessed_(false),
       camera_params_(),
       pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       odom_pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       cloud_downsampled_( new PointCloudType ),
+      normal_cloud_( new NormalCloud ),
       feature_cloud_( new PointCloudXYZ ),
       keypoint_type_( "ORB" ),
       orb_extractor_( orb_extractor ),
@@ -154,10 +164,12 @@ Frame::Frame( PointCloudTypePtr &input, CameraParameters &camera_params,
               OrganizedPlaneSegmentor* organized_plane_segmentor)
     : valid_(false),
       key_frame_(false),
+      planes_preprocessed_(false),
       camera_params_(),
       pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       odom_pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       cloud_downsampled_( new PointCloudType ),
+      normal_cloud_( new NormalCloud ),
       feature_cloud_( new PointCloudXYZ ),
       keypoint_type_(""),
       organized_plane_segmentor_(organized_plane_segmentor)
@@ -177,10 +189,12 @@ Frame::Frame( cv::Mat &visual, PointCloudTypePtr &input, CameraParameters &camer
               ORBextractor* orb_extractor, OrganizedPlaneSegmentor* organized_plane_segmentor)
     : valid_(false),
       key_frame_(false),
+      planes_preprocessed_(false),
       camera_params_(),
       pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       odom_pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       cloud_downsampled_( new PointCloudType ),
+      normal_cloud_( new NormalCloud ),
       feature_cloud_( new PointCloudXYZ ),
       keypoint_type_( "ORB" ),
       orb_extractor_(orb_extractor),
@@ -206,10 +220,12 @@ Frame::Frame( cv::Mat &visual, cv::Mat &depth, CameraParameters &camera_params,
               OrganizedPlaneSegmentor* organized_plane_segmentor )
     : valid_(false),
       key_frame_(false),
+      planes_preprocessed_(false),
       camera_params_(),
       pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       odom_pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       cloud_downsampled_( new PointCloudType ),
+      normal_cloud_( new NormalCloud ),
       feature_cloud_( new PointCloudXYZ ),
       keypoint_type_( "SURF" ),
       surf_detector_( surf_detector ),
@@ -241,10 +257,12 @@ Frame::Frame( cv::Mat &visual, cv::Mat &depth, CameraParameters &camera_params,
               ORBextractor* orb_extractor, OrganizedPlaneSegmentor* organized_plane_segmentor)
     : valid_(false),
       key_frame_(false),
+      planes_preprocessed_(false),
       camera_params_(),
       pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       odom_pose_( tf::Quaternion(0, 0, 0, 1.0), tf::Vector3(0, 0, 0) ),
       cloud_downsampled_( new PointCloudType ),
+      normal_cloud_( new NormalCloud ),
       feature_cloud_( new PointCloudXYZ ),
       keypoint_type_( "ORB" ),
       orb_extractor_( orb_extractor ),
@@ -348,17 +366,58 @@ void Frame::extractORB()
 void Frame::lineBasedPlaneSegment()
 {
     ros::Time start = ros::Time::now();
-    (*line_based_plane_segmentor_)( cloud_downsampled_, segment_planes_, camera_params_downsampled_ );
+    TemporalPlaneSeeder *seeder = line_based_plane_segmentor_->temporalSeeder();
+    const bool seeding = seeder && seeder->isValid();
+    // Normals only for the seeder and the inlier refinement, projective icp has its own
+    if( seeding || line_based_plane_segmentor_->normalRefineInlier() )
+        line_based_plane_segmentor_->computeNormals( cloud_downsampled_, normal_cloud_ );
+    else
+        normal_cloud_->clear();
+    // Verify and grow the last frame's planes first, segment only the unexplained pixels
+    PointCloudTypePtr cloud = cloud_downsampled_;
+    bool segment = true;
+    if( seeding )
+    {
+        const int left = seeder->seed( *cloud_downsampled_, *normal_cloud_, camera_params_downsampled_, segment_planes_ );
+        cloud = seeder->remaining();
+        segment = left >= seeder->minInlier();
+    }
+    if( segment )
+        (*line_based_plane_segmentor_)( cloud, normal_cloud_, segment_planes_, camera_params_downsampled_ );
+    // Voxelization, bad inlier and hull per plane, off the mapping thread
+    preprocessPlanes( line_based_plane_segmentor_->planePreprocessor() );
     plane_segment_duration_ = (ros::Time::now() - start).toSec()*1000;
 }
 
 void Frame::organizedPlaneSegment()
 {
     ros::Time start = ros::Time::now();
-    (*organized_plane_segmentor_)( cloud_downsampled_, segment_planes_ );
+    organized_plane_segmentor_->computeNormals( cloud_downsampled_, normal_cloud_ );
+    // Verify and grow the last frame's planes first, segment only the unexplained pixels
+    PointCloudTypePtr cloud = cloud_downsampled_;
+    bool segment = true;
+    TemporalPlaneSeeder *seeder = organized_plane_segmentor_->temporalSeeder();
+    if( seeder && seeder->isValid() )
+    {
+        const int left = seeder->seed( *cloud_downsampled_, *normal_cloud_, camera_params_downsampled_, segment_planes_ );
+        cloud = seeder->remaining();
+        segment = left >= seeder->minInlier();
+    }
+    if( segment )
+        (*organized_plane_segmentor_)( cloud, normal_cloud_, segment_planes_ );
+    // Voxelization, bad inlier and hull per plane, off the mapping thread
+    preprocessPlanes( organized_plane_segmentor_->planePreprocessor() );
     plane_segment_duration_ = (ros::Time::now() - start).toSec()*1000;
 }
 
+void Frame::preprocessPlanes( PlanePreprocessor *preprocessor )
+{
+    if( !preprocessor || !preprocessor->runInFrame() )
+        return;
+    preprocessor->process( *cloud_downsampled_, segment_planes_ );
+    planes_preprocessed_ = true;
+}
+
 void Frame::downsampleOrganizedCloud( const PointCloudTypePtr &input, CameraParameters &in_camera,
                                       PointCloudTypePtr &output, CameraParameters &out_camera, int size_type)
 {
@@ -21,15 +21,24 @@ GTMapping::GTMapping(ros::NodeHandle &nh, Viewer *viewer, Tracking *tracker)
     , isam2_relinearize_threshold_( 0.01f )
     , isam2_relinearize_skip_(1)
     , isam2_factorization_(ISAM2Params::Factorization::QR)
+    , use_fixed_lag_smoother_( false )
+    , fixed_lag_window_( 30.0 )
+    , fixed_lag_in_keyframes_( true )
     , plane_observation_sigmas_(0.01, 0.01, 0.01)
     , plane_match_direction_threshold_( 10.0*DEG_TO_RAD )   // 10 degree
     , plane_match_distance_threshold_( 0.1 )    // 0.1meter
+    , plane_inlier_rebuild_translation_( 0.02 )
+    , plane_inlier_rebuild_rotation_( 1.0*DEG_TO_RAD )
     , plane_match_check_overlap_( true )
     , plane_match_overlap_alpha_( 0.5 )
     , plane_inlier_leaf_size_( 0.05f )  // 0.05meter
     , plane_hull_alpha_( 0.5 )
+    , use_frustum_culling_( false )
+    , frustum_max_range_( 6.0 )
+    , frustum_margin_( 0.5 )
     , octomap_resolution_( 0.025f )
     , octomap_max_depth_range_( 4.0f )
+    , local_map_keyframe_( -1 )
     , rng_(12345)
     , next_plane_id_( 0 )
     , next_point_id_( 0 )
@@ -84,9 +93,21 @@ bool GTMapping::mappingMix( Frame *frame )
 {
     ros::Time dura_start = ros::Time::now();
     bool success;
+    // Budget of the active submap reached, the keyframe starts the next one
+    if( use_submaps_ && optimized_poses_list_.size()
+            && (!use_keyframe_ || isKeyFrame( frame )) && isSubmapFull( frame ) )
+    {
+        closeSubmap();
+    }
+
     if( !optimized_poses_list_.size() )    // first frame, add prior
     {
         success = addFirstFrameMix( frame );
+        if( success )
+        {
+            submap_first_frame_ = frame->id();
+            submap_anchor_ = tfToPose3( frame->pose_ );
+        }
     }
     else    // do mapping
     {
@@ -147,12 +168,10 @@ bool GTMapping::doMappingMix( Frame *frame )
         observations.push_back( OrientedPlane3(plane.coefficients) );
 
 //        cout << " " << plane.cloud->points.size();
-
-        // do voxel grid filter
-        voxelGridFilter( plane.cloud, plane.cloud_voxel, plane_inlier_leaf_size_ );
-        if( remove_plane_bad_inlier_ )
-            removePlaneBadInlier( plane.cloud_voxel );
     }
+    // Voxelized inlier unless the frame workers did it, segmentation hull kept
+    if( !frame->planes_preprocessed_ )
+        plane_preprocessor_.process( *(frame->cloud_downsampled_), planes, false );
 //    cout << " Done." << endl;
 
     // Time
@@ -162,7 +181,7 @@ bool GTMapping::doMappingMix( Frame *frame )
 
     /// 1: plane features
     // Get predicted-observation
-    std::map<int, gtsam::OrientedPlane3> predicted_observations = getPredictedObservation( new_pose );
+    std::map<int, gtsam::OrientedPlane3> predicted_observations = getPredictedObservation( new_pose, frame->camera_params_ );
 
     // Match observations with predicted ones
     std::vector<PlanePair> pairs; // <lm, obs>
@@ -202,7 +221,9 @@ bool GTMapping::doMappingMix( Frame *frame )
 //    cout << GREEN << "odom noise dim: " << odometry_noise->dim() << RESET << endl;
     Key pose_key = Symbol('x', frame->id() );
     Key last_key = Symbol('x', frame->id()-1);
-    factor_graph_.push_back(BetweenFactor<Pose3>(last_key, pose_key, rel_pose, odometry_noise));
+    BetweenFactor<Pose3>::shared_ptr odometry( new BetweenFactor<Pose3>(last_key, pose_key, rel_pose, odometry_noise) );
+    factor_graph_.push_back( odometry );
+    odometry_factors_[frame->id()] = odometry;
     // Add pose guess
     initial_estimate_.insert<Pose3>( pose_key, new_pose );
 
@@ -216,8 +237,7 @@ bool GTMapping::doMappingMix( Frame *frame )
         unpairs[pair.iobs] = 0;
         obs.setId( pair.ilm );
         Key ln =  Symbol( 'l', obs.id() );
-        noiseModel::Diagonal::shared_ptr obs_noise = noiseModel::Diagonal::Sigmas( obs.sigmas );
-        factor_graph_.push_back( OrientedPlane3Factor(obs.coefficients, obs_noise, pose_key, ln) );
+        addPlaneFactor( obs.coefficients, obs.sigmas, pose_key, ln );
     }
 
     // Add new landmark for unpaired observation
@@ -230,8 +250,7 @@ bool GTMapping::doMappingMix( Frame *frame )
             obs.setId( next_plane_id_ );
             next_plane_id_++;
             Key ln = Symbol('l', obs.id());
-            noiseModel::Diagonal::shared_ptr obs_noise = noiseModel::Diagonal::Sigmas( obs.sigmas*3.0 );
-            factor_graph_.push_back( OrientedPlane3Factor(obs.coefficients, obs_noise, pose_key, ln) );
+            addPlaneFactor( obs.coefficients, obs.sigmas*3.0, pose_key, ln );
 
             // Add initial guess
             OrientedPlane3 lmn( obs.coefficients );
@@ -249,6 +268,8 @@ bool GTMapping::doMappingMix( Frame *frame )
             lm->color.Alpha = 255;
             lm->setId( obs.id() );
             landmarks_list_[obs.id()] = lm;
+            landmark_index_.update( lm->id(), *(lm->cloud_voxel) );
+            plane_buckets_.update( lm->id(), lm->coefficients );
         }
     }
 
@@ -340,17 +361,11 @@ bool GTMapping::doMappingMix( Frame *frame )
             {
                 noiseModel::Isotropic::shared_ptr pointNoise = noiseModel::Isotropic::Sigma(3, 0.01);
                 factor_graph_.push_back(PriorFactor<Point3>(Symbol('p', 0), p1_w, pointNoise));
+                prior_keys_.insert( Symbol('p', 0) );
             }
-            // Noise
-            Eigen::Matrix3d cov1 = kinectBearingRangeCov( p1 );
-            Eigen::Matrix3d cov2 = kinectBearingRangeCov( p2 );
-            noiseModel::Gaussian::shared_ptr noise1 = noiseModel::Gaussian::Covariance( cov1 );
-            noiseModel::Gaussian::shared_ptr noise2 = noiseModel::Gaussian::Covariance( cov2 );
-            // Define the camera observation noise model
             // Keys: pose_key, last_key, kp_key
-            // BearingRange factor
-            factor_graph_.push_back(BearingRangeFactor<Pose3, Point3>(last_key, kp_key, (gtsam::Unit3)p1, p1.norm(), noise1));
-            factor_graph_.push_back(BearingRangeFactor<Pose3, Point3>(pose_key, kp_key, (gtsam::Unit3)p2, p2.norm(), noise2));
+            addKeypointFactor( p1, last_key, kp_key );
+            addKeypointFactor( p2, pose_key, kp_key );
             // Add initial guess
             initial_estimate_.insert<Point3>( kp_key, p1_w );
         }
@@ -396,10 +411,8 @@ bool GTMapping::doMappingMix( Frame *frame )
             // Add factor
             const Eigen::Vector4f& point = frame->feature_locations_3d_[m.queryIdx];
             gtsam::Point3 gp3(point[0], point[1], point[2]);
-            Eigen::Matrix3d cov = kinectBearingRangeCov( gp3 );
-            noiseModel::Gaussian::shared_ptr m_noise = noiseModel::Gaussian::Covariance( cov );
             Key kp_key = Symbol('p', m.trainIdx);
-            factor_graph_.push_back(BearingRangeFactor<Pose3, Point3>(pose_key, kp_key, (gtsam::Unit3)gp3, gp3.norm(), m_noise));
+            addKeypointFactor( gp3, pose_key, kp_key );
         }
 
         /// Add new factor to unpaired landmark
@@ -413,8 +426,6 @@ bool GTMapping::doMappingMix( Frame *frame )
                 const Eigen::Vector4f &point = frame->feature_locations_3d_[idx];
                 gtsam::Point3 gp3( point[0], point[1], point[2] );
                 gtsam::Point3 gp3_w = transformPoint( gp3, toWorld );
-                Eigen::Matrix3d cov = kinectBearingRangeCov( gp3 );
-                noiseModel::Gaussian::shared_ptr m_noise = noiseModel::Gaussian::Covariance( cov );
                 // Add new keypoint landmark
                 KeyPoint *keypoint( new KeyPoint() );
                 Key kp_key = Symbol('p', next_point_id_ );
@@ -433,7 +444,7 @@ bool GTMapping::doMappingMix( Frame *frame )
                 keypoints_list_[keypoint->id()] = keypoint;
                 optimized_keypoints_list_[keypoint->id()] = keypoint->translation;
                 // add factor
-                factor_graph_.push_back(BearingRangeFactor<Pose3, Point3>(pose_key, kp_key, (gtsam::Unit3)gp3, gp3.norm(), m_noise));
+                addKeypointFactor( gp3, pose_key, kp_key );
                 // add initial guess
                 initial_estimate_.insert<Point3>( kp_key, gp3_w );
             }
@@ -448,16 +459,30 @@ bool GTMapping::doMappingMix( Frame *frame )
     optimized_poses_list_[frame->id()] = new_pose;
     // Insert keyframe to list
     frames_list_[ frame->id() ] = frame;
+    addPlaneObservations( frame );
 
     // Remove lost keypoints
-    removeKeypoints( lost_landmarks, removed_factors_ );
+    removeKeypoints( lost_landmarks, removed_keys_ );
     keypoint_removed_ = lost_landmarks.size();
     // Time
     kp_r_dura = (ros::Time::now() - step_time).toSec() * 1000.0f;
     step_time = ros::Time::now();
 
     // Add additional between factors
-    if( factors_previous_n_frames_ >= 2 ){
+    if( factors_previous_n_frames_ >= 2 && use_covisibility_ ){
+        // The keyframes sharing most landmarks with the previous one
+        std::vector<int> neighbours;
+        covisibility_.neighbours( frame->id()-1, covisibility_min_weight_, factors_previous_n_frames_, neighbours );
+        int count = 1;
+        for( int i = 0; i < neighbours.size() && count < factors_previous_n_frames_; i++)
+        {
+            if( neighbours[i] == frame->id()-1 || neighbours[i] == frame->id() )
+                continue;
+            addFactorBetweenFrames( neighbours[i], frame->id() );
+            count ++;
+        }
+    }
+    else if( factors_previous_n_frames_ >= 2 ){
         int idx_max = factors_previous_n_frames_;
         int idx = 2;
         while( idx <= idx_max ){
@@ -466,16 +491,14 @@ bool GTMapping::doMappingMix( Frame *frame )
         }
     }
 
-    // Update graph
-    try{
-        isam2_->update(factor_graph_, initial_estimate_, removed_factors_ );}
-    catch(gtsam::IndeterminantLinearSystemException &e){
-        Symbol sym = Symbol(e.nearbyVariable());
-        cout << "ISAM update error: key ch = " << (char)(sym.chr()) << ", index = " << sym.index() << endl;
-        fflush(stdout);
-    }
+    // Keyframes sharing landmarks
+    addCovisibility( factor_graph_ );
+
+    // Update graph, on the optimizer thread if asynchronous
+    optimizer_.push( factor_graph_, initial_estimate_, removed_factors_, removed_keys_, windowTime( frame ) );
 //    isam2_->update(); // call additionally
     removed_factors_.clear();
+    removed_keys_.clear();
 
     // Time
     optimize_dura = (ros::Time::now() - step_time).toSec() * 1000.0f;
@@ -538,10 +561,17 @@ bool GTMapping::doMappingMix( Frame *frame )
     semantic_dura = (ros::Time::now() - step_time).toSec() * 1000.0f;
     step_time = ros::Time::now();
 
+    // Drop redundant keyframes
+    cullKeyFrames( frame->id() );
+
     // update estimated
     last_estimated_pose_ = optimized_poses_list_[ frame->id() ];
     last_estimated_pose_tf_ = pose3ToTF( last_estimated_pose_ );
 
+    // Local map for tracking, built on first use
+    local_map_.clear();
+    local_map_keyframe_ = frame->id();
+
     // Print timing
     cout << " Time:"
          << " cvt: " << MAGENTA << cvt_dura << RESET
@@ -623,11 +653,35 @@ bool GTMapping::addFactorBetweenFrames( int previous_id, int id )
         Key last_key = Symbol('x', preframe->id());
         Key pose_key = Symbol('x', frame->id() );
         factor_graph_.push_back(BetweenFactor<Pose3>(last_key, pose_key, rel_pose, odometry_noise));
+        linked_keys_.insert( last_key );
+        linked_keys_.insert( pose_key );
     }
 
     return true;
 }
 
+void GTMapping::addPlaneFactor( const Eigen::Vector4d &coefficients, const Eigen::Vector3d &sigmas, Key pose_key, Key plane_key )
+{
+    if( use_analytic_factors_ )
+        factor_graph_.push_back( RGBDPlaneFactor( coefficients, sigmas, pose_key, plane_key ) );
+    else
+        factor_graph_.push_back( OrientedPlane3Factor( coefficients, noiseModel::Diagonal::Sigmas( sigmas ), pose_key, plane_key ) );
+}
+
+void GTMapping::addKeypointFactor( const gtsam::Point3 &point, Key pose_key, Key point_key )
+{
+    if( use_analytic_factors_ )
+    {
+        const Eigen::Vector4f p( point.x(), point.y(), point.z(), 1.0 );
+        factor_graph_.push_back( RGBDPointFactor( point, kinectPointCov( p ), pose_key, point_key ) );
+    }
+    else
+    {
+        noiseModel::Gaussian::shared_ptr noise = noiseModel::Gaussian::Covariance( kinectBearingRangeCov( point ) );
+        factor_graph_.push_back( BearingRangeFactor<Pose3, Point3>( pose_key, point_key, (gtsam::Unit3)point, point.norm(), noise ) );
+    }
+}
+
 bool GTMapping::addFirstFrameMix( Frame *frame )
 {
     ros::Time dura_start = ros::Time::now();
@@ -644,26 +698,16 @@ bool GTMapping::addFirstFrameMix( Frame *frame )
     next_frame_id_++;
 
     //
-    double radius = plane_inlier_leaf_size_ * 5;
-    int min_neighbors = M_PI * radius *radius
-                    / (plane_inlier_leaf_size_ * plane_inlier_leaf_size_) *  planar_bad_inlier_alpha_;
     for( int i = 0; i < planes.size(); i++)
     {
         PlaneType &plane = planes[i];
         plane.sigmas = plane_observation_sigmas_;
         plane.setId( next_plane_id_ );
         next_plane_id_ ++;
-
-        // do voxel grid filter
-        if( remove_plane_bad_inlier_ )
-        {
-            PointCloudTypePtr cloud_filtered( new PointCloudType );
-            voxelGridFilter( plane.cloud, cloud_filtered, plane_inlier_leaf_size_ );
-            radiusOutlierRemoval( cloud_filtered, plane.cloud_voxel, radius, min_neighbors );
-        }
-        else
-            voxelGridFilter( plane.cloud, plane.cloud_voxel, plane_inlier_leaf_size_ );
     }
+    // Voxelized inlier unless the frame workers did it, segmentation hull kept
+    if( !frame->planes_preprocessed_ )
+        plane_preprocessor_.process( *(frame->cloud_downsampled_), planes, false );
 
     // check if there is floor plane
 //    cout << BOLDWHITE << " Floor idx: " << BOLDCYAN << idxf << RESET << endl;
@@ -684,6 +728,7 @@ bool GTMapping::addFirstFrameMix( Frame *frame )
 //    noiseModel::Diagonal::shared_ptr poseNoise = //
 //        noiseModel::Diagonal::Variances((Vector(6) << 1e-6, 1e-6, 1e-6, 1e-4, 1e-4, 1e-4).finished());
     factor_graph_.push_back( PriorFactor<Pose3>( x0, init_pose, poseNoise ) );
+    prior_keys_.insert( x0 );
 
     // Add an initial guess for the current pose
     initial_estimate_.insert<Pose3>( x0, init_pose );
@@ -696,6 +741,7 @@ bool GTMapping::addFirstFrameMix( Frame *frame )
     OrientedPlane3 glm0 = lm0.transform(init_pose.inverse());
     noiseModel::Diagonal::shared_ptr lm_noise = noiseModel::Diagonal::Sigmas( (Vector(2) << planes[0].sigmas[0], planes[0].sigmas[1]).finished() );
     factor_graph_.push_back( OrientedPlane3DirectionPrior( l0, glm0.planeCoefficients(), lm_noise) );
+    prior_keys_.insert( l0 );
     //
 
     // Add new landmark
@@ -710,8 +756,7 @@ bool GTMapping::addFirstFrameMix( Frame *frame )
              << ", " << plane.centroid.y << ", " << plane.centroid.z << RESET << endl;
 
         // Add observation factor
-        noiseModel::Diagonal::shared_ptr obs_noise = noiseModel::Diagonal::Sigmas( plane.sigmas*3.0 );
-        factor_graph_.push_back( OrientedPlane3Factor(plane.coefficients, obs_noise, x0, ln) );
+        addPlaneFactor( plane.coefficients, plane.sigmas*3.0, x0, ln );
 
         // Add initial guesses to all observed landmarks
 //        cout << "Key: " << ln << endl;
@@ -730,6 +775,8 @@ bool GTMapping::addFirstFrameMix( Frame *frame )
         lm->color.Alpha = 255;
         lm->setId( plane.id() );
         landmarks_list_[plane.id()] = lm;
+        landmark_index_.update( lm->id(), *(lm->cloud_voxel) );
+        plane_buckets_.update( lm->id(), lm->coefficients );
     }
 
     add_delete_duration_ = getIntervalMS(dura_start);
@@ -741,6 +788,7 @@ bool GTMapping::addFirstFrameMix( Frame *frame )
     optimized_poses_list_[ frame->id() ] = init_pose;
     // Insert first frame to list
     frames_list_[ frame->id() ] = frame;  // add frame to list
+    addPlaneObservations( frame );
 
     // Optimize factor graph
 //    isam2_->update( graph_, initial_estimate_ );
@@ -762,6 +810,8 @@ bool GTMapping::addFirstFrameMix( Frame *frame )
 
     last_estimated_pose_ = init_pose;
     last_estimated_pose_tf_ = pose3ToTF( last_estimated_pose_ );
+    local_map_.clear();
+    local_map_keyframe_ = frame->id();
 
     cout << GREEN << " Register first frame in the map." << endl;
     printTransform( init_pose.matrix(), " - Initial pose", GREEN);
@@ -826,15 +876,13 @@ bool GTMapping::doMapping( Frame *frame )
         PlaneType &plane = planes[i];
         plane.sigmas = plane_observation_sigmas_;
         observations.push_back( OrientedPlane3(plane.coefficients) );
-
-        // do voxel grid filter
-        voxelGridFilter( plane.cloud, plane.cloud_voxel, plane_inlier_leaf_size_ );
-        if( remove_plane_bad_inlier_ )
-            removePlaneBadInlier( plane.cloud_voxel );
     }
+    // Voxelized inlier unless the frame workers did it, segmentation hull kept
+    if( !frame->planes_preprocessed_ )
+        plane_preprocessor_.process( *(frame->cloud_downsampled_), planes, false );
 
     // Get predicted-observation
-    std::map<int, gtsam::OrientedPlane3> predicted_observations = getPredictedObservation( new_pose );
+    std::map<int, gtsam::OrientedPlane3> predicted_observations = getPredictedObservation( new_pose, frame->camera_params_ );
 
     // Match observations with predicted ones
     std::vector<PlanePair> pairs; // <lm, obs>
@@ -863,7 +911,9 @@ bool GTMapping::doMapping( Frame *frame )
 //    cout << GREEN << "odom noise dim: " << odometry_noise->dim() << RESET << endl;
     Key pose_key = Symbol('x', frame->id() );
     Key last_key = Symbol('x', frame->id()-1);
-    factor_graph_.push_back(BetweenFactor<Pose3>(last_key, pose_key, rel_pose, odometry_noise));
+    BetweenFactor<Pose3>::shared_ptr odometry( new BetweenFactor<Pose3>(last_key, pose_key, rel_pose, odometry_noise) );
+    factor_graph_.push_back( odometry );
+    odometry_factors_[frame->id()] = odometry;
     // Add pose guess
     initial_estimate_.insert<Pose3>( pose_key, new_pose );
 
@@ -876,8 +926,7 @@ bool GTMapping::doMapping( Frame *frame )
         unpairs[pair.iobs] = 0;
         obs.setId( pair.ilm );
         Key ln =  Symbol( 'l', obs.id() );
-        noiseModel::Diagonal::shared_ptr obs_noise = noiseModel::Diagonal::Sigmas( obs.sigmas );
-        factor_graph_.push_back( OrientedPlane3Factor(obs.coefficients, obs_noise, pose_key, ln) );
+        addPlaneFactor( obs.coefficients, obs.sigmas, pose_key, ln );
     }
 
     // Add new landmark for unpaired observation
@@ -890,8 +939,7 @@ bool GTMapping::doMapping( Frame *frame )
             obs.setId( next_plane_id_ );
             next_plane_id_++;
             Key ln = Symbol('l', obs.id());
-            noiseModel::Diagonal::shared_ptr obs_noise = noiseModel::Diagonal::Sigmas( obs.sigmas );
-            factor_graph_.push_back( OrientedPlane3Factor(obs.coefficients, obs_noise, pose_key, ln) );
+            addPlaneFactor( obs.coefficients, obs.sigmas, pose_key, ln );
 
             // Add initial guess
             OrientedPlane3 lmn( obs.coefficients );
@@ -909,6 +957,8 @@ bool GTMapping::doMapping( Frame *frame )
             lm->color.Alpha = 255;
             lm->setId( obs.id() );
             landmarks_list_[obs.id()] = lm;
+            landmark_index_.update( lm->id(), *(lm->cloud_voxel) );
+            plane_buckets_.update( lm->id(), lm->coefficients );
         }
     }
 
@@ -916,11 +966,13 @@ bool GTMapping::doMapping( Frame *frame )
     optimized_poses_list_[frame->id()] = new_pose;
     // Insert keyframe to list
     frames_list_[ frame->id() ] = frame;
+    addPlaneObservations( frame );
 
 
     // Update graph
-    isam2_->update(factor_graph_, initial_estimate_);
-    isam2_->update(); // call additionally
+    addCovisibility( factor_graph_ );
+    optimizer_.push( factor_graph_, initial_estimate_, FactorIndices(), FastVector<Key>(), windowTime( frame ) );
+    optimizer_.push( NonlinearFactorGraph() ); // call additionally
 
     // Update optimized poses and planes
     updateOptimizedResult();
@@ -969,26 +1021,16 @@ bool GTMapping::addFirstFrame( Frame *frame )
     next_frame_id_++;
 
     //
-    double radius = plane_inlier_leaf_size_ * 5;
-    int min_neighbors = M_PI * radius *radius
-                    / (plane_inlier_leaf_size_ * plane_inlier_leaf_size_) *  planar_bad_inlier_alpha_;
     for( int i = 0; i < planes.size(); i++)
     {
         PlaneType &plane = planes[i];
         plane.sigmas = plane_observation_sigmas_;
         plane.setId( next_plane_id_ );
         next_plane_id_ ++;
-
-        // do voxel grid filter
-        if( remove_plane_bad_inlier_ )
-        {
-            PointCloudTypePtr cloud_filtered( new PointCloudType );
-            voxelGridFilter( plane.cloud, cloud_filtered, plane_inlier_leaf_size_ );
-            radiusOutlierRemoval( cloud_filtered, plane.cloud_voxel, radius, min_neighbors );
-        }
-        else
-            voxelGridFilter( plane.cloud, plane.cloud_voxel, plane_inlier_leaf_size_ );
     }
+    // Voxelized inlier unless the frame workers did it, segmentation hull kept
+    if( !frame->planes_preprocessed_ )
+        plane_preprocessor_.process( *(frame->cloud_downsampled_), planes, false );
 
 
     // Add a prior factor
@@ -1000,6 +1042,7 @@ bool GTMapping::addFirstFrame( Frame *frame )
 //    noiseModel::Diagonal::shared_ptr poseNoise = //
 //        noiseModel::Diagonal::Variances((Vector(6) << 1e-6, 1e-6, 1e-6, 1e-4, 1e-4, 1e-4).finished());
     factor_graph_.push_back( PriorFactor<Pose3>( x0, init_pose, poseNoise ) );
+    prior_keys_.insert( x0 );
 
     // Add an initial guess for the current pose
     initial_estimate_.insert<Pose3>( x0, init_pose );
@@ -1010,6 +1053,7 @@ bool GTMapping::addFirstFrame( Frame *frame )
     OrientedPlane3 glm0 = lm0.transform(init_pose.inverse());
     noiseModel::Diagonal::shared_ptr lm_noise = noiseModel::Diagonal::Sigmas( (Vector(2) << planes[0].sigmas[0], planes[0].sigmas[1]).finished() );
     factor_graph_.push_back( OrientedPlane3DirectionPrior( l0, glm0.planeCoefficients(), lm_noise) );
+    prior_keys_.insert( l0 );
 
     // Add new landmark
     for(int i = 0; i < planes.size(); i++)
@@ -1023,8 +1067,7 @@ bool GTMapping::addFirstFrame( Frame *frame )
              << ", " << plane.centroid.y << ", " << plane.centroid.z << RESET << endl;
 
         // Add observation factor
-        noiseModel::Diagonal::shared_ptr obs_noise = noiseModel::Diagonal::Sigmas( plane.sigmas );
-        factor_graph_.push_back( OrientedPlane3Factor(plane.coefficients, obs_noise, x0, ln) );
+        addPlaneFactor( plane.coefficients, plane.sigmas, x0, ln );
 
         // Add initial guesses to all observed landmarks
 //        cout << "Key: " << ln << endl;
@@ -1043,6 +1086,8 @@ bool GTMapping::addFirstFrame( Frame *frame )
         lm->color.Alpha = 255;
         lm->setId( plane.id() );
         landmarks_list_[plane.id()] = lm;
+        landmark_index_.update( lm->id(), *(lm->cloud_voxel) );
+        plane_buckets_.update( lm->id(), lm->coefficients );
     }
 
 
@@ -1050,6 +1095,7 @@ bool GTMapping::addFirstFrame( Frame *frame )
     optimized_poses_list_[ frame->id() ] = init_pose;
     // Insert first frame to list
     frames_list_[ frame->id() ] = frame;  // add frame to list
+    addPlaneObservations( frame );
 
     // Optimize factor graph
 //    isam2_->update( graph_, initial_estimate_ );
@@ -1083,10 +1129,90 @@ bool GTMapping::isKeyFrame( Frame *frame )
         return false;
 }
 
+double GTMapping::windowTime( Frame *frame ) const
+{
+    return fixed_lag_in_keyframes_ ? frame->id() : frame->header_.stamp.toSec();
+}
+
+bool GTMapping::isSubmapFull( Frame *frame ) const
+{
+    if( next_frame_id_ - submap_first_frame_ >= submap_max_keyframes_ )
+        return true;
+    const gtsam::Point3 position = tfToPose3( frame->pose_ ).translation();
+    return submap_anchor_.translation().distance( position ) > submap_max_radius_;
+}
+
+void GTMapping::closeSubmap()
+{
+    ros::Time start_time = ros::Time::now();
+
+    /// 1: Final estimate of the active map
+    optimizeGraph( 1 );
+    updateOptimizedResultMix();
+    updateLandmarksInlier();
+    if( !optimized_poses_list_.count( submap_first_frame_ ) )
+        return;
+
+    /// 2: Move it into a submap, tied to the previous one in the submap graph
+    Submap *submap = new Submap();
+    submap->first_frame = submap_first_frame_;
+    submap->last_frame = next_frame_id_ - 1;
+    submap->anchor = submap_anchor_;
+    submap->first_pose = optimized_poses_list_.at( submap_first_frame_ );
+    submap->poses = optimized_poses_list_;
+    for( SlotMap<Frame*>::iterator it = frames_list_.begin(); it != frames_list_.end(); it++)
+        submap->headers[it->first] = it->second->header_;
+    submap->planes = optimized_landmarks_list_;
+    submap->frames = frames_list_;
+    submap->landmarks = landmarks_list_;
+    submap->keypoints = keypoints_list_;
+    submap->points = optimized_keypoints_list_;
+    for( SlotMap<PlaneType*>::iterator it = landmarks_list_.begin(); it != landmarks_list_.end(); it++)
+    {
+        PlaneType *lm = it->second;
+        setPointCloudColor( *(lm->cloud_voxel), lm->color );
+        *(submap->cloud) += *(lm->cloud_voxel);
+    }
+    submap->octree = octree_map_;
+    // Drift over the submap, as odometry over its keyframes
+    const double keyframes = std::max( 1, submap->frames.size() );
+    submaps_.add( submap, noiseModel::Diagonal::Sigmas( odom_sigmas_ * sqrt( keyframes ) ) );
+    // The newest one stays, its last keyframe is still the tracking reference
+    submaps_.evict( std::max( 1, submap_hot_count_ ), submap_directory_ );
+
+    /// 3: Empty active map, with its own ISAM2. Ids go on across submaps.
+    optimizer_.reset( isam2_parameters_, use_fixed_lag_smoother_ ? fixed_lag_window_ : 0 );
+    factor_graph_.resize(0);
+    initial_estimate_.clear();
+    removed_factors_.clear();
+    removed_keys_.clear();
+    frames_list_.clear();
+    landmarks_list_.clear();
+    keypoints_list_.clear();
+    optimized_poses_list_.clear();
+    optimized_landmarks_list_.clear();
+    optimized_keypoints_list_.clear();
+    landmark_observations_.clear();
+    landmark_index_.clear();
+    plane_buckets_.clear();
+    covisibility_.clear();
+    odometry_factors_.clear();
+    linked_keys_.clear();
+    prior_keys_.clear();
+    local_map_.clear();
+    local_map_keyframe_ = -1;
+    octree_map_ = new octomap::OcTree( octomap_resolution_ );
+    last_culling_frame_ = next_frame_id_;
+
+    cout << GREEN << " Closed submap " << submap->id << ", keyframes " << submap->first_frame
+         << " - " << submap->last_frame << ", hot " << std::min( submaps_.size(), submap_hot_count_ )
+         << " (" << getIntervalMS( start_time ) << " ms)." << RESET << endl;
+}
+
 void GTMapping::semanticMapLabel()
 {
     // Assign semantic label to every landmark
-    for( std::map<int, PlaneType*>::iterator it = landmarks_list_.begin();
+    for( SlotMap<PlaneType*>::iterator it = landmarks_list_.begin();
          it != landmarks_list_.end(); it++)
     {
         PlaneType *lm = it->second;
@@ -1160,6 +1286,7 @@ int GTMapping::checkFloorPlane(std::vector<PlaneType> &planes)
             PointCloudTypePtr cloud_filtered( new PointCloudType );
             projectPoints(*plane.cloud_voxel, plane.coefficients, *cloud_filtered);
             plane.cloud_voxel->swap(*cloud_filtered);
+            updatePlaneRaster( &plane );
             return i;
         }
     }
@@ -1196,6 +1323,7 @@ void GTMapping::createFloorPlane(PlaneType* &plane,
     plane->cloud_voxel->height = 1;
     plane->cloud_voxel->width = plane->cloud_voxel->points.size();
     plane->cloud_voxel->is_dense = true;
+    updatePlaneRaster( plane );
 
     // build octree
     float resolution = leafsize;
@@ -1210,7 +1338,8 @@ void GTMapping::matchKeypointWithMap( const Frame &frame, std::vector<cv::DMatch
     // Get prediction
     std::map<int, pcl::PointUV> predicted_image_points;
     std::map<int, gtsam::Point3> predicted_keypoints;
-    getPredictedKeypoints( tfToPose3(frame.pose_), frame.camera_params_, predicted_image_points, predicted_keypoints );
+    getPredictedKeypoints( tfToPose3(frame.pose_), frame.camera_params_, predicted_image_points, predicted_keypoints,
+                           use_covisibility_ ? frame.id()-1 : -1 );
 
     // Mark predicted
     for( std::map<int, gtsam::Point3>::iterator pit = predicted_keypoints.begin();
@@ -1544,15 +1673,30 @@ void GTMapping::matchImageFeatures( const Frame &frame,
 void GTMapping::getPredictedKeypoints( const gtsam::Pose3 &pose,
                                        const CameraParameters & camera_param,
                                        std::map<int, pcl::PointUV> &predicted_feature_2d,
-                                       std::map<int, gtsam::Point3> &predicted_feature_3d)
+                                       std::map<int, gtsam::Point3> &predicted_feature_3d,
+                                       int reference_frame )
 {
     // Define the camera calibration parameters
     Cal3_S2::shared_ptr K(new Cal3_S2(camera_param.fx, camera_param.fy, 0.0, camera_param.cx, camera_param.cy));
     gtsam::SimpleCamera camera( pose, *K );
     //
-    for( std::map<int, gtsam::Point3>::iterator it = optimized_keypoints_list_.begin();
-         it != optimized_keypoints_list_.end(); it++)
+    // Keypoints of the covisible local map, or all of them
+    std::vector<int> ids;
+    if( reference_frame >= 0 )
+        getLocalKeypoints( reference_frame, ids );
+    if( ids.empty() )
+    {
+        ids.reserve( optimized_keypoints_list_.size() );
+        for( SlotMap<gtsam::Point3>::iterator it = optimized_keypoints_list_.begin();
+             it != optimized_keypoints_list_.end(); it++)
+            ids.push_back( it->first );
+    }
+    //
+    for( int i = 0; i < ids.size(); i++)
     {
+        SlotMap<gtsam::Point3>::iterator it = optimized_keypoints_list_.find( ids[i] );
+        if( it == optimized_keypoints_list_.end() )
+            continue;
         std::pair<gtsam::Point2, bool> ps = camera.projectSafe(it->second);
 //        gtsam::Point2 pc = camera.project( it->second );
         if( std::get<1>(ps) == true )
@@ -1577,7 +1721,7 @@ std::map<int, gtsam::Point3> GTMapping::getPredictedKeypoints( const gtsam::Pose
     Cal3_S2::shared_ptr K(new Cal3_S2(camera_param.fx, camera_param.fy, 0.0, camera_param.cx, camera_param.cy));
     gtsam::SimpleCamera camera( pose, *K );
     std::map<int, gtsam::Point3> predicted_keypoints;
-    for( std::map<int, gtsam::Point3>::iterator it = optimized_keypoints_list_.begin();
+    for( SlotMap<gtsam::Point3>::iterator it = optimized_keypoints_list_.begin();
          it != optimized_keypoints_list_.end(); it++)
     {
         gtsam::Point2 pc = camera.project( it->second );
@@ -1595,7 +1739,7 @@ std::map<int, gtsam::Point3> GTMapping::getPredictedKeypoints( const gtsam::Pose
 std::map<int, gtsam::OrientedPlane3> GTMapping::getPredictedObservation( const Pose3 &pose )
 {
     std::map<int, gtsam::OrientedPlane3> predicted_observations;
-    for( std::map<int, gtsam::OrientedPlane3>::iterator it = optimized_landmarks_list_.begin();
+    for( SlotMap<gtsam::OrientedPlane3>::iterator it = optimized_landmarks_list_.begin();
          it != optimized_landmarks_list_.end(); it++)
     {
         OrientedPlane3 &plane = it->second;
@@ -1604,6 +1748,29 @@ std::map<int, gtsam::OrientedPlane3> GTMapping::getPredictedObservation( const P
     return predicted_observations;
 }
 
+std::map<int, gtsam::OrientedPlane3> GTMapping::getPredictedObservation( const Pose3 &pose, const CameraParameters &camera )
+{
+    if( !use_frustum_culling_ )
+        return getPredictedObservation( pose );
+
+    std::vector<int> visible;
+    landmark_index_.query( pose.matrix(), camera, frustum_max_range_, frustum_margin_, visible );
+
+    std::map<int, gtsam::OrientedPlane3> predicted_observations;
+    for( int i = 0; i < visible.size(); i++)
+    {
+        SlotMap<gtsam::OrientedPlane3>::iterator it = optimized_landmarks_list_.find( visible[i] );
+        if( it != optimized_landmarks_list_.end() )
+            predicted_observations[ it->first ] = it->second.transform( pose );
+    }
+
+    if( verbose_ )
+        cout << GREEN << " Landmarks in frustum = " << predicted_observations.size()
+             << "/" << optimized_landmarks_list_.size() << RESET << endl;
+
+    return predicted_observations;
+}
+
 // simple euclidian distance
 void GTMapping::matchObservationWithPredicted( std::map<int, gtsam::OrientedPlane3> &predicted_observations,
                                             const std::vector<OrientedPlane3> &observations,
@@ -1658,7 +1825,7 @@ void GTMapping::matchObservationWithPredicted( std::map<int, gtsam::OrientedPlan
             {
                 if( glm->cloud_voxel->size() > max_size )
                 {
-                    if( plane_match_check_overlap_ && !checkOverlap( glm->cloud_voxel, glm->coefficients, observed.cloud_voxel, pose ) )
+                    if( plane_match_check_overlap_ && !checkOverlap( *glm, observed, pose ) )
                         continue;
     //                min_d = d;
                     min_index = id;
@@ -1675,41 +1842,21 @@ void GTMapping::matchObservationWithPredicted( std::map<int, gtsam::OrientedPlan
     }
 }
 
-bool GTMapping::checkOverlap( const PointCloudTypePtr &landmark_cloud,
-                            const OrientedPlane3 &landmark,
-                            const PointCloudTypePtr &observation,
-                            const Pose3 &pose)
+bool GTMapping::checkOverlap( const PlaneType &landmark,
+                              const PlaneType &observation,
+                              const Pose3 &pose)
 {
-    // transform and project pointcloud
-    PointCloudTypePtr cloud( new PointCloudType ), cloud_projected( new PointCloudType );
-    transformPointCloud( *observation, *cloud, pose.matrix() );
-    projectPoints( *cloud, landmark.planeCoefficients(), *cloud_projected );
-
-    // build octree
-    float resolution = plane_inlier_leaf_size_;
-    pcl::octree::OctreePointCloud<PointType> octreeD (resolution);
-    octreeD.setInputCloud( landmark_cloud );
-    octreeD.addPointsFromInputCloud();
-
-    // check if occupied
-    int collision = 0;
-    PointCloudType::iterator it = cloud_projected->begin();
-    for( ; it != cloud_projected->end(); it++)
-    {
-        PointType &pt = *it;
-        if( octreeD.isVoxelOccupiedAtPoint( pt ) )
-            collision ++;
-    }
-
-//    cout << GREEN << "  - collision: " << collision << "/" << cloud_projected->size() << RESET << endl;
+    PlaneRaster landmark_local, observation_local;
+    const PlaneRaster &landmark_raster = getPlaneRaster( landmark, landmark_local );
+    const PlaneRaster &observation_raster = getPlaneRaster( observation, observation_local );
 
-    double alpha = ((float)collision) / (float)cloud_projected->size();
+    // observation cells in the map frame, hit on the landmark raster
+    double alpha = landmark_raster.overlap( observation_raster, pose.matrix() );
+//    cout << GREEN << "  - overlap: " << alpha << RESET << endl;
     if( alpha < plane_match_overlap_alpha_ )
         return false;
     else
         return true;
-
-    return true;
 }
 
 // indices of lm1 must bigger than that of lm2
@@ -1718,40 +1865,28 @@ bool GTMapping::checkLandmarksOverlap( const PlaneType &lm1, const PlaneType &lm
     if(lm2.cloud_voxel->size() == 0)
         return false;
 
-    // project lm2 inlier to lm1 plane
-    PointCloudTypePtr cloud_projected( new PointCloudType );
-    projectPoints( *lm2.cloud_voxel, lm1.coefficients, *cloud_projected );
-
-    // build octree from lm1
-    float resolution = plane_inlier_leaf_size_;
-    pcl::octree::OctreePointCloud<PointType> octreeD (resolution);
-    octreeD.setInputCloud( lm1.cloud_voxel );
-    octreeD.addPointsFromInputCloud();
-
-    // check if occupied
-    const int thresh = std::max(5, (int)(planar_merge_overlap_alpha_* cloud_projected->points.size()));
-    int collision = 0;
-    PointCloudType::iterator it = cloud_projected->begin();
-    for( ; it != cloud_projected->end(); it++)
-    {
-        PointType &pt = *it;
-        if( octreeD.isVoxelOccupiedAtPoint( pt ) )
-        {
-            collision ++;
-            if(collision >= thresh)
-                return true;
-        }
-    }
+    PlaneRaster local1, local2;
+    const PlaneRaster &raster1 = getPlaneRaster( lm1, local1 );
+    const PlaneRaster &raster2 = getPlaneRaster( lm2, local2 );
 
-//    cout << GREEN << "  - collision: " << collision << "/" << cloud_projected->size() << RESET << endl;
+    // lm2 cells hit on lm1 raster
+    const int thresh = std::max(5, (int)(planar_merge_overlap_alpha_* raster2.count()));
+    return raster1.intersect( raster2 ) >= thresh;
+}
 
-//    double alpha = ((float)collision) / (float)cloud_projected->size();
-//    if( alpha < plane_match_overlap_alpha_ )
-//        return false;
-//    else
-//        return true;
+void GTMapping::updatePlaneRaster( PlaneType *plane )
+{
+    if( !plane->raster )
+        plane->raster.reset( new PlaneRaster );
+    plane->raster->build( *(plane->cloud_voxel), plane->coefficients, plane_inlier_leaf_size_ );
+}
 
-    return false;
+const PlaneRaster &GTMapping::getPlaneRaster( const PlaneType &plane, PlaneRaster &local )
+{
+    if( plane.raster )
+        return *(plane.raster);
+    local.build( *(plane.cloud_voxel), plane.coefficients, plane_inlier_leaf_size_ );
+    return local;
 }
 
 
@@ -1766,7 +1901,7 @@ bool GTMapping::refinePlanarMap()
     const double direction_threshold = planar_merge_direction_threshold_;
     const double distance_threshold = planar_merge_distance_threshold_;
     std::map<int, int> remove_list;  // removed landmarks, <from, to>
-    for( std::map<int, PlaneType*>::iterator it1 = landmarks_list_.begin();
+    for( SlotMap<PlaneType*>::iterator it1 = landmarks_list_.begin();
          it1 != landmarks_list_.end(); it1++)
     {
         const int idx1 = it1->first;
@@ -1788,11 +1923,16 @@ bool GTMapping::refinePlanarMap()
         // Transform observation to local frame
         const OrientedPlane3 &llm1 = lm1.transform( local );
 
-        for( std::map<int, PlaneType*>::iterator it2 = landmarks_list_.begin();
-             it2 != landmarks_list_.end(); it2++)
+        // Candidates from the neighbouring normal buckets. The offset in the local frame differs
+        // from the global one by at most the normal difference times the centroid distance.
+        std::vector<int> candidates;
+        const double offset_range = distance_threshold + 2.0 * sin( direction_threshold * 0.5 ) * point.norm();
+        plane_buckets_.query( lm1.planeCoefficients(), direction_threshold, offset_range, candidates );
+
+        for( int k = 0; k < candidates.size(); k++)
         {
-            const int idx2 = it2->first;
-            PlaneType &p2 = *(it2->second);
+            const int idx2 = candidates[k];
+            PlaneType &p2 = *(landmarks_list_.at( idx2 ));
             OrientedPlane3 &lm2 = optimized_landmarks_list_[idx2];
 
             // check if will be removed
@@ -1842,7 +1982,7 @@ bool GTMapping::refinePlanarMap()
 
             }
 
-        } // end of for( int j = i+1; j < num; j++)
+        } // end of for( int k = 0; k < candidates.size(); k++)
 
     } // end of for( int i = 0; i < (num - 1 ); i++)
 
@@ -1913,7 +2053,7 @@ bool GTMapping::mergeFloorPlane()
     std::vector<int> fv;
     int idx_max = -1;
     size_t max_size = 0;
-    for( std::map<int, PlaneType*>::iterator it = landmarks_list_.begin();
+    for( SlotMap<PlaneType*>::iterator it = landmarks_list_.begin();
          it != landmarks_list_.end(); it++)
     {
         int idx = it->first;
@@ -2009,7 +2149,7 @@ void GTMapping::computeLostKeypoints( std::vector<int> &unmatched_landmarks,
 
 }
 
-void GTMapping::removeKeypoints( std::vector<int> &lost_landmarks, FactorIndices &removed_factors )
+void GTMapping::removeKeypoints( std::vector<int> &lost_landmarks, FastVector<Key> &removed_keys )
 {
     cout << YELLOW << " Remove lost landmarks: " << lost_landmarks.size() << RESET << endl;
     if( lost_landmarks.size() <= 0 )
@@ -2024,15 +2164,13 @@ void GTMapping::removeKeypoints( std::vector<int> &lost_landmarks, FactorIndices
         return;
 
     //
-    FastVector<Key> remove_keys;
     for( int i = 0; i < lost_landmarks.size(); i++ )
     {
         const int &idx = lost_landmarks[i];
         Key key_kp = Symbol( 'p', idx );
-        remove_keys.push_back( key_kp );
 
         // Remove from keypoints list
-        std::map<int, KeyPoint*>::iterator kpitem = keypoints_list_.find( idx );
+        SlotMap<KeyPoint*>::iterator kpitem = keypoints_list_.find( idx );
         if( kpitem != keypoints_list_.end() )
         {
             delete keypoints_list_.at( idx );
@@ -2041,7 +2179,7 @@ void GTMapping::removeKeypoints( std::vector<int> &lost_landmarks, FactorIndices
         }
 
         // Remove from optimized list
-        std::map<int, gtsam::Point3>::iterator okpitem = optimized_keypoints_list_.find( idx );
+        SlotMap<gtsam::Point3>::iterator okpitem = optimized_keypoints_list_.find( idx );
         if( okpitem != optimized_keypoints_list_.end() )
         {
             optimized_keypoints_list_.erase( idx );
@@ -2053,33 +2191,206 @@ void GTMapping::removeKeypoints( std::vector<int> &lost_landmarks, FactorIndices
 //        isam2_->getLinearizationPoint().erase( key_kp );
 //        cout << BLUE << "\t" << idx;
 
-        // Remove factors, only preserve one factor
-        VariableIndex::Factors factors;
-        bool exist = true;
-        try{
-            factors = isam2_->getVariableIndex()[key_kp];
-        }catch( std::invalid_argument &e){
-            exist = false;
-        }
-        //
-        if( exist && factors.size() > 0 )
+        // Remove factors, only preserve one factor. Resolved by the optimizer when
+        // the update runs, the factors of queued updates are not indexed yet.
+        removed_keys.push_back( key_kp );
+
+        // No longer links the keyframes
+        covisibility_.removeLandmark( key_kp );
+
+        cout << RESET << endl;
+    }
+
+//    cout << BLUE << " isam2 update once." << RESET << endl;
+//    isam2_->update();
+}
+
+void GTMapping::cullKeyFrames( int frame_id )
+{
+    if( !keyframe_culling_ || optimizer_.isFixedLag() )
+        return;
+    if( frame_id - last_culling_frame_ < keyframe_culling_interval_ )
+        return;
+    last_culling_frame_ = frame_id;
+
+    /// 1: Keyframes of the window and two neighbours each side, the newest is never culled
+    std::vector<int> ids;
+    for( int id = std::max( 0, frame_id - keyframe_culling_window_ - 2 ); id <= frame_id; id++)
+    {
+        if( frames_list_.count( id ) )
+            ids.push_back( id );
+    }
+    if( ids.size() < 3 )
+        return;
+
+    // Decided on the observations of the covisibility graph and the odometry factors, the
+    // factors of the keyframe are removed by the optimizer when the update runs
+    NonlinearFactorGraph new_factors;
+    FastVector<Key> remove_keys;
+    std::set<int> culled;
+    std::vector<int> lost_keypoints;
+    for( int i = 1; i+1 < ids.size(); i++)
+    {
+        const int id = ids[i];
+        if( id < frame_id - keyframe_culling_window_ )
+            continue;
+        const int prev_id = ids[i-1];
+        const int next_id = ids[i+1];
+        const Key key = Symbol( 'x', id );
+
+        // Only the two odometry factors are rewritten, other pose links would be lost
+        if( linked_keys_.count( key ) )
+            continue;
+
+        // Odometry to the neighbours
+        SlotMap<BetweenFactor<Pose3>::shared_ptr>::iterator itop = odometry_factors_.find( id );
+        SlotMap<BetweenFactor<Pose3>::shared_ptr>::iterator iton = odometry_factors_.find( next_id );
+        if( itop == odometry_factors_.end() || iton == odometry_factors_.end() )
+            continue;
+        const BetweenFactor<Pose3>::shared_ptr odom_prev = itop->second;
+        const BetweenFactor<Pose3>::shared_ptr odom_next = iton->second;
+        if( odom_prev->key1() != Symbol( 'x', prev_id ) || odom_next->key1() != key )
+            continue;
+
+        /// 2: Planes seen by enough neighbouring keyframes
+        Frame *frame = frames_list_.at( id );
+        int planes = 0, planes_covered = 0;
+        bool orphan_plane = false;
+        for( int j = 0; j < frame->segment_planes_.size(); j++)
         {
-            for( int k = 1; k < factors.size(); k ++)
+            const int lm = frame->segment_planes_[j].id();
+            if( !landmarks_list_.count( lm ) )
+                continue;
+            planes ++;
+            int observers = 0;
+            for( int k = std::max( 0, i-2 ); k <= std::min( (int)ids.size()-1, i+2 ); k++)
             {
-                cout << MAGENTA << "\t" << factors.at(k) ;
-                removed_factors.push_back( factors.at(k) );
+                if( k == i )
+                    continue;
+                const std::vector<PlaneType> &planes_k = frames_list_.at( ids[k] )->segment_planes_;
+                for( int n = 0; n < planes_k.size(); n++)
+                {
+                    if( planes_k[n].id() == lm )
+                    {
+                        observers ++;
+                        break;
+                    }
+                }
             }
+            if( observers >= keyframe_culling_min_observers_ )
+                planes_covered ++;
+            if( !otherObservers( Symbol( 'l', lm ), id, culled ) )
+                orphan_plane = true;
         }
+        if( orphan_plane )
+            continue;
 
-        cout << RESET << endl;
+        /// 3: Keypoints seen by enough other keyframes
+        int keypoints = 0, keypoints_covered = 0;
+        std::vector<int> orphan_keypoints;
+        const std::vector<Key> &landmarks = covisibility_.landmarks( id );
+        for( int k = 0; k < landmarks.size(); k++)
+        {
+            const Symbol sym( landmarks[k] );
+            if( sym.chr() != 'p' )
+                continue;
+            keypoints ++;
+            const int observers = otherObservers( sym, id, culled );
+            if( observers >= keyframe_culling_min_observers_ )
+                keypoints_covered ++;
+            else if( observers == 0 && !prior_keys_.count( sym ) )  // a prior keeps it in the graph
+                orphan_keypoints.push_back( sym.index() );
+        }
+        if( planes_covered < keyframe_culling_redundancy_ * planes
+                || keypoints_covered < keyframe_culling_redundancy_ * keypoints )
+            continue;
+        noiseModel::Gaussian::shared_ptr noise_prev = boost::dynamic_pointer_cast<noiseModel::Gaussian>( odom_prev->noiseModel() );
+        noiseModel::Gaussian::shared_ptr noise_next = boost::dynamic_pointer_cast<noiseModel::Gaussian>( odom_next->noiseModel() );
+        if( !noise_prev || !noise_next )
+            continue;
+
+        /// 4: Odometry through the keyframe replaces all of its factors. The noise of each
+        ///    is in its own tangent space, T1 exp(a) T2 exp(b) = T1 T2 exp(Ad(T2^-1) a) exp(b).
+        const Pose3 &T1 = odom_prev->measured();
+        const Pose3 &T2 = odom_next->measured();
+        const Matrix A = T2.inverse().AdjointMap();
+        const Matrix covariance = A * noise_prev->covariance() * A.transpose() + noise_next->covariance();
+        BetweenFactor<Pose3>::shared_ptr odometry( new BetweenFactor<Pose3>( Symbol( 'x', prev_id ), Symbol( 'x', next_id ),
+                                                                             T1.compose( T2 ),
+                                                                             noiseModel::Gaussian::Covariance( covariance ) ) );
+        new_factors.push_back( odometry );
+        odometry_factors_[next_id] = odometry;
+        odometry_factors_.erase( id );
+        remove_keys.push_back( key );
+        lost_keypoints.insert( lost_keypoints.end(), orphan_keypoints.begin(), orphan_keypoints.end() );
+        culled.insert( id );
+
+        // The next one is not culled in this pass, its odometry to this one is gone
+        ids.erase( ids.begin() + i );
+    }
+
+    if( !culled.size() )
+        return;
+
+    /// 5: Drop the keyframes and the keypoints only they observed
+    for( std::set<int>::iterator it = culled.begin(); it != culled.end(); it++)
+    {
+        const int id = *it;
+        Frame *frame = frames_list_.at( id );
+        for( int j = 0; j < frame->segment_planes_.size(); j++)
+        {
+            SlotMap<std::vector<PlaneObservation> >::iterator ito = landmark_observations_.find( frame->segment_planes_[j].id() );
+            if( ito == landmark_observations_.end() )
+                continue;
+            std::vector<PlaneObservation> &observations = ito->second;
+            for( int k = observations.size()-1; k >= 0; k--)
+            {
+                if( observations[k].frame_id == id )
+                    observations.erase( observations.begin() + k );
+            }
+        }
+        delete frame;
+        frames_list_.erase( id );
+        optimized_poses_list_.erase( id );
+        covisibility_.removeFrame( id );
     }
+    for( int i = 0; i < lost_keypoints.size(); i++)
+    {
+        covisibility_.removeLandmark( Symbol( 'p', lost_keypoints[i] ) );
+        SlotMap<KeyPoint*>::iterator itk = keypoints_list_.find( lost_keypoints[i] );
+        if( itk == keypoints_list_.end() )
+            continue;
+        delete itk->second;
+        keypoints_list_.erase( itk );
+        optimized_keypoints_list_.erase( lost_keypoints[i] );
+    }
+    optimizer_.remove( remove_keys, new_factors );
 
-//    cout << BLUE << " isam2 update once." << RESET << endl;
-//    isam2_->update();
+    cout << YELLOW << " Culled keyframes:";
+    for( std::set<int>::iterator it = culled.begin(); it != culled.end(); it++)
+        cout << " " << *it;
+    cout << ", keypoints: " << lost_keypoints.size() << RESET << endl;
+}
+
+int GTMapping::otherObservers( Key landmark, int frame_id, const std::set<int> &culled ) const
+{
+    const std::vector<int> &observers = covisibility_.observers( landmark );
+    int count = 0;
+    for( int i = 0; i < observers.size(); i++)
+    {
+        if( observers[i] != frame_id && !culled.count( observers[i] ) )
+            count ++;
+    }
+    return count;
 }
 
 void GTMapping::mergeCoplanarLandmarks( std::map<int, std::set<int> > merge_list )
 {
+    // A merge removes every factor of 'from' and ISAM2 drops the variable, but the
+    // fixed-lag smoother keeps its timestamp and would marginalize or revive it later
+    if( optimizer_.isFixedLag() )
+        return;
+
     // print merge list
     cout << YELLOW << " Merge list: " << endl;
     for( std::map<int, std::set<int> >::iterator it = merge_list.begin(); it != merge_list.end(); it++)
@@ -2092,8 +2403,7 @@ void GTMapping::mergeCoplanarLandmarks( std::map<int, std::set<int> > merge_list
     }
 
 
-    // Graph variable
-    Values isam2_values = isam2_->calculateBestEstimate();
+    // Factors of 'from' move to 'to', resolved by the optimizer when the update runs
     std::map<Key, Key> rekey_mapping; // old -> new
     for( std::map<int, std::set<int> >::iterator itt = merge_list.begin(); itt != merge_list.end(); itt++)
     {
@@ -2107,7 +2417,7 @@ void GTMapping::mergeCoplanarLandmarks( std::map<int, std::set<int> > merge_list
 
             // Do Merging
             // Delete id == 'from' in the 'landmarks_list_'
-            std::map<int, PlaneType*>::iterator litem = landmarks_list_.find( from );
+            SlotMap<PlaneType*>::iterator litem = landmarks_list_.find( from );
             if( litem != landmarks_list_.end() )
             {
                 // Merge inlier
@@ -2116,39 +2426,25 @@ void GTMapping::mergeCoplanarLandmarks( std::map<int, std::set<int> > merge_list
                 delete litem->second;
 //                landmarks_list_.erase( from );
                 landmarks_list_.erase( litem );
+                landmark_index_.remove( from );
             }
 
             // Delete id == 'from' in the 'optimized_landmarks_list_'
-            std::map<int, gtsam::OrientedPlane3>::iterator olitem = optimized_landmarks_list_.find( from );
+            SlotMap<gtsam::OrientedPlane3>::iterator olitem = optimized_landmarks_list_.find( from );
             if( olitem != optimized_landmarks_list_.end() )
             {
 //                optimized_landmarks_list_.erase( from );
                 optimized_landmarks_list_.erase( olitem );
             }
+            plane_buckets_.remove( from );
 
             // Change PlaneType id in the frame,  from 'from' to 'to'
-            for( std::map<int, Frame*>::iterator frame_iter = frames_list_.begin();
-                 frame_iter != frames_list_.end(); frame_iter++)
-            {
-                Frame *frame = frame_iter->second;
-                for( int idx = 0; idx < frame->segment_planes_.size(); idx++)
-                {
-                    PlaneType &obs = frame->segment_planes_[idx];
-                    if( obs.id() == from )
-                        obs.setId( to );
-                }
-            }
+            mergeLandmarkInlier( from, to );
 
             Key key_from = Symbol( 'l', from );
             Key key_to = Symbol( 'l', to );
-            // delete OrientedPlane3 id in the graph.
-            if( isam2_values.exists( key_from ) )
-            {
-                isam2_values.erase( key_from );   // After deleting, crush occured.
-            }
-
-            // Change factor id in the graph, just build rekey_mapping
             rekey_mapping[key_from] = key_to;
+            covisibility_.mergeLandmark( key_from, key_to );
         }
 
         // Project and downsample
@@ -2156,39 +2452,10 @@ void GTMapping::mergeCoplanarLandmarks( std::map<int, std::set<int> > merge_list
 
     }
 
-    NonlinearFactorGraph factor_graph = isam2_->getFactorsUnsafe().clone();
-    // Change factor id in the graph, provide rekey_mapping
-    for( NonlinearFactorGraph::iterator factor_iter = factor_graph.begin();
-         factor_iter != factor_graph.end(); factor_iter++)
-    {
-        // OrientedPlane3Factor factor
-        boost::shared_ptr<OrientedPlane3Factor> plane_factor =
-                boost::dynamic_pointer_cast<OrientedPlane3Factor>(*factor_iter);
-        if( plane_factor )
-        {
-            FastVector<Key> &keys = plane_factor->keys();
-            std::map<Key, Key>::const_iterator mapping = rekey_mapping.find( keys[1] );
-            if (mapping != rekey_mapping.end())
-                keys[1] = mapping->second;
-        }
-
-        // OrientedPlane3DirectionPrior factor
-        boost::shared_ptr<OrientedPlane3DirectionPrior> plane_prior_factor =
-                boost::dynamic_pointer_cast<OrientedPlane3DirectionPrior>(*factor_iter);
-        if( plane_prior_factor )
-        {
-            FastVector<Key> &keys = plane_prior_factor->keys();
-            std::map<Key, Key>::const_iterator mapping = rekey_mapping.find( keys[0] );
-            if (mapping != rekey_mapping.end())
-                keys[0] = mapping->second;
-        }
-
-    }
-
-    delete isam2_;
-    isam2_ = new ISAM2( isam2_parameters_ );
-    isam2_->update( factor_graph, isam2_values );
-    isam2_->update();
+    // Swap the factors, cost follows the degree of the merged landmarks. The estimate
+    // of 'to' comes with the next update taken.
+    optimizer_.rekey( rekey_mapping );
+    optimizer_.push( NonlinearFactorGraph() );
     updateOptimizedResultMix();
     for( std::map<int, std::set<int> >::iterator itt = merge_list.begin(); itt != merge_list.end(); itt++){
         planes_optimized_.insert( itt->first );
@@ -2198,7 +2465,107 @@ void GTMapping::mergeCoplanarLandmarks( std::map<int, std::set<int> > merge_list
 
 void GTMapping::mergeLandmarkInlier( int from, int to )
 {
+    std::vector<PlaneObservation> &to_obs = landmark_observations_[to];
+    SlotMap<std::vector<PlaneObservation> >::iterator itf = landmark_observations_.find( from );
+    if( itf == landmark_observations_.end() )
+        return;
+
+    // Observations of 'from' are not in the cloud of 'to' yet
+    std::vector<PlaneObservation> &from_obs = itf->second;
+    for( int i = 0; i < from_obs.size(); i++)
+    {
+        PlaneObservation &ob = from_obs[i];
+        frames_list_.at( ob.frame_id )->segment_planes_[ob.plane_index].setId( to );
+        ob.merged = false;
+        to_obs.push_back( ob );
+    }
+    landmark_observations_.erase( itf );
+}
 
+void GTMapping::addCovisibility( const NonlinearFactorGraph &graph )
+{
+    for( NonlinearFactorGraph::const_iterator it = graph.begin(); it != graph.end(); it++)
+    {
+        if( !(*it) || (*it)->size() != 2 )
+            continue;
+        const Symbol key1( (*it)->keys()[0] );
+        const Symbol key2( (*it)->keys()[1] );
+        // Pose to landmark factors only
+        if( key1.chr() == 'x' && (key2.chr() == 'l' || key2.chr() == 'p') )
+            covisibility_.addObservation( key1.index(), key2 );
+        else if( key2.chr() == 'x' && (key1.chr() == 'l' || key1.chr() == 'p') )
+            covisibility_.addObservation( key2.index(), key1 );
+    }
+}
+
+void GTMapping::getLocalKeypoints( int frame_id, std::vector<int> &ids )
+{
+    ids.clear();
+    std::vector<int> frames;
+    std::vector<Key> landmarks;
+    covisibility_.localMap( frame_id, covisibility_min_weight_, covisibility_max_neighbours_, frames, landmarks );
+    for( int i = 0; i < landmarks.size(); i++)
+    {
+        const Symbol sym( landmarks[i] );
+        if( sym.chr() == 'p' )
+            ids.push_back( sym.index() );
+    }
+}
+
+void GTMapping::addPlaneObservations( const Frame *frame )
+{
+    for( int i = 0; i < frame->segment_planes_.size(); i++)
+    {
+        const int id = frame->segment_planes_[i].id();
+        if( landmarks_list_.find( id ) == landmarks_list_.end() )
+            continue;
+        PlaneObservation ob;
+        ob.frame_id = frame->id();
+        ob.plane_index = i;
+        ob.merged = false;
+        landmark_observations_[id].push_back( ob );
+    }
+}
+
+void GTMapping::refreshLandmarkInlier( int id, bool rebuild )
+{
+    PlaneType *lm = landmarks_list_.at( id );
+    std::vector<PlaneObservation> &observations = landmark_observations_[id];
+
+    /// 1: Rebuild if a merged observation moved too much
+    for( int i = 0; i < observations.size() && !rebuild; i++)
+    {
+        const PlaneObservation &ob = observations[i];
+        if( !ob.merged )
+            continue;
+        const Pose3 delta = ob.pose.between( optimized_poses_list_.at( ob.frame_id ) );
+        if( delta.translation().norm() > plane_inlier_rebuild_translation_
+                || Rot3::Logmap( delta.rotation() ).norm() > plane_inlier_rebuild_rotation_ )
+            rebuild = true;
+    }
+    if( rebuild )
+    {
+        lm->cloud_voxel->clear();  // clear inlier
+        for( int i = 0; i < observations.size(); i++)
+            observations[i].merged = false;
+    }
+
+    /// 2: Add the observations not merged yet
+    for( int i = 0; i < observations.size(); i++)
+    {
+        PlaneObservation &ob = observations[i];
+        if( ob.merged )
+            continue;
+        const Frame *frame = frames_list_.at( ob.frame_id );
+        const PlaneType &obs = frame->segment_planes_[ob.plane_index];
+        Eigen::Matrix4d trans = transformTFToMatrix4d( frame->pose_ );
+        *(lm->cloud_voxel) += transformPointCloud( *(obs.cloud_voxel), trans );
+        ob.merged = true;
+        ob.pose = optimized_poses_list_.at( ob.frame_id );
+    }
+
+    /// 3: Project onto the current coefficients and downsample
+    projectAndDownsamplePlane( lm );
 }
 
 void GTMapping::projectAndDownsamplePlane( PlaneType *lm )
@@ -2219,6 +2586,11 @@ void GTMapping::projectAndDownsamplePlane( PlaneType *lm )
     lm->centroid.y = cen[1];
     lm->centroid.z = cen[2];
     lm->centroid.rgb = lm->color.float_value;
+
+    // occupancy for overlap checks
+    updatePlaneRaster( lm );
+    // box for frustum queries
+    landmark_index_.update( lm->id(), *(lm->cloud_voxel) );
 }
 
 bool GTMapping::removeLandmarksBadInlier()
@@ -2229,11 +2601,13 @@ bool GTMapping::removeLandmarksBadInlier()
     cout << GREEN << " Remove bad inlier, radius = " << radius
          << ", minimum neighbours = " << min_neighbors << RESET << endl;
 
-    for( std::map<int, PlaneType*>::const_iterator it = landmarks_list_.begin();
+    for( SlotMap<PlaneType*>::const_iterator it = landmarks_list_.begin();
          it != landmarks_list_.end(); it++)
     {
         PlaneType &lm = *(it->second);
         removePlaneBadInlier( lm.cloud_voxel, radius, min_neighbors );
+        updatePlaneRaster( &lm );
+        landmark_index_.update( lm.id(), *(lm.cloud_voxel) );
     }
 }
 
@@ -2258,17 +2632,48 @@ void GTMapping::updateOptimizedResultMix()
     frames_optimized_.clear();
     planes_optimized_.clear();
     //
-    Values values = isam2_->calculateBestEstimate();
-    // frames
-    for( std::map<int, gtsam::Pose3>::iterator it = optimized_poses_list_.begin();
-            it != optimized_poses_list_.end(); it++)
-    {
-        gtsam::Pose3 pose3 = values.at( Symbol('x', it->first) ).cast<gtsam::Pose3>();
-        if( !pose3.equals(it->second, 1e-4) )
-            frames_optimized_.insert( it->first );
-        it->second = pose3;
-        frames_list_[it->first]->pose_ = pose3ToTF( pose3 );
+    // Only the estimates moved since the last call, variables still in the queue keep their guess
+    Values values;
+    optimizer_.takeChanges( values );
+    for( Values::const_iterator it = values.begin(); it != values.end(); it++)
+    {
+        const Symbol sym( it->key );
+        const int id = sym.index();
+        // frames
+        if( sym.chr() == 'x' )
+        {
+            SlotMap<gtsam::Pose3>::iterator itp = optimized_poses_list_.find( id );
+            if( itp == optimized_poses_list_.end() )
+                continue;
+            const gtsam::Pose3 &pose3 = it->value.cast<gtsam::Pose3>();
+            frames_optimized_.insert( id );
+            itp->second = pose3;
+            frames_list_[id]->pose_ = pose3ToTF( pose3 );
+        }
+        // planes
+        else if( sym.chr() == 'l' )
+        {
+            SlotMap<gtsam::OrientedPlane3>::iterator itl = optimized_landmarks_list_.find( id );
+            if( itl == optimized_landmarks_list_.end() )
+                continue;
+            const gtsam::OrientedPlane3 &plane = it->value.cast<gtsam::OrientedPlane3>();
+            planes_optimized_.insert( id );
+            plane_buckets_.update( id, plane.planeCoefficients() );
+            itl->second = plane;
+            landmarks_list_[id]->coefficients = plane.planeCoefficients();
+        }
+        // keypoints
+        else if( sym.chr() == 'p' )
+        {
+            SlotMap<gtsam::Point3>::iterator itk = optimized_keypoints_list_.find( id );
+            if( itk == optimized_keypoints_list_.end() )
+                continue;
+            const gtsam::Point3 &point = it->value.cast<gtsam::Point3>();
+            itk->second = point;
+            keypoints_list_.at( id )->translation = point;
+        }
     }
+
     // From frames_optimized_ to determine which plane landmarks are changed
     if( frames_optimized_.size() > 0 )
     {
@@ -2285,25 +2690,65 @@ void GTMapping::updateOptimizedResultMix()
             }
         }
     }
+}
+
+void GTMapping::updateLocalMap( int frame_id )
+{
+    local_map_.clear();
+    if( optimized_poses_list_.find( frame_id ) == optimized_poses_list_.end() )
+        return;
+
+    local_map_.frame_id = frame_id;
+    local_map_.pose = optimized_poses_list_.at( frame_id );
+    const gtsam::Point3 center = local_map_.pose.translation();
+
+    // Keypoints around the keyframe, of the covisible keyframes if any
+    std::vector<int> ids;
+    if( use_covisibility_ )
+        getLocalKeypoints( frame_id, ids );
+    if( ids.empty() )
+    {
+        ids.reserve( optimized_keypoints_list_.size() );
+        for( SlotMap<gtsam::Point3>::iterator it = optimized_keypoints_list_.begin();
+                it != optimized_keypoints_list_.end(); it++)
+            ids.push_back( it->first );
+    }
+    for( int i = 0; i < ids.size(); i++)
+    {
+        SlotMap<gtsam::Point3>::iterator it = optimized_keypoints_list_.find( ids[i] );
+        if( it == optimized_keypoints_list_.end() )
+            continue;
+        if( center.distance( it->second ) > local_map_radius_ )
+            continue;
+        const KeyPoint *keypoint = keypoints_list_.at( it->first );
+        local_map_.keypoint_ids.push_back( it->first );
+        local_map_.keypoints.push_back( it->second );
+        local_map_.descriptors.insert( local_map_.descriptors.end(), keypoint->descriptor, keypoint->descriptor + 4 );
+    }
 
-    // planes
-    for( std::map<int, gtsam::OrientedPlane3>::iterator it = optimized_landmarks_list_.begin();
-            it != optimized_landmarks_list_.end(); it++)
+    // Plane landmarks whose inlier box comes within the radius
+    std::vector<int> plane_ids;
+    landmark_index_.queryRadius( Eigen::Vector3f( center.x(), center.y(), center.z() ), local_map_radius_, plane_ids );
+    for( int i = 0; i < plane_ids.size(); i++)
     {
-        gtsam::OrientedPlane3 plane = values.at( Symbol('l', it->first) ).cast<gtsam::OrientedPlane3>();
-        if( !plane.equals(it->second) )
-            planes_optimized_.insert( it->first );
-        it->second = plane;
-        landmarks_list_[it->first]->coefficients = plane.planeCoefficients();
+        SlotMap<gtsam::OrientedPlane3>::iterator it = optimized_landmarks_list_.find( plane_ids[i] );
+        if( it == optimized_landmarks_list_.end() || !landmarks_list_.at( it->first )->valid )
+            continue;
+        local_map_.plane_ids.push_back( it->first );
+        local_map_.planes.push_back( it->second );
     }
-    // keypoints
-    for( std::map<int, gtsam::Point3>::iterator it = optimized_keypoints_list_.begin();
-            it != optimized_keypoints_list_.end(); it++)
+
+    local_map_.valid = true;
+}
+
+const LocalMap &GTMapping::getLocalMap()
+{
+    if( local_map_keyframe_ >= 0 )
     {
-        gtsam::Point3 point = values.at( Symbol('p', it->first) ).cast<gtsam::Point3>();
-        it->second = point;
-        keypoints_list_.at(it->first)->translation = point;
+        updateLocalMap( local_map_keyframe_ );
+        local_map_keyframe_ = -1;
     }
+    return local_map_;
 }
 
 void GTMapping::updateOptimizedResult()
@@ -2311,16 +2756,35 @@ void GTMapping::updateOptimizedResult()
     frames_optimized_.clear();
     planes_optimized_.clear();
     //
-    Values values = isam2_->calculateBestEstimate();
-    // frames
-    for( std::map<int, gtsam::Pose3>::iterator it = optimized_poses_list_.begin();
-            it != optimized_poses_list_.end(); it++)
-    {
-        gtsam::Pose3 pose3 = values.at( Symbol('x', it->first) ).cast<gtsam::Pose3>();
-        if( !pose3.equals(it->second, 1e-4) )
-            frames_optimized_.insert( it->first );
-        it->second = pose3;
-        frames_list_[it->first]->pose_ = pose3ToTF( pose3 );
+    // Only the estimates moved since the last call
+    Values values;
+    optimizer_.takeChanges( values );
+    for( Values::const_iterator it = values.begin(); it != values.end(); it++)
+    {
+        const Symbol sym( it->key );
+        const int id = sym.index();
+        // frames
+        if( sym.chr() == 'x' )
+        {
+            SlotMap<gtsam::Pose3>::iterator itp = optimized_poses_list_.find( id );
+            if( itp == optimized_poses_list_.end() )
+                continue;
+            const gtsam::Pose3 &pose3 = it->value.cast<gtsam::Pose3>();
+            frames_optimized_.insert( id );
+            itp->second = pose3;
+            frames_list_[id]->pose_ = pose3ToTF( pose3 );
+        }
+        // landmarks
+        else if( sym.chr() == 'l' )
+        {
+            SlotMap<gtsam::OrientedPlane3>::iterator itl = optimized_landmarks_list_.find( id );
+            if( itl == optimized_landmarks_list_.end() )
+                continue;
+            const OrientedPlane3 &plane = it->value.cast<OrientedPlane3>();
+            plane_buckets_.update( id, plane.planeCoefficients() );
+            itl->second = plane;
+            landmarks_list_[id]->coefficients = plane.planeCoefficients();
+        }
     }
     // From frames_optimized_ to determine which plane landmarks are changed
     for( std::set<int>::iterator it = frames_optimized_.begin(); it != frames_optimized_.end(); it++ )
@@ -2333,14 +2797,6 @@ void GTMapping::updateOptimizedResult()
                 planes_optimized_.insert( id );
         }
     }
-    // landmarks
-    for( std::map<int, gtsam::OrientedPlane3>::iterator it = optimized_landmarks_list_.begin();
-            it != optimized_landmarks_list_.end(); it++)
-    {
-        OrientedPlane3 plane = values.at( Symbol('l', it->first) ).cast<OrientedPlane3>();
-        it->second = plane;
-        landmarks_list_[it->first]->coefficients = plane.planeCoefficients();
-    }
 }
 
 void GTMapping::updateLandmarksInlier( int index )
@@ -2376,46 +2832,11 @@ void GTMapping::updateLandmarksInlier( int index )
     if( planes_optimized_.size() == 0 )
         return;
 
-    // Clear liner
+    // Only the new observations are merged, unless the frames moved
     for( std::set<int>::iterator it = planes_optimized_.begin(); it != planes_optimized_.end(); it++ )
     {
-        landmarks_list_.at(*it)->cloud_voxel->clear();  // clear inlier
-    }
-
-//    // Add inlier
-//    Frame *frame = frames_list_.at( index );;
-//    Eigen::Matrix4d trans = transformTFToMatrix4d( frame->pose_ );
-//    for( int idx = 0; idx < frame->segment_planes_.size(); idx++)
-//    {
-//        PlaneType &obs = frame->segment_planes_[idx];
-//        if( planes_optimized_.find(obs.id()) != planes_optimized_.end() )
-//        {
-//            PlaneType *lm = landmarks_list_[ obs.id() ];
-//            *(lm->cloud_voxel) += transformPointCloud( *(obs.cloud_voxel), trans );
-//        }
-//    }
-
-    // Sum
-    for( std::map<int, Frame*>::iterator it = frames_list_.begin();
-         it != frames_list_.end(); it++)
-    {
-        Frame *frame = it->second;
-        Eigen::Matrix4d trans = transformTFToMatrix4d( frame->pose_ );
-        for( int idx = 0; idx < frame->segment_planes_.size(); idx++)
-        {
-            PlaneType &obs = frame->segment_planes_[idx];
-            if( planes_optimized_.find(obs.id()) != planes_optimized_.end() )
-            {
-                PlaneType *lm = landmarks_list_[ obs.id() ];
-                *(lm->cloud_voxel) += transformPointCloud( *(obs.cloud_voxel), trans );
-            }
-        }
-    }
-
-    // Project and Downsample
-    for( std::set<int>::iterator it = planes_optimized_.begin(); it != planes_optimized_.end(); it++ )
-    {
-        projectAndDownsamplePlane( landmarks_list_.at(*it) );
+        if( landmarks_list_.find( *it ) != landmarks_list_.end() )
+            refreshLandmarkInlier( *it );
     }
 
     planes_optimized_.clear();
@@ -2423,46 +2844,11 @@ void GTMapping::updateLandmarksInlier( int index )
 
 void GTMapping::updateLandmarksInlierAll()
 {
-    // Update landmark poses, plane coefficients
-    for( std::map<int, PlaneType*>::iterator it = landmarks_list_.begin();
+    // Rebuild every landmark from its observations
+    for( SlotMap<PlaneType*>::iterator it = landmarks_list_.begin();
          it != landmarks_list_.end(); it++)
     {
-        PlaneType *lm = it->second;
-        lm->cloud_voxel->clear();  // clear inlier
-    }
-
-    // Sum
-    for( std::map<int, Frame*>::iterator it = frames_list_.begin();
-         it != frames_list_.end(); it++)
-    {
-        Frame *frame = it->second;
-        Eigen::Matrix4d trans = transformTFToMatrix4d( frame->pose_ );
-        for( int idx = 0; idx < frame->segment_planes_.size(); idx++)
-        {
-            PlaneType &obs = frame->segment_planes_[idx];
-            PlaneType *lm = landmarks_list_[ obs.id() ];
-            *(lm->cloud_voxel) += transformPointCloud( *(obs.cloud_voxel), trans );
-        }
-    }
-
-    // Project and Downsample
-    for( std::map<int, PlaneType*>::iterator it = landmarks_list_.begin();
-         it != landmarks_list_.end(); it++)
-    {
-        PlaneType *lm = it->second;
-        PointCloudTypePtr cloud_projected( new PointCloudType );
-        projectPoints( *(lm->cloud_voxel), lm->coefficients, *cloud_projected );
-        voxelGridFilter( cloud_projected, lm->cloud_voxel, plane_inlier_leaf_size_ );
-        setPointCloudColor( *(lm->cloud_voxel), lm->color );
-        cloud_projected->clear();
-
-        // compute 3d centroid
-        Eigen::Vector4f cen;
-        pcl::compute3DCentroid( *(lm->cloud_voxel), cen );
-        lm->centroid.x = cen[0];
-        lm->centroid.y = cen[1];
-        lm->centroid.z = cen[2];
-        lm->centroid.rgb = lm->color.float_value;
+        refreshLandmarkInlier( it->first, true );
     }
 }
 
@@ -2480,15 +2866,16 @@ void GTMapping::updateOctoMap()
     if( !(octomap_publisher_.getNumSubscribers()) )
         return;
 
-    if( frames_list_.size() <= node_size )
+    if( next_frame_id_ <= node_size )
         return;
 
     ros::Time start_time = ros::Time::now();
     int number = 0;
     cout << BLUE << " Octree scan size: " << node_size << RESET << endl;
-    for( int idx = node_size; idx < frames_list_.size(); idx++)
+    // Frame ids, culled keyframes leave gaps
+    for( int idx = node_size; idx < next_frame_id_; idx++)
     {
-        std::map<int, Frame*>::iterator itf = frames_list_.find( idx );
+        SlotMap<Frame*>::iterator itf = frames_list_.find( idx );
         // Add one scan
         if( itf != frames_list_.end() )
         {
@@ -2522,12 +2909,13 @@ void GTMapping::updateOctoMap()
             // Construct a octomap::ScanNode
             octomap::ScanNode node( scan, scan_pose, id);
             octree_map_->insertPointCloud( node, octomap_max_depth_range_, false, false );
-            node_size ++;
     //        ROS_INFO("inserted %d pt=%d ", id, (int)scan->size() );
         }
 
     }
 
+    node_size = next_frame_id_;
+
     ROS_INFO(" Updated inner octree map, inserted %d (%fs)", number, (ros::Time::now() - start_time).toSec() );
 
 }
@@ -2536,9 +2924,10 @@ void GTMapping::optimizeGraph( int n )
 {
     while( n > 0 )
     {
-        isam2_->update();
+        optimizer_.push( NonlinearFactorGraph() );
         n--;
     }
+    optimizer_.flush();
 //    isam2_->print( "Map Graph");
 }
 
@@ -2564,7 +2953,8 @@ void GTMapping::publishOptimizedPath()
         nav_msgs::Path path;
         path.header.frame_id = map_frame_;
         path.header.stamp = ros::Time::now();
-        for( std::map<int, gtsam::Pose3>::iterator it = optimized_poses_list_.begin();
+        submaps_.getPath( path.poses );
+        for( SlotMap<gtsam::Pose3>::iterator it = optimized_poses_list_.begin();
                 it != optimized_poses_list_.end(); it++)
         {
             path.poses.push_back( pose3ToGeometryPose( it->second ) );
@@ -2777,34 +3167,33 @@ void GTMapping::updateMapViewer()
 
 void GTMapping::reset()
 {
-    // Delete old
-    if( isam2_ )
-        delete isam2_;
-
-    // Construct new
+    // Construct new, drops the queued updates
     isam2_parameters_.relinearizeThreshold = isam2_relinearize_threshold_; // 0.1
     isam2_parameters_.relinearizeSkip = isam2_relinearize_skip_; // 1
     isam2_parameters_.factorization = isam2_factorization_;
     isam2_parameters_.print( "ISAM2 parameters:" );
-    isam2_ = new ISAM2( isam2_parameters_ );
+    optimizer_.reset( isam2_parameters_, use_fixed_lag_smoother_ ? fixed_lag_window_ : 0 );
 
     // clear
     factor_graph_.resize(0);
     initial_estimate_.clear();
+    removed_factors_.clear();
+    removed_keys_.clear();
 
     //
     next_plane_id_ = 0;
     next_point_id_ = 0;
     next_frame_id_ = 0;
-    for( std::map<int, Frame*>::iterator it = frames_list_.begin(); it != frames_list_.end(); it++)
+    last_culling_frame_ = 0;
+    for( SlotMap<Frame*>::iterator it = frames_list_.begin(); it != frames_list_.end(); it++)
     {
         delete (it->second);
     }
-    for( std::map<int, PlaneType*>::iterator it = landmarks_list_.begin(); it!= landmarks_list_.end(); it++)
+    for( SlotMap<PlaneType*>::iterator it = landmarks_list_.begin(); it!= landmarks_list_.end(); it++)
     {
         delete (it->second);
     }
-    for( std::map<int, KeyPoint*>::iterator it = keypoints_list_.begin(); it!= keypoints_list_.end(); it++)
+    for( SlotMap<KeyPoint*>::iterator it = keypoints_list_.begin(); it!= keypoints_list_.end(); it++)
     {
         delete (it->second);
     }
@@ -2814,6 +3203,18 @@ void GTMapping::reset()
     optimized_poses_list_.clear();
     optimized_landmarks_list_.clear();
     optimized_keypoints_list_.clear();
+    landmark_observations_.clear();
+    landmark_index_.clear();
+    plane_buckets_.clear();
+    covisibility_.clear();
+    odometry_factors_.clear();
+    linked_keys_.clear();
+    prior_keys_.clear();
+    local_map_.clear();
+    local_map_keyframe_ = -1;
+    submaps_.clear();
+    submap_first_frame_ = 0;
+    submap_anchor_ = gtsam::Pose3();
 }
 
 PointCloudTypePtr GTMapping::getMapCloud( bool force )
@@ -2825,13 +3226,15 @@ PointCloudTypePtr GTMapping::getMapCloud( bool force )
 
         // update map pointcloud
         map_cloud_->clear();
-        for( std::map<int, PlaneType*>::iterator it = landmarks_list_.begin();
+        for( SlotMap<PlaneType*>::iterator it = landmarks_list_.begin();
              it != landmarks_list_.end(); it++)
         {
             PlaneType *lm = it->second;
             setPointCloudColor( *(lm->cloud_voxel), lm->color );
             *map_cloud_ += *(lm->cloud_voxel);
         }
+        // Hot finished submaps
+        submaps_.getCloud( *map_cloud_ );
     }
 
     return map_cloud_;
@@ -2841,17 +3244,20 @@ PointCloudTypePtr GTMapping::getMapFullCloud( bool colored )
 {
     PointCloudTypePtr map_full_cloud( new PointCloudType );
     // Clear landmark cloud
-    for( std::map<int, PlaneType*>::iterator it = landmarks_list_.begin();
+    for( SlotMap<PlaneType*>::iterator it = landmarks_list_.begin();
          it != landmarks_list_.end(); it++)
     {
         PlaneType *lm = it->second;
-        lm->cloud->clear();  // clear inlier
+        if( lm->cloud )
+            lm->cloud->clear();  // clear inlier
+        else
+            lm->cloud.reset( new PointCloudType );
     }
     // Sum
     double radius = map_full_search_radius_;
 //    int min_neighbors =  map_full_min_neighbor_;
     int min_neighbors =  M_PI * radius * radius / ( map_full_leaf_size_ * map_full_leaf_size_) * map_full_min_neighbor_alpha_;
-    for( std::map<int, Frame*>::iterator it = frames_list_.begin();
+    for( SlotMap<Frame*>::iterator it = frames_list_.begin();
          it != frames_list_.end(); it++)
     {
         Frame *frame = it->second;
@@ -2860,8 +3266,11 @@ PointCloudTypePtr GTMapping::getMapFullCloud( bool colored )
         {
             PlaneType &obs = frame->segment_planes_[idx];
             PlaneType *lm = landmarks_list_[ obs.id() ];
+            // Projected without caching on the observation
+            PointCloudTypePtr cloud_projected( new PointCloudType );
+            projectPoints( *(frame->cloud_downsampled_), obs.inlier, obs.coefficients, *cloud_projected );
             PointCloudTypePtr cloud_voxeled( new PointCloudType );
-            voxelGridFilter( obs.cloud, cloud_voxeled, map_full_leaf_size_ );
+            voxelGridFilter( cloud_projected, cloud_voxeled, map_full_leaf_size_ );
             if( map_full_remove_bad_inlier_ )
             {
                 PointCloudTypePtr cloud_filtered( new PointCloudType );
@@ -2876,7 +3285,7 @@ PointCloudTypePtr GTMapping::getMapFullCloud( bool colored )
     }
 
     // Project and Downsample
-    for( std::map<int, PlaneType*>::iterator it = landmarks_list_.begin();
+    for( SlotMap<PlaneType*>::iterator it = landmarks_list_.begin();
          it != landmarks_list_.end(); it++)
     {
         PlaneType *lm = it->second;
@@ -2886,7 +3295,7 @@ PointCloudTypePtr GTMapping::getMapFullCloud( bool colored )
     }
 
 
-    for( std::map<int, PlaneType*>::iterator it = landmarks_list_.begin();
+    for( SlotMap<PlaneType*>::iterator it = landmarks_list_.begin();
          it != landmarks_list_.end(); it++)
     {
         PlaneType *lm = it->second;
@@ -2908,7 +3317,7 @@ PointCloudTypePtr GTMapping::getStructureCloud()
     PointCloudTypePtr structure_cloud( new PointCloudType );
 //    double radius = map_full_search_radius_;
 //    int min_neighbors =  M_PI * radius * radius / ( map_full_leaf_size_ * map_full_leaf_size_) * map_full_min_neighbor_alpha_;
-    for( std::map<int, Frame*>::iterator it = frames_list_.begin();
+    for( SlotMap<Frame*>::iterator it = frames_list_.begin();
          it != frames_list_.end(); it++)
     {
         Frame *frame = it->second;
@@ -2945,7 +3354,7 @@ PointCloudTypePtr GTMapping::getKeypointCloud( bool force )
     cloud->height = 1;
 
     PointType pt;
-    for( std::map<int, KeyPoint*>::iterator it = keypoints_list_.begin();
+    for( SlotMap<KeyPoint*>::iterator it = keypoints_list_.begin();
          it != keypoints_list_.end(); it++)
     {
         KeyPoint *keypoint = it->second;
@@ -2974,7 +3383,7 @@ octomap::OcTree * GTMapping::createOctoMap( double resolution )
     octomap::OcTree * octree = new octomap::OcTree( resolution );
 
     int number = 0;
-    for( std::map<int, Frame*>::iterator itf = frames_list_.begin();
+    for( SlotMap<Frame*>::iterator itf = frames_list_.begin();
          itf != frames_list_.end(); itf++)
     {
         number ++;
@@ -3087,13 +3496,15 @@ void GTMapping::saveMapPlanePCD( const std::string &prefix )
     cout << WHITE << "Save planes: " << prefix << "..." << RESET << endl;
 
     bool colored = true;
-    for( std::map<int, PlaneType*>::iterator it = landmarks_list_.begin();
+    for( SlotMap<PlaneType*>::iterator it = landmarks_list_.begin();
          it != landmarks_list_.end(); it++)
     {
         stringstream ss;
         ss << prefix << it->first<<".pcd";
         //
         PlaneType *lm = it->second;
+        if( !lm->cloud )    // added after the last getMapFullCloud()
+            continue;
         cout << WHITE << " - " << ss.str() << ", points = " << lm->cloud->size() << RESET << endl;
         if( colored )
         {
@@ -3113,7 +3524,8 @@ void GTMapping::saveMapPlanePCD( const std::string &prefix )
 std::vector<geometry_msgs::PoseStamped> GTMapping::getOptimizedPath()
 {
     std::vector<geometry_msgs::PoseStamped> poses;
-    for( std::map<int, gtsam::Pose3>::iterator it = optimized_poses_list_.begin();
+    submaps_.getPath( poses );
+    for( SlotMap<gtsam::Pose3>::iterator it = optimized_poses_list_.begin();
             it != optimized_poses_list_.end(); it++)
     {
         geometry_msgs::PoseStamped pose = pose3ToGeometryPose( it->second );
@@ -3140,6 +3552,13 @@ void GTMapping::gtMappingReconfigCallback(plane_slam::GTMappingConfig &config, u
     isam2_relinearize_threshold_ = config.isam2_relinearize_threshold;
     isam2_relinearize_skip_ = config.isam2_relinearize_skip;
     isam2_factorization_ = ISAM2Params::Factorization(config.isam2_factorization);
+    optimizer_.setAsync( config.async_optimization );
+    optimizer_.setRefreshThreshold( config.estimate_refresh_threshold );
+    optimizer_.setFullRefreshInterval( config.estimate_full_refresh_interval );
+    use_fixed_lag_smoother_ = config.use_fixed_lag_smoother;
+    fixed_lag_window_ = config.fixed_lag_window;
+    fixed_lag_in_keyframes_ = config.fixed_lag_in_keyframes;
+    optimizer_.setLag( fixed_lag_window_ );
     //
     min_keypoint_correspondences_ = config.min_keypoint_correspondences;
     keypoint_match_search_radius_ = config.keypoint_match_search_radius;
@@ -3152,6 +3571,8 @@ void GTMapping::gtMappingReconfigCallback(plane_slam::GTMappingConfig &config, u
     plane_match_direction_threshold_ = config.plane_match_direction_threshold * DEG_TO_RAD;
     plane_match_distance_threshold_ = config.plane_match_distance_threshold;
     plane_force_inlier_update_ = config.plane_force_inlier_update;
+    plane_inlier_rebuild_translation_ = config.plane_inlier_rebuild_translation;
+    plane_inlier_rebuild_rotation_ = config.plane_inlier_rebuild_rotation * DEG_TO_RAD;
     plane_match_check_overlap_ = config.plane_match_check_overlap;
     plane_match_overlap_alpha_ = config.plane_match_overlap_alpha;
     plane_inlier_leaf_size_ = config.plane_inlier_leaf_size;
@@ -3167,9 +3588,19 @@ void GTMapping::gtMappingReconfigCallback(plane_slam::GTMappingConfig &config, u
     floor_plane_height_threshold_ = config.floor_plane_height_threshold;
     floor_plane_angular_threshold_ = config.floor_plane_angular_threshold*DEG_TO_RAD;
     wall_plane_angular_threshold_ = config.wall_plane_angular_threshold*DEG_TO_RAD;
+    plane_buckets_.setAngularResolution( planar_merge_direction_threshold_ );
     //
     remove_plane_bad_inlier_ = config.remove_plane_bad_inlier;
     planar_bad_inlier_alpha_ = config.planar_bad_inlier_alpha;
+    plane_preprocessor_.setLeafSize( plane_inlier_leaf_size_ );
+    plane_preprocessor_.setRemoveBadInlier( remove_plane_bad_inlier_ );
+    plane_preprocessor_.setBadInlierAlpha( planar_bad_inlier_alpha_ );
+    plane_preprocessor_.setRunInFrame( config.plane_preprocess_in_frame );
+    plane_preprocessor_.setThreads( config.plane_preprocess_threads );
+    use_frustum_culling_ = config.use_frustum_culling;
+    frustum_max_range_ = config.frustum_max_range;
+    frustum_margin_ = config.frustum_margin;
+    landmark_index_.setCellSize( config.landmark_index_cell_size );
     //
     map_full_leaf_size_ = config.map_full_leaf_size;
     map_full_remove_bad_inlier_ = config.map_full_remove_bad_inlier;
@@ -3183,13 +3614,31 @@ void GTMapping::gtMappingReconfigCallback(plane_slam::GTMappingConfig &config, u
     publish_octomap_ = config.publish_octomap;
     publish_keypoint_cloud_ = config.publish_keypoint_cloud;
     publish_optimized_path_ = config.publish_optimized_path;
+    local_map_radius_ = config.local_map_radius;
+    //
+    keyframe_culling_ = config.keyframe_culling;
+    keyframe_culling_interval_ = config.keyframe_culling_interval;
+    keyframe_culling_window_ = config.keyframe_culling_window;
+    keyframe_culling_min_observers_ = config.keyframe_culling_min_observers;
+    keyframe_culling_redundancy_ = config.keyframe_culling_redundancy;
+    //
+    use_covisibility_ = config.use_covisibility;
+    covisibility_min_weight_ = config.covisibility_min_weight;
+    covisibility_max_neighbours_ = config.covisibility_max_neighbours;
+    use_analytic_factors_ = config.use_analytic_factors;
+    //
+    use_submaps_ = config.use_submaps;
+    submap_max_keyframes_ = config.submap_max_keyframes;
+    submap_max_radius_ = config.submap_max_radius;
+    submap_hot_count_ = config.submap_hot_count;
+    submap_directory_ = config.submap_directory;
 
     cout << GREEN <<" GTSAM Mapping Config." << RESET << endl;
 }
 
 bool GTMapping::optimizeGraphCallback(std_srvs::Trigger::Request &req, std_srvs::Trigger::Response &res)
 {
-    if( isam2_->empty() )
+    if( optimizer_.empty() )
     {
         res.success = false;
         res.message = " Failed, graph is empty.";
@@ -3214,7 +3663,7 @@ bool GTMapping::optimizeGraphCallback(std_srvs::Trigger::Request &req, std_srvs:
 
 bool GTMapping::saveGraphCallback(std_srvs::Trigger::Request &req, std_srvs::Trigger::Response &res)
 {
-    if( isam2_->empty() )
+    if( optimizer_.empty() )
     {
         res.success = false;
         res.message = " Failed, graph is empty.";
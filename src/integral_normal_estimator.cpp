@@ -0,0 +1,205 @@
+#include "integral_normal_estimator.h"
+#include <Eigen/Eigenvalues>
+#include <limits>
+
+namespace plane_slam
+{
+
+IntegralNormalEstimator::IntegralNormalEstimator()
+    : smoothing_size_( 10 )
+    , max_depth_change_factor_( 0.02 )
+{
+}
+
+void IntegralNormalEstimator::compute( const PointCloudType &cloud, NormalCloud &normals )
+{
+    const int width = cloud.width;
+    const int height = cloud.height;
+    const int stride = (width + 1) * CHANNELS;
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+
+    normals.width = width;
+    normals.height = height;
+    normals.is_dense = false;
+    normals.points.resize( width * height );    // keeps capacity between frames
+    if( !width || !height )
+        return;
+
+    /// 1: Moments and distance to discontinuities
+    computeIntegral( cloud );
+    computeDistanceMap( cloud );
+
+    /// 2: Box sum in the shrunk window, covariance and its smallest eigenvector
+    const int half_size = std::max( 1, smoothing_size_ / 2 );
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver;
+    for( int v = 0; v < height; v++)
+    {
+        for( int u = 0; u < width; u++)
+        {
+            const int idx = v*width + u;
+            pcl::Normal &normal = normals.points[idx];
+            normal.normal_x = normal.normal_y = normal.normal_z = normal.curvature = nan;
+
+            const int r = std::min( half_size, (int)distance_[idx] );
+            if( r < 1 )
+                continue;
+            const int u0 = std::max( u - r, 0 );
+            const int u1 = std::min( u + r + 1, width );
+            const int v0 = std::max( v - r, 0 );
+            const int v1 = std::min( v + r + 1, height );
+            const Moments m = Eigen::Map<const Moments>( &integral_[v1*stride + u1*CHANNELS] )
+                    - Eigen::Map<const Moments>( &integral_[v0*stride + u1*CHANNELS] )
+                    - Eigen::Map<const Moments>( &integral_[v1*stride + u0*CHANNELS] )
+                    + Eigen::Map<const Moments>( &integral_[v0*stride + u0*CHANNELS] );
+            if( m(0) < 3 )
+                continue;
+
+            const Eigen::Vector3d mean = m.segment<3>(1) / m(0);
+            Eigen::Matrix3d covariance;
+            covariance << m(4), m(5), m(6),
+                          m(5), m(7), m(8),
+                          m(6), m(8), m(9);
+            covariance = covariance / m(0) - mean * mean.transpose();
+            solver.computeDirect( covariance );
+            const Eigen::Vector3d &lambda = solver.eigenvalues();
+            const double sum = lambda.sum();
+            if( !(sum > 0) )
+                continue;
+
+            // towards viewpoint
+            Eigen::Vector3d n = solver.eigenvectors().col(0);
+            const PointType &p = cloud.points[idx];
+            if( n(0)*p.x + n(1)*p.y + n(2)*p.z > 0 )
+                n = -n;
+            normal.normal_x = n(0);
+            normal.normal_y = n(1);
+            normal.normal_z = n(2);
+            normal.curvature = std::max( lambda(0), 0.0 ) / sum;
+        }
+    }
+}
+
+void IntegralNormalEstimator::computeIntegral( const PointCloudType &cloud )
+{
+    const int width = cloud.width;
+    const int height = cloud.height;
+    const int stride = (width + 1) * CHANNELS;
+    integral_.assign( (height + 1) * stride, 0.0 );
+
+    // Fixed size Eigen maps, channel sums are vectorized
+    Moments row;
+    Moments sample;
+    for( int v = 0; v < height; v++)
+    {
+        row.setZero();
+        const double *above = &integral_[v*stride];
+        double *current = &integral_[(v+1)*stride];
+        for( int u = 0; u < width; u++)
+        {
+            const PointType &p = cloud.points[v*width + u];
+            if( !std::isnan(p.z) )
+            {
+                const double x = p.x, y = p.y, z = p.z;
+                sample << 1.0, x, y, z, x*x, x*y, x*z, y*y, y*z, z*z;
+                row += sample;
+            }
+            Eigen::Map<Moments>( current + (u+1)*CHANNELS ) = Eigen::Map<const Moments>( above + (u+1)*CHANNELS ) + row;
+        }
+    }
+}
+
+void IntegralNormalEstimator::computeDistanceMap( const PointCloudType &cloud )
+{
+    const int width = cloud.width;
+    const int height = cloud.height;
+    const unsigned short far = std::numeric_limits<unsigned short>::max() - 1;
+    distance_.assign( width * height, far );
+
+    /// 1: Invalid pixel and depth discontinuity to the right or below
+    for( int v = 0; v < height; v++)
+    {
+        for( int u = 0; u < width; u++)
+        {
+            const int idx = v*width + u;
+            const float z = cloud.points[idx].z;
+            if( std::isnan(z) )
+            {
+                distance_[idx] = 0;
+                continue;
+            }
+            const float threshold = max_depth_change_factor_ * z;
+            if( u+1 < width )
+            {
+                const float zr = cloud.points[idx+1].z;
+                if( !std::isnan(zr) && fabs( zr - z ) > threshold )
+                    distance_[idx] = distance_[idx+1] = 0;
+            }
+            if( v+1 < height )
+            {
+                const float zd = cloud.points[idx+width].z;
+                if( !std::isnan(zd) && fabs( zd - z ) > threshold )
+                    distance_[idx] = distance_[idx+width] = 0;
+            }
+        }
+    }
+
+    /// 2: Two pass chessboard distance transform
+    for( int v = 0; v < height; v++)
+    {
+        for( int u = 0; u < width; u++)
+        {
+            unsigned short &d = distance_[v*width + u];
+            if( u > 0 )
+                d = std::min<unsigned short>( d, distance_[v*width + u-1] + 1 );
+            if( v > 0 )
+            {
+                const unsigned short *above = &distance_[(v-1)*width];
+                d = std::min<unsigned short>( d, above[u] + 1 );
+                if( u > 0 )
+                    d = std::min<unsigned short>( d, above[u-1] + 1 );
+                if( u+1 < width )
+                    d = std::min<unsigned short>( d, above[u+1] + 1 );
+            }
+        }
+    }
+    for( int v = height-1; v >= 0; v--)
+    {
+        for( int u = width-1; u >= 0; u--)
+        {
+            unsigned short &d = distance_[v*width + u];
+            if( u+1 < width )
+                d = std::min<unsigned short>( d, distance_[v*width + u+1] + 1 );
+            if( v+1 < height )
+            {
+                const unsigned short *below = &distance_[(v+1)*width];
+                d = std::min<unsigned short>( d, below[u] + 1 );
+                if( u > 0 )
+                    d = std::min<unsigned short>( d, below[u-1] + 1 );
+                if( u+1 < width )
+                    d = std::min<unsigned short>( d, below[u+1] + 1 );
+            }
+        }
+    }
+}
+
+void refinePlaneInlier( const NormalCloud &normals, PlaneType &plane,
+                        double angular_threshold, double max_curvature )
+{
+    const Eigen::Vector3f n = plane.coefficients.head<3>().cast<float>();
+    const float cos_threshold = cos( angular_threshold );
+    int count = 0;
+    for( int i = 0; i < plane.inlier.size(); i++)
+    {
+        const pcl::Normal &normal = normals.points[plane.inlier[i]];
+        if( !std::isnan(normal.normal_z) )
+        {
+            if( fabs( n.dot( normal.getNormalVector3fMap() ) ) < cos_threshold
+                    || normal.curvature > max_curvature )
+                continue;
+        }
+        plane.inlier[count++] = plane.inlier[i];
+    }
+    plane.inlier.resize( count );
+}
+
+} // end of namespace plane_slam
@@ -47,7 +47,9 @@ bool ITree::euclidianPlaneCorrespondences( const vector<PlaneType> &planes,
             if( (fabs(dir_error) < direction_thresh )
                     && (d_error < distance_thresh) )
             {
-                // check overlap
+                // check overlap, needs the projected clouds
+                if( !plane.cloud || !predicted.cloud )
+                    continue;
                 bool overlap;
                 if( plane.cloud->size() < predicted.cloud->size() )
                     overlap = checkPlanesOverlap( predicted, plane, 0.5 );
@@ -74,6 +76,59 @@ bool ITree::euclidianPlaneCorrespondences( const vector<PlaneType> &planes,
     return true;
 }
 
+bool ITree::euclidianPlaneCorrespondences( const vector<PlaneType> &planes,
+                                       const PointCloudType &cloud,
+                                       const vector<PlaneType> &last_planes,
+                                       const PointCloudType &last_cloud,
+                                       vector<PlanePair> &pairs,
+                                       const Eigen::Matrix4d &estimated_transform,
+                                       const double direction_threshold,
+                                       const double distance_threshold )
+{
+    /// 1: Transform, only coefficients are predicted, inlier stay as indices
+    std::vector<PlaneCoefficients> predict_coefficients( last_planes.size() );
+    const Eigen::Matrix4d transform = estimated_transform;
+    for(int i = 0; i < last_planes.size(); i++)
+        transformPlane( last_planes[i].coefficients, transform, predict_coefficients[i] );
+
+    /// 2: Find correspondences
+    const double direction_thresh = direction_threshold * DEG_TO_RAD;
+    const double distance_thresh = distance_threshold;
+    Eigen::VectorXd paired = Eigen::VectorXd::Zero( predict_coefficients.size() );
+    for( int i = 0; i < planes.size(); i++)
+    {
+        const PlaneType &plane = planes[i];
+        //
+        for( int j = 0; j < predict_coefficients.size(); j++)
+        {
+            if( paired[j] ) // already paired
+                continue;
+
+            const PlaneType &predicted = last_planes[j];
+
+            double dir_error, d_error;
+            euclidianDistance( plane.coefficients, predict_coefficients[j], dir_error, d_error);
+            if( (fabs(dir_error) < direction_thresh )
+                    && (d_error < distance_thresh) )
+            {
+                // check overlap
+                bool overlap;
+                if( plane.inlier.size() < predicted.inlier.size() )
+                    overlap = checkPlanesOverlap( last_cloud, predicted, cloud, plane, 0.5 );
+                else
+                    overlap = checkPlanesOverlap( cloud, plane, last_cloud, predicted, 0.5 );
+                if(overlap)
+                {
+                    paired[j] = 1;
+                    pairs.push_back( PlanePair((unsigned int)i, (unsigned int)j, (dir_error+d_error) ));
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
 void ITree::euclidianDistance(const PlaneType &p1, const PlaneType &p2, double &direction, double &distance)
 {
     Eigen::Vector3d n1 = p1.coefficients.head<3>();
@@ -123,6 +178,8 @@ bool ITree::checkCoPlanar( const PlaneType &lm1, const PlaneType &lm2, const dou
 // indices of lm1 must bigger than that of lm2
 bool ITree::checkPlanesOverlap( const PlaneType &lm1, const PlaneType &lm2, const double &overlap)
 {
+    if( !lm1.cloud || !lm2.cloud )
+        return false;
     // project lm2 inlier to lm1 plane
     PointCloudTypePtr cloud_projected( new PointCloudType );
     projectPoints( *lm2.cloud, lm1.coefficients, *cloud_projected );
@@ -158,6 +215,55 @@ bool ITree::checkPlanesOverlap( const PlaneType &lm1, const PlaneType &lm2, cons
     return false;
 }
 
+// 21 bits per axis
+static inline uint64_t projectedVoxelKey( const PointType &pt, const Eigen::Vector3f &n, float d, float resolution )
+{
+    const Eigen::Vector3f p = pt.getVector3fMap();
+    const Eigen::Vector3f q = (p - n * (n.dot(p) + d)) / resolution;
+    const int64_t mask = (1 << 21) - 1;
+    return ( (uint64_t)( (int64_t)floor(q(0)) & mask ) << 42 )
+            | ( (uint64_t)( (int64_t)floor(q(1)) & mask ) << 21 )
+            | (uint64_t)( (int64_t)floor(q(2)) & mask );
+}
+
+// indices of lm1 must bigger than that of lm2
+bool ITree::checkPlanesOverlap( const PointCloudType &cloud1, const PlaneType &lm1,
+                                const PointCloudType &cloud2, const PlaneType &lm2,
+                                const double &overlap )
+{
+    const int threshold = lm2.inlier.size() * overlap;
+    if( lm1.inlier.empty() || lm2.inlier.empty() )
+        return false;
+
+    // voxels of points projected to lm1 plane
+    const float resolution = 0.05;
+    Eigen::Vector3f n = lm1.coefficients.head<3>().cast<float>();
+    const float d = lm1.coefficients(3) / n.norm();
+    n.normalize();
+
+    // occupied voxels of lm1
+    std::vector<uint64_t> voxels( lm1.inlier.size() );
+    for( int i = 0; i < lm1.inlier.size(); i++)
+        voxels[i] = projectedVoxelKey( cloud1.points[lm1.inlier[i]], n, d, resolution );
+    std::sort( voxels.begin(), voxels.end() );
+    voxels.erase( std::unique( voxels.begin(), voxels.end() ), voxels.end() );
+
+    // check if occupied
+    int collision = 0;
+    for( int i = 0; i < lm2.inlier.size(); i++)
+    {
+        if( std::binary_search( voxels.begin(), voxels.end(),
+                                projectedVoxelKey( cloud2.points[lm2.inlier[i]], n, d, resolution ) ) )
+        {
+            collision ++;
+            if( collision > threshold )
+                return true;
+        }
+    }
+
+    return false;
+}
+
 
 /////////////////////////////////////////////////////////////////////////////////////
 
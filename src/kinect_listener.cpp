@@ -37,9 +37,14 @@ KinectListener::KinectListener() :
     orb_extractor_ = new ORBextractor( 1000, 1.2, 8, 20, 7);
     line_based_plane_segmentor_ = new LineBasedPlaneSegmentor(nh_);
     organized_plane_segmentor_ = new OrganizedPlaneSegmentor(nh_);
+    temporal_seeder_ = new TemporalPlaneSeeder();
+    line_based_plane_segmentor_->setTemporalSeeder( temporal_seeder_ );
+    organized_plane_segmentor_->setTemporalSeeder( temporal_seeder_ );
     viewer_ = new Viewer(nh_);
     tracker_ = new Tracking(nh_, viewer_ );
     gt_mapping_ = new GTMapping(nh_, viewer_, tracker_);
+    line_based_plane_segmentor_->setPlanePreprocessor( gt_mapping_->getPlanePreprocessor() );
+    organized_plane_segmentor_->setPlanePreprocessor( gt_mapping_->getPlanePreprocessor() );
     //
     tracker_->setVerbose( verbose_ );
     gt_mapping_->setVerbose( verbose_ );
@@ -396,6 +401,10 @@ void KinectListener::trackDepthRgbImage( const sensor_msgs::ImageConstPtr &visua
     // Record & publish visual odometry & odometry
     recordVisualOdometry( last_frame, frame );
 
+    // Refine pose against local map
+    if( last_frame->valid_ )
+        trackLocalMap( frame );
+
     // Mapping
     if( frame->valid_ && do_slam_ ) // always valid
     {
@@ -498,6 +507,10 @@ void KinectListener::trackDepthRgbImage( const sensor_msgs::ImageConstPtr &visua
     // Record & publish visual odometry & odometry
     recordVisualOdometry( last_frame, frame );
 
+    // Refine pose against local map
+    if( last_frame->valid_ )
+        trackLocalMap( frame );
+
     // Mapping
     if( frame->valid_ && do_slam_ )
     {
@@ -765,6 +778,19 @@ bool KinectListener::trackFrameMotion( Frame* last_frame, Frame *frame )
     return motion.valid;
 }
 
+bool KinectListener::trackLocalMap( Frame *frame )
+{
+    if( !frame->valid_ || !do_slam_ || !tracker_->isLocalMapTracking() )
+        return false;
+
+    gtsam::Pose3 pose;
+    if( !tracker_->trackLocalMap( *frame, gt_mapping_->getLocalMap(), tfToPose3( frame->pose_ ), pose ) )
+        return false;
+
+    frame->pose_ = pose3ToTF( pose );
+    return true;
+}
+
 void KinectListener::recordVisualOdometry( Frame *last_frame, Frame *frame )
 {
     // Publish visual odometry path
@@ -887,9 +913,25 @@ void KinectListener::storeKeyFrame( Frame* &last_frame, Frame* &frame )
         delete frame;   // delete invalid frame
     }
 
+    // Seed segmentation of the next frame
+    updateTemporalSeed( last_frame );
+
 //    cout << YELLOW << " done." << RESET << endl;
 }
 
+void KinectListener::updateTemporalSeed( Frame *last_frame )
+{
+    gtsam::Pose3 motion;
+    if( !use_temporal_segmentation_ || !last_frame->valid_
+            || !tracker_->predictNextMotion( *last_frame, motion ) )
+    {
+        temporal_seeder_->clear();
+        return;
+    }
+
+    temporal_seeder_->setSeed( last_frame->segment_planes_, *(last_frame->cloud_downsampled_), motion.matrix() );
+}
+
 void KinectListener::debugFrame( Frame* frame )
 {
     // Debug frame
@@ -904,7 +946,7 @@ void KinectListener::debugFrame( Frame* frame )
         cout << " planes size: ";
         for( int i = 0; i < frame->segment_planes_.size(); i++)
         {
-            cout << " " << frame->segment_planes_[i].cloud->points.size();
+            cout << " " << frame->segment_planes_[i].inlier.size();
         }
         cout << endl;
 
@@ -931,9 +973,9 @@ void KinectListener::savePlaneLandmarks( const std::string &filename )
     fprintf( yaml, "# lm(a,b,c,d,id,numOfPoints(voxel), semantic_label)");
 
     // Save Landmarks
-    std::map<int, PlaneType*> landmarks = gt_mapping_->getLandmark();
+    const SlotMap<PlaneType*> &landmarks = gt_mapping_->getLandmark();
     fprintf( yaml, "# landmarks, size %d\n\n", landmarks.size() );
-    for( std::map<int, PlaneType*>::const_iterator it = landmarks.begin();
+    for( SlotMap<PlaneType*>::const_iterator it = landmarks.begin();
          it != landmarks.end(); it++)
     {
         PlaneType *lm = it->second;
@@ -980,10 +1022,10 @@ void KinectListener::saveKeypointLandmarks( const std::string &filename )
     fprintf( yaml, "# descriptor: uint64*4 = 256bits = 32bytes\n" );
 
     // Save location
-    std::map<int, KeyPoint*> keypoints = gt_mapping_->getKeypointLandmark();
+    const SlotMap<KeyPoint*> &keypoints = gt_mapping_->getKeypointLandmark();
     fprintf( yaml, "# keypoints, size %d\n", keypoints.size() );
     fprintf( yaml, "# location:\n");
-    for( std::map<int, KeyPoint*>::const_iterator it = keypoints.begin();
+    for( SlotMap<KeyPoint*>::const_iterator it = keypoints.begin();
          it != keypoints.end(); it++)
     {
         KeyPoint *kp = it->second;
@@ -995,7 +1037,7 @@ void KinectListener::saveKeypointLandmarks( const std::string &filename )
 
     // Save descriptor
     fprintf( yaml, "# descriptor:\n" );
-    for( std::map<int, KeyPoint*>::const_iterator it = keypoints.begin();
+    for( SlotMap<KeyPoint*>::const_iterator it = keypoints.begin();
          it != keypoints.end(); it++)
     {
         KeyPoint *kp = it->second;
@@ -1171,9 +1213,9 @@ void KinectListener::saveKeyKrameSequence( const std::string &filename )
     fprintf( yaml, "# format: id sequence\n");
 
     // Save key frame sequences
-    std::map<int, Frame*> frames_list = gt_mapping_->getFrames();
+    const SlotMap<Frame*> &frames_list = gt_mapping_->getFrames();
     fprintf( yaml, "# size: %d\n", frames_list.size());
-    for( std::map<int, Frame*>::iterator it = frames_list.begin();
+    for( SlotMap<Frame*>::const_iterator it = frames_list.begin();
          it != frames_list.end(); it++)
     {
         Frame *frame = it->second;
@@ -1378,6 +1420,16 @@ void KinectListener::publishVisualOdometryPath()
 void KinectListener::planeSlamReconfigCallback(plane_slam::PlaneSlamConfig &config, uint32_t level)
 {
     plane_segment_method_ = config.plane_segment_method;
+    use_temporal_segmentation_ = config.use_temporal_segmentation;
+    temporal_seeder_->setSeedDistanceThreshold( config.temporal_seed_distance_threshold );
+    temporal_seeder_->setDistanceThreshold( config.temporal_distance_threshold );
+    temporal_seeder_->setAngularThreshold( config.temporal_angular_threshold * DEG_TO_RAD );
+    temporal_seeder_->setNeighborThreshold( config.temporal_neighbor_threshold );
+    temporal_seeder_->setMinSupport( config.temporal_min_support );
+    temporal_seeder_->setMinInlier( config.temporal_min_inlier );
+    temporal_seeder_->setVerbose( verbose_ );
+    if( !use_temporal_segmentation_ )
+        temporal_seeder_->clear();
     do_visual_odometry_ = config.do_visual_odometry;
     do_mapping_ = config.do_mapping;
     do_slam_ = config.do_slam;
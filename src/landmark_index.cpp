@@ -0,0 +1,221 @@
+#include "landmark_index.h"
+
+namespace plane_slam
+{
+
+LandmarkIndex::LandmarkIndex()
+    : cell_size_( 1.0 )
+    , max_cells_( 512 )
+{
+}
+
+void LandmarkIndex::update( int id, const PointCloudType &cloud )
+{
+    remove( id );
+    Box &box = boxes_[id];
+
+    /// 1: Bounding box
+    box.min.setConstant( std::numeric_limits<float>::max() );
+    box.max.setConstant( -std::numeric_limits<float>::max() );
+    for( int i = 0; i < cloud.size(); i++)
+    {
+        const PointType &pt = cloud.points[i];
+        if( std::isnan(pt.z) )
+            continue;
+        box.min = box.min.cwiseMin( pt.getVector3fMap() );
+        box.max = box.max.cwiseMax( pt.getVector3fMap() );
+    }
+    box.bounded = (box.min.array() <= box.max.array()).all();
+
+    insert( id, box );
+}
+
+void LandmarkIndex::insert( int id, Box &box )
+{
+    /// 1: Cells covered
+    box.cells.clear();
+    if( box.bounded )
+    {
+        const int x0 = cell( box.min(0) ), x1 = cell( box.max(0) );
+        const int y0 = cell( box.min(1) ), y1 = cell( box.max(1) );
+        const int z0 = cell( box.min(2) ), z1 = cell( box.max(2) );
+        const int64_t cells = (int64_t)(x1-x0+1) * (y1-y0+1) * (z1-z0+1);
+        if( cells <= max_cells_ )
+        {
+            box.cells.reserve( cells );
+            for( int x = x0; x <= x1; x++)
+                for( int y = y0; y <= y1; y++)
+                    for( int z = z0; z <= z1; z++)
+                        box.cells.push_back( cellKey( x, y, z ) );
+        }
+    }
+
+    /// 2: Grid, or tested on every query
+    if( box.cells.empty() )
+    {
+        unbounded_.push_back( id );
+        return;
+    }
+    for( int i = 0; i < box.cells.size(); i++)
+        grid_[box.cells[i]].push_back( id );
+}
+
+void LandmarkIndex::remove( int id )
+{
+    std::unordered_map<int, Box>::iterator it = boxes_.find( id );
+    if( it == boxes_.end() )
+        return;
+
+    const Box &box = it->second;
+    if( box.cells.empty() )
+        unbounded_.erase( std::find( unbounded_.begin(), unbounded_.end(), id ) );
+    for( int i = 0; i < box.cells.size(); i++)
+    {
+        std::unordered_map<int64_t, std::vector<int> >::iterator cit = grid_.find( box.cells[i] );
+        std::vector<int> &ids = cit->second;
+        ids.erase( std::find( ids.begin(), ids.end(), id ) );
+        if( ids.empty() )
+            grid_.erase( cit );
+    }
+    boxes_.erase( it );
+}
+
+void LandmarkIndex::setCellSize( double size )
+{
+    if( size == cell_size_ )
+        return;
+    cell_size_ = size;
+    grid_.clear();
+    unbounded_.clear();
+    for( std::unordered_map<int, Box>::iterator it = boxes_.begin(); it != boxes_.end(); it++)
+        insert( it->first, it->second );
+}
+
+void LandmarkIndex::clear()
+{
+    boxes_.clear();
+    grid_.clear();
+    unbounded_.clear();
+}
+
+void LandmarkIndex::query( const Eigen::Matrix4d &pose, const CameraParameters &camera,
+                           double max_range, double margin, std::vector<int> &ids ) const
+{
+    ids = unbounded_;
+    if( grid_.empty() )
+        return;
+
+    /// 1: Frustum in camera frame, inward normals of the side planes through the origin
+    const float xmin = -camera.cx / camera.fx;
+    const float xmax = (camera.width - camera.cx) / camera.fx;
+    const float ymin = -camera.cy / camera.fy;
+    const float ymax = (camera.height - camera.cy) / camera.fy;
+    const Eigen::Vector3f normals[4] = { Eigen::Vector3f( 1, 0, -xmin ).normalized(),
+                                         Eigen::Vector3f( -1, 0, xmax ).normalized(),
+                                         Eigen::Vector3f( 0, 1, -ymin ).normalized(),
+                                         Eigen::Vector3f( 0, -1, ymax ).normalized() };
+    const Eigen::Matrix3f R = pose.topLeftCorner<3,3>().cast<float>();
+    const Eigen::Vector3f t = pose.topRightCorner<3,1>().cast<float>();
+    const Eigen::Matrix3f Rt = R.transpose();
+
+    /// 2: Cells under the box of the frustum corners
+    Eigen::Vector3f fmin = t, fmax = t;
+    for( int i = 0; i < 4; i++)
+    {
+        const Eigen::Vector3f corner( i & 1 ? xmax : xmin, i & 2 ? ymax : ymin, 1 );
+        const Eigen::Vector3f p = R * corner * max_range + t;
+        fmin = fmin.cwiseMin( p );
+        fmax = fmax.cwiseMax( p );
+    }
+    fmin.array() -= margin;
+    fmax.array() += margin;
+    std::vector<int> candidate_ids;
+    candidates( fmin, fmax, candidate_ids );
+
+    /// 3: Box against the frustum planes
+    for( int i = 0; i < candidate_ids.size(); i++)
+    {
+        if( visible( boxes_.at( candidate_ids[i] ), Rt, t, normals, max_range, margin ) )
+            ids.push_back( candidate_ids[i] );
+    }
+}
+
+void LandmarkIndex::queryRadius( const Eigen::Vector3f &center, double radius, std::vector<int> &ids ) const
+{
+    ids = unbounded_;
+    if( grid_.empty() )
+        return;
+
+    const Eigen::Vector3f extent = Eigen::Vector3f::Constant( radius );
+    std::vector<int> candidate_ids;
+    candidates( center - extent, center + extent, candidate_ids );
+
+    // Distance of the center to the box
+    for( int i = 0; i < candidate_ids.size(); i++)
+    {
+        const Box &box = boxes_.at( candidate_ids[i] );
+        const Eigen::Vector3f d = (box.min - center).cwiseMax( center - box.max ).cwiseMax( Eigen::Vector3f::Zero() );
+        if( d.squaredNorm() <= radius * radius )
+            ids.push_back( candidate_ids[i] );
+    }
+}
+
+void LandmarkIndex::candidates( const Eigen::Vector3f &min, const Eigen::Vector3f &max, std::vector<int> &ids ) const
+{
+    ids.clear();
+    const int x0 = cell( min(0) ), x1 = cell( max(0) );
+    const int y0 = cell( min(1) ), y1 = cell( max(1) );
+    const int z0 = cell( min(2) ), z1 = cell( max(2) );
+    if( (int64_t)(x1-x0+1) * (y1-y0+1) * (z1-z0+1) > (int64_t)grid_.size() )
+    {
+        // Box wider than the map, walk the occupied cells instead
+        for( std::unordered_map<int64_t, std::vector<int> >::const_iterator it = grid_.begin(); it != grid_.end(); it++)
+            ids.insert( ids.end(), it->second.begin(), it->second.end() );
+    }
+    else
+    {
+        for( int x = x0; x <= x1; x++)
+            for( int y = y0; y <= y1; y++)
+                for( int z = z0; z <= z1; z++)
+                {
+                    std::unordered_map<int64_t, std::vector<int> >::const_iterator it = grid_.find( cellKey( x, y, z ) );
+                    if( it != grid_.end() )
+                        ids.insert( ids.end(), it->second.begin(), it->second.end() );
+                }
+    }
+    std::sort( ids.begin(), ids.end() );
+    ids.erase( std::unique( ids.begin(), ids.end() ), ids.end() );
+}
+
+bool LandmarkIndex::visible( const Box &box, const Eigen::Matrix3f &Rt, const Eigen::Vector3f &t,
+                             const Eigen::Vector3f *normals, double max_range, double margin ) const
+{
+    Eigen::Vector3f corners[8];
+    for( int i = 0; i < 8; i++)
+    {
+        const Eigen::Vector3f c( i & 1 ? box.max(0) : box.min(0),
+                                 i & 2 ? box.max(1) : box.min(1),
+                                 i & 4 ? box.max(2) : box.min(2) );
+        corners[i] = Rt * (c - t);
+    }
+
+    // Culled only if all corners are outside of the same plane
+    int near = 0, far = 0;
+    int sides[4] = { 0, 0, 0, 0 };
+    for( int i = 0; i < 8; i++)
+    {
+        const Eigen::Vector3f &p = corners[i];
+        if( p(2) < -margin ) near ++;
+        if( p(2) > max_range + margin ) far ++;
+        for( int k = 0; k < 4; k++)
+            if( normals[k].dot( p ) < -margin ) sides[k] ++;
+    }
+    if( near == 8 || far == 8 )
+        return false;
+    for( int k = 0; k < 4; k++)
+        if( sides[k] == 8 )
+            return false;
+    return true;
+}
+
+} // end of namespace plane_slam
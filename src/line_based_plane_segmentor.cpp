@@ -1,4 +1,5 @@
 #include "line_based_plane_segmentor.h"
+#include <Eigen/Eigenvalues>
 
 namespace plane_slam
 {
@@ -6,6 +7,12 @@ namespace plane_slam
 LineBasedPlaneSegmentor::LineBasedPlaneSegmentor( ros::NodeHandle &nh )
     : private_nh_(nh),
       plane_segmentor_("/home/lizhi/bags/rgbd/config/QQVGA.yaml"),
+      normal_estimator_(),
+      normal_cloud_( new NormalCloud ),
+      temporal_seeder_( NULL ),
+      plane_preprocessor_( NULL ),
+      segment_method_( LIBRARY ),
+      segment_threads_( 4 ),
       line_based_segment_config_server_( ros::NodeHandle( private_nh_, "LineBasedSegment" ) ),
       is_update_line_based_parameters_( true )
 {
@@ -16,6 +23,23 @@ LineBasedPlaneSegmentor::LineBasedPlaneSegmentor( ros::NodeHandle &nh )
 }
 
 void LineBasedPlaneSegmentor::operator()(PointCloudTypePtr &input, std::vector<PlaneType> &planes, CameraParameters &camera_parameters)
+{
+    if( normal_refine_inlier_ )
+        computeNormals( input, normal_cloud_ );
+    else
+        normal_cloud_->clear();
+    (*this)( input, normal_cloud_, planes, camera_parameters );
+}
+
+void LineBasedPlaneSegmentor::computeNormals( const PointCloudTypePtr &input, NormalCloudPtr &normals )
+{
+    normal_estimator_.setMaxDepthChangeFactor( normal_estimate_depth_change_factor_ );
+    normal_estimator_.setSmoothingSize( normal_estimate_smoothing_size_ );
+    normal_estimator_.compute( *input, *normals );
+}
+
+void LineBasedPlaneSegmentor::operator()(PointCloudTypePtr &input, const NormalCloudPtr &normals,
+                                         std::vector<PlaneType> &planes, CameraParameters &camera_parameters)
 {
     PointCloudTypePtr cloud_in (new PointCloudType);
 //    pcl::copyPointCloud( *input, *cloud_in);
@@ -28,6 +52,22 @@ void LineBasedPlaneSegmentor::operator()(PointCloudTypePtr &input, std::vector<P
         is_update_line_based_parameters_ = false;
     }
 
+    // Band-parallel scanline segmentation
+    if( segment_method_ == BANDS )
+    {
+        std::vector<PlaneType> band_planes;
+        bandSegment( *input, *normals, band_planes );
+        for( int i = 0; i < band_planes.size(); i++)
+        {
+            PlaneType &plane = band_planes[i];
+            if( normal_refine_inlier_ && normals->size() == input->size() )
+                refinePlaneInlier( *normals, plane, normal_refine_angular_threshold_*DEG_TO_RAD, normal_refine_max_curvature_ );
+            computePlaneStatistics( *input, plane );
+            planes.push_back( plane );
+        }
+        return;
+    }
+
     // Do segment
     std::vector<line_based_plane_segment::PlaneType> line_based_planes;
     plane_segmentor_.setInputCloud( cloud_in );
@@ -54,7 +94,9 @@ void LineBasedPlaneSegmentor::operator()(PointCloudTypePtr &input, std::vector<P
         plane.inlier = pl.indices;
         plane.boundary_inlier = pl.boundary_indices;
         plane.hull_inlier = pl.hull_indices;
-        projectPoints( *input, plane.inlier, plane.coefficients, *(plane.cloud) );
+        if( normal_refine_inlier_ && normals->size() == input->size() )
+            refinePlaneInlier( *normals, plane, normal_refine_angular_threshold_*DEG_TO_RAD, normal_refine_max_curvature_ );
+        computePlaneStatistics( *input, plane );
 //            getPointCloudFromIndices( input, plane.boundary_inlier, plane.cloud_boundary );
 //            getPointCloudFromIndices( input, plane.hull_inlier, plane.cloud_hull );
         //
@@ -63,6 +105,345 @@ void LineBasedPlaneSegmentor::operator()(PointCloudTypePtr &input, std::vector<P
 
 }
 
+void LineBasedPlaneSegmentor::bandSegment( const PointCloudType &cloud, const NormalCloud &normals, std::vector<PlaneType> &planes )
+{
+    const int width = cloud.width;
+    const int height = cloud.height;
+    const int bands = std::max( 1, std::min( segment_threads_, height / 8 ) );
+    const NormalCloud *normals_ptr = normals.size() == cloud.size() ? &normals : NULL;
+
+    /// 1: Line segments of horizontal and vertical scanlines, one task per band
+    horizontal_lines_.resize( bands );
+    vertical_lines_.resize( bands );
+    pool_.resize( segment_threads_ - 1 );
+    pool_.run( boost::bind( &LineBasedPlaneSegmentor::extractBandLines, this, &cloud, _1, bands ), bands );
+
+    // Concatenate in band order, horizontal first
+    std::vector<LineSegment> segments;
+    for( int i = 0; i < bands; i++ )
+        segments.insert( segments.end(), horizontal_lines_[i].begin(), horizontal_lines_[i].end() );
+    const int horizontal_size = segments.size();
+    for( int i = 0; i < bands; i++ )
+        segments.insert( segments.end(), vertical_lines_[i].begin(), vertical_lines_[i].end() );
+
+    /// 2: Merge, union crossing segments that lie on a common plane
+    std::vector<int> parent( segments.size() );
+    for( int i = 0; i < parent.size(); i++ )
+        parent[i] = i;
+    // horizontal segments per row
+    std::vector< std::vector<int> > row_segments( height );
+    for( int i = 0; i < horizontal_size; i++ )
+        row_segments[ segments[i].line ].push_back( i );
+    const double sin_threshold = sin( line_fitting_angular_threshold_ * DEG_TO_RAD );
+    for( int j = horizontal_size; j < segments.size(); j++ )
+    {
+        const LineSegment &vs = segments[j];
+        for( int v = vs.begin; v <= vs.end; v++ )
+        {
+            const std::vector<int> &row = row_segments[v];
+            for( int k = 0; k < row.size(); k++ )
+            {
+                const LineSegment &hs = segments[row[k]];
+                if( vs.line < hs.begin || vs.line > hs.end )
+                    continue;
+                Eigen::Vector3d n = hs.direction.cross( vs.direction );
+                const double norm = n.norm();
+                if( norm < sin_threshold )
+                    continue;
+                n /= norm;
+                if( fabs( n.dot( vs.centroid - hs.centroid ) ) > distance_threshold_ )
+                    continue;
+                // smaller root as parent, independent of thread count
+                int a = row[k], b = j;
+                while( parent[a] != a ) a = parent[a] = parent[parent[a]];
+                while( parent[b] != b ) b = parent[b] = parent[parent[b]];
+                if( a != b )
+                    parent[std::max(a, b)] = std::min(a, b);
+            }
+        }
+    }
+
+    /// 3: Plane of each component, flat enough and seen by both directions
+    band_planes_.clear();
+    std::vector<int> component( segments.size(), -1 );
+    for( int i = 0; i < segments.size(); i++ )
+    {
+        int root = i;
+        while( parent[root] != root ) root = parent[root];
+        if( component[root] < 0 )
+        {
+            component[root] = band_planes_.size();
+            band_planes_.push_back( BandPlane() );
+        }
+        band_planes_[component[root]].segments.push_back( i );
+    }
+    const int margin = std::max( x_interval_, y_interval_ );
+    int valid_planes = 0;
+    for( int i = 0; i < band_planes_.size(); i++ )
+    {
+        BandPlane &bp = band_planes_[i];
+        if( bp.segments.size() < 2 )
+            continue;
+        int count = 0;
+        Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+        Eigen::Matrix3d squared_sum = Eigen::Matrix3d::Zero();
+        bp.u_min = width; bp.u_max = -1; bp.v_min = height; bp.v_max = -1;
+        for( int k = 0; k < bp.segments.size(); k++ )
+        {
+            const LineSegment &ls = segments[bp.segments[k]];
+            count += ls.count;
+            sum += ls.sum;
+            squared_sum += ls.squared_sum;
+            const bool horizontal = bp.segments[k] < horizontal_size;
+            bp.u_min = std::min( bp.u_min, horizontal ? ls.begin : ls.line );
+            bp.u_max = std::max( bp.u_max, horizontal ? ls.end : ls.line );
+            bp.v_min = std::min( bp.v_min, horizontal ? ls.line : ls.begin );
+            bp.v_max = std::max( bp.v_max, horizontal ? ls.line : ls.end );
+        }
+        const Eigen::Vector3d centroid = sum / count;
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver;
+        solver.computeDirect( squared_sum / count - centroid * centroid.transpose() );
+        const double curvature = solver.eigenvalues()(0) / solver.eigenvalues().sum();
+        if( !(curvature <= max_curvature_) )
+            continue;
+        Eigen::Vector3d n = solver.eigenvectors().col(0);
+        if( n.dot( centroid ) > 0 )
+            n = -n;
+        bp.coefficients << n, -n.dot( centroid );
+        bp.u_min = std::max( bp.u_min - margin, 0 );
+        bp.u_max = std::min( bp.u_max + margin, width-1 );
+        bp.v_min = std::max( bp.v_min - margin, 0 );
+        bp.v_max = std::min( bp.v_max + margin, height-1 );
+        band_planes_[valid_planes++] = bp;
+    }
+    band_planes_.resize( valid_planes );
+    if( band_planes_.empty() )
+        return;
+
+    /// 4: Label pixels by nearest plane, bands of rows in parallel
+    labels_.assign( width * height, -1 );
+    const int rows = (height + bands - 1) / bands;
+    pool_.run( boost::bind( &LineBasedPlaneSegmentor::labelBand, this, &cloud, normals_ptr, rows, _1 ), bands );
+
+    /// 5: Grow each plane from its segments over connected pixels with the same label
+    regions_.assign( width * height, -1 );
+    const float squared_neighbor = neighbor_threshold_ * neighbor_threshold_;
+    std::vector< std::vector<int> > inliers( band_planes_.size() );
+    std::vector<int> queue;
+    for( int r = 0; r < band_planes_.size(); r++ )
+    {
+        const BandPlane &bp = band_planes_[r];
+        queue.clear();
+        for( int k = 0; k < bp.segments.size(); k++ )
+        {
+            const LineSegment &ls = segments[bp.segments[k]];
+            const bool horizontal = bp.segments[k] < horizontal_size;
+            for( int t = ls.begin; t <= ls.end; t++ )
+            {
+                const int idx = horizontal ? ls.line*width + t : t*width + ls.line;
+                if( labels_[idx] == r && regions_[idx] < 0 )
+                {
+                    regions_[idx] = r;
+                    queue.push_back( idx );
+                }
+            }
+        }
+        for( int q = 0; q < queue.size(); q++ )
+        {
+            const int idx = queue[q];
+            const int u = idx % width;
+            const int v = idx / width;
+            const int neighbors[4] = { u > 0 ? idx-1 : -1, u+1 < width ? idx+1 : -1,
+                                       v > 0 ? idx-width : -1, v+1 < height ? idx+width : -1 };
+            for( int k = 0; k < 4; k++ )
+            {
+                const int n = neighbors[k];
+                if( n < 0 || labels_[n] != r || regions_[n] >= 0 )
+                    continue;
+                if( (cloud.points[n].getVector3fMap() - cloud.points[idx].getVector3fMap()).squaredNorm() > squared_neighbor )
+                    continue;
+                regions_[n] = r;
+                queue.push_back( n );
+            }
+        }
+        inliers[r] = queue;
+        std::sort( inliers[r].begin(), inliers[r].end() );
+    }
+
+    /// 6: Refit on inlier and extract boundary
+    for( int r = 0; r < band_planes_.size(); r++ )
+    {
+        const std::vector<int> &inlier = inliers[r];
+        if( inlier.size() < min_inliers_ )
+            continue;
+
+        Eigen::Vector3d centroid;
+        PlaneType plane;
+        fitPlane( cloud, inlier, plane.coefficients, centroid );
+        plane.centroid.x = centroid(0);
+        plane.centroid.y = centroid(1);
+        plane.centroid.z = centroid(2);
+        plane.sigmas[0] = 0.008;
+        plane.sigmas[1] = 0.008;
+        plane.sigmas[2] = 0.008;
+        plane.inlier = inlier;
+        extractRegionBoundary( regions_, r, width, height, inlier, plane.boundary_inlier );
+        plane.hull_inlier = plane.boundary_inlier;
+        planes.push_back( plane );
+    }
+}
+
+void LineBasedPlaneSegmentor::extractBandLines( const PointCloudType *cloud, int band, int bands )
+{
+    const int width = cloud->width;
+    const int height = cloud->height;
+    std::vector<LineSegment> *horizontal = &horizontal_lines_[band];
+    std::vector<LineSegment> *vertical = &vertical_lines_[band];
+    horizontal->clear();
+    vertical->clear();
+    std::vector<int> indices;
+
+    // Rows on the y_interval grid inside the band
+    if( use_horizontal_line_ )
+    {
+        const int rows = (height + bands - 1) / bands;
+        const int row_end = std::min( height, (band+1)*rows );
+        for( int v = ((band*rows + y_interval_ - 1) / y_interval_) * y_interval_; v < row_end; v += y_interval_ )
+        {
+            indices.resize( width );
+            for( int u = 0; u < width; u++ )
+                indices[u] = v*width + u;
+            fitLineSegments( *cloud, indices, v, *horizontal );
+        }
+    }
+
+    // Columns on the x_interval grid inside the band
+    if( use_verticle_line_ )
+    {
+        const int cols = (width + bands - 1) / bands;
+        const int col_end = std::min( width, (band+1)*cols );
+        for( int u = ((band*cols + x_interval_ - 1) / x_interval_) * x_interval_; u < col_end; u += x_interval_ )
+        {
+            indices.resize( height );
+            for( int v = 0; v < height; v++ )
+                indices[v] = v*width + u;
+            fitLineSegments( *cloud, indices, u, *vertical );
+        }
+    }
+}
+
+void LineBasedPlaneSegmentor::fitLineSegments( const PointCloudType &cloud, const std::vector<int> &indices, int line,
+                                               std::vector<LineSegment> &segments )
+{
+    const float squared_gap = line_point_min_distance_ * line_point_min_distance_;
+    const int size = indices.size();
+    std::vector< std::pair<int, int> > stack;
+
+    int run_begin = 0;
+    while( run_begin < size )
+    {
+        /// 1: Run of valid points without a gap
+        if( std::isnan( cloud.points[indices[run_begin]].z ) )
+        {
+            run_begin ++;
+            continue;
+        }
+        int run_end = run_begin;
+        while( run_end+1 < size && !std::isnan( cloud.points[indices[run_end+1]].z )
+               && (cloud.points[indices[run_end+1]].getVector3fMap()
+                   - cloud.points[indices[run_end]].getVector3fMap()).squaredNorm() < squared_gap )
+            run_end ++;
+
+        /// 2: Split at the farthest point from the chord, left piece first
+        stack.clear();
+        stack.push_back( std::pair<int, int>( run_begin, run_end ) );
+        while( !stack.empty() )
+        {
+            const int begin = stack.back().first;
+            const int end = stack.back().second;
+            stack.pop_back();
+            if( end - begin + 1 < line_fitting_min_indices_ )
+                continue;
+
+            const Eigen::Vector3f a = cloud.points[indices[begin]].getVector3fMap();
+            const Eigen::Vector3f chord = (cloud.points[indices[end]].getVector3fMap() - a).normalized();
+            int farthest = begin;
+            float max_distance = 0;
+            for( int i = begin+1; i < end; i++ )
+            {
+                const Eigen::Vector3f d = cloud.points[indices[i]].getVector3fMap() - a;
+                const float distance = (d - chord * chord.dot( d )).norm();
+                if( distance > max_distance )
+                {
+                    max_distance = distance;
+                    farthest = i;
+                }
+            }
+            if( max_distance > distance_threshold_ )
+            {
+                stack.push_back( std::pair<int, int>( farthest+1, end ) );
+                stack.push_back( std::pair<int, int>( begin, farthest ) );
+                continue;
+            }
+
+            LineSegment ls;
+            ls.line = line;
+            ls.begin = begin;
+            ls.end = end;
+            ls.count = end - begin + 1;
+            ls.sum.setZero();
+            ls.squared_sum.setZero();
+            for( int i = begin; i <= end; i++ )
+            {
+                const Eigen::Vector3d p = cloud.points[indices[i]].getVector3fMap().cast<double>();
+                ls.sum += p;
+                ls.squared_sum += p * p.transpose();
+            }
+            ls.centroid = ls.sum / ls.count;
+            Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver;
+            solver.computeDirect( ls.squared_sum / ls.count - ls.centroid * ls.centroid.transpose() );
+            ls.direction = solver.eigenvectors().col(2);
+            segments.push_back( ls );
+        }
+
+        run_begin = run_end + 1;
+    }
+}
+
+void LineBasedPlaneSegmentor::labelBand( const PointCloudType *cloud, const NormalCloud *normals, int rows, int band )
+{
+    const int width = cloud->width;
+    const int row_begin = band * rows;
+    const int row_end = std::min( (int)cloud->height, row_begin + rows );
+    const float cos_threshold = cos( angular_threshold_ * DEG_TO_RAD );
+    for( int v = row_begin; v < row_end; v++ )
+    {
+        for( int u = 0; u < width; u++ )
+        {
+            const int idx = v*width + u;
+            const PointType &p = cloud->points[idx];
+            if( std::isnan(p.z) )
+                continue;
+            double min_distance = distance_threshold_;
+            for( int r = 0; r < band_planes_.size(); r++ )
+            {
+                const BandPlane &bp = band_planes_[r];
+                if( u < bp.u_min || u > bp.u_max || v < bp.v_min || v > bp.v_max )
+                    continue;
+                const double distance = fabs( bp.coefficients(0)*p.x + bp.coefficients(1)*p.y
+                                              + bp.coefficients(2)*p.z + bp.coefficients(3) );
+                if( distance > min_distance )
+                    continue;
+                if( normals && !std::isnan( normals->points[idx].normal_z )
+                        && fabs( bp.coefficients.head<3>().cast<float>().dot( normals->points[idx].getNormalVector3fMap() ) ) < cos_threshold )
+                    continue;
+                min_distance = distance;
+                labels_[idx] = r;
+            }
+        }
+    }
+}
+
 // update parameters
 void LineBasedPlaneSegmentor::updateLineBasedPlaneSegmentParameters()
 {
@@ -137,6 +518,13 @@ void LineBasedPlaneSegmentor::lineBasedSegmentReconfigCallback( plane_slam::Line
     normal_estimate_method_ = config.normal_estimate_method;
     normal_estimate_depth_change_factor_ = config.normal_estimate_depth_change_factor;
     normal_estimate_smoothing_size_ = config.normal_estimate_smoothing_size;
+    //
+    segment_method_ = config.segment_method;
+    segment_threads_ = config.segment_threads;
+    //
+    normal_refine_inlier_ = config.normal_refine_inlier;
+    normal_refine_angular_threshold_ = config.normal_refine_angular_threshold;
+    normal_refine_max_curvature_ = config.normal_refine_max_curvature;
 
     cout << GREEN <<" Line Based Segment Config." << RESET << endl;
 
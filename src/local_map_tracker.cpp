@@ -0,0 +1,253 @@
+#include "local_map_tracker.h"
+
+namespace plane_slam
+{
+
+static inline Eigen::Matrix3d skew( const Eigen::Vector3d &v )
+{
+    Eigen::Matrix3d m;
+    m << 0, -v(2), v(1),
+         v(2), 0, -v(0),
+         -v(1), v(0), 0;
+    return m;
+}
+
+LocalMapTracker::LocalMapTracker()
+    : verbose_( false )
+    , search_radius_( 20.0 )
+    , hamming_threshold_( 40 )
+    , iterations_( 10 )
+    , point_sigma_( 0.005 )
+    , plane_direction_sigma_( 0.01 )
+    , plane_distance_sigma_( 0.01 )
+    , plane_direction_threshold_( 10.0*DEG_TO_RAD )
+    , plane_distance_threshold_( 0.1 )
+    , huber_( 3.0 )
+    , min_inlier_( 20 )
+    , max_translation_( 0.1 )
+    , max_rotation_( 5.0*DEG_TO_RAD )
+{
+}
+
+bool LocalMapTracker::track( const Frame &frame, const LocalMap &map,
+                             const gtsam::Pose3 &initial_pose, gtsam::Pose3 &pose )
+{
+    pose = initial_pose;
+    if( !map.valid )
+        return false;
+
+    /// 1: Associate with the initial pose
+    matchKeypoints( frame, map, initial_pose );
+    matchPlanes( frame, map, initial_pose );
+    if( keypoint_matches_.size() < 3 && plane_matches_.size() < 3 )
+        return false;
+
+    /// 2: Gauss-Newton on the map to camera transform, left perturbation
+    Eigen::Matrix4d T = initial_pose.inverse().matrix();
+    System system;
+    for( int it = 0; it < iterations_; it++ )
+    {
+        reduce( frame, map, T, system );
+        const Eigen::Matrix<double, 6, 1> xi = system.JtJ.ldlt().solve( -system.Jtr );
+        if( xi != xi )
+            return false;
+        T = gtsam::Pose3::Expmap( xi ).matrix() * T;
+        if( xi.norm() < 1e-6 )
+            break;
+    }
+
+    /// 3: Check observability, inlier and correction
+    reduce( frame, map, T, system );
+    Eigen::SelfAdjointEigenSolver< Eigen::Matrix<double, 6, 6> > solver( system.JtJ );
+    const bool observable = solver.eigenvalues()(0) > 1e-6 * solver.eigenvalues()(5);
+    const gtsam::Pose3 refined = gtsam::Pose3( T ).inverse();
+    const gtsam::Pose3 correction = initial_pose.between( refined );
+    const gtsam::Point3 &dt = correction.translation();
+    const bool small = Eigen::Vector3d( dt.x(), dt.y(), dt.z() ).norm() < max_translation_
+            && gtsam::Rot3::Logmap( correction.rotation() ).norm() < max_rotation_;
+    const bool valid = observable && small
+            && ( system.point_inlier >= min_inlier_ || system.plane_inlier >= 3 );
+
+    if( verbose_ )
+    {
+        cout << GREEN << " Local map tracking, keypoints = " << keypoint_matches_.size()
+             << ", planes = " << plane_matches_.size()
+             << ", inlier = " << system.point_inlier << "/" << system.plane_inlier
+             << ", correction = " << Eigen::Vector3d( dt.x(), dt.y(), dt.z() ).norm()
+             << ", valid = " << (valid?"true":"false") << RESET << endl;
+    }
+
+    if( valid )
+        pose = refined;
+    return valid;
+}
+
+void LocalMapTracker::matchKeypoints( const Frame &frame, const LocalMap &map, const gtsam::Pose3 &pose )
+{
+    keypoint_matches_.clear();
+    if( frame.keypoint_type_.compare("ORB") || !map.keypoints.size() )
+        return;
+
+    const CameraParameters &camera = frame.camera_params_;
+    const float radius = search_radius_;
+    const int cols = camera.width / radius + 1;
+    const int rows = camera.height / radius + 1;
+
+    /// 1: Grid of frame keypoints with depth
+    keypoint_grid_.resize( cols * rows );
+    for( int i = 0; i < keypoint_grid_.size(); i++)
+        keypoint_grid_[i].clear();
+    for( int i = 0; i < frame.feature_locations_2d_.size(); i++)
+    {
+        if( frame.feature_locations_3d_[i](2) == 0 )
+            continue;
+        const cv::Point2f &pt = frame.feature_locations_2d_[i].pt;
+        const int x = std::min( std::max( (int)(pt.x / radius), 0 ), cols-1 );
+        const int y = std::min( std::max( (int)(pt.y / radius), 0 ), rows-1 );
+        keypoint_grid_[y*cols + x].push_back( i );
+    }
+
+    /// 2: Project map keypoints, best descriptor in the search radius
+    const float squared_radius = radius * radius;
+    const uint64_t* descriptors = reinterpret_cast<const uint64_t*>(frame.feature_descriptors_.data);
+    for( int k = 0; k < map.keypoints.size(); k++)
+    {
+        const gtsam::Point3 pt = pose.transform_to( map.keypoints[k] );
+        if( pt.z() <= 0 )
+            continue;
+        const float u = camera.fx * pt.x() / pt.z() + camera.cx;
+        const float v = camera.fy * pt.y() / pt.z() + camera.cy;
+        if( u < 0 || v < 0 || u >= camera.width || v >= camera.height )
+            continue;
+
+        const uint64_t *train_desp = &map.descriptors[4*k];
+        int result_index = -1;
+        int min_distance = 1 + 256;
+        const int x_min = std::max( (int)floor( (u - radius) / radius ), 0 );
+        const int x_max = std::min( (int)floor( (u + radius) / radius ), cols-1 );
+        const int y_min = std::max( (int)floor( (v - radius) / radius ), 0 );
+        const int y_max = std::min( (int)floor( (v + radius) / radius ), rows-1 );
+        for( int y = y_min; y <= y_max; y++)
+        {
+            for( int x = x_min; x <= x_max; x++)
+            {
+                const std::vector<int> &cell = keypoint_grid_[y*cols + x];
+                for( int c = 0; c < cell.size(); c++)
+                {
+                    const int j = cell[c];
+                    const cv::Point2f &kp = frame.feature_locations_2d_[j].pt;
+                    if( (kp.x-u)*(kp.x-u) + (kp.y-v)*(kp.y-v) > squared_radius )
+                        continue;
+                    const int d = hamming_distance_orb32x8_popcountll( descriptors + 4*j, train_desp );
+                    if( d < min_distance )
+                    {
+                        min_distance = d;
+                        result_index = j;
+                    }
+                }
+            }
+        }
+
+        if( min_distance <= hamming_threshold_ )
+            keypoint_matches_.push_back( std::pair<int, int>( result_index, k ) );
+    }
+}
+
+void LocalMapTracker::matchPlanes( const Frame &frame, const LocalMap &map, const gtsam::Pose3 &pose )
+{
+    plane_matches_.clear();
+
+    // Nearest predicted plane, each landmark is used once
+    std::vector<char> paired( map.planes.size(), 0 );
+    for( int i = 0; i < frame.segment_planes_.size(); i++)
+    {
+        const PlaneCoefficients &coef = frame.segment_planes_[i].coefficients;
+        const Eigen::Vector3d normal = coef.head<3>();
+        int best = -1;
+        double min_error = 1e9;
+        for( int j = 0; j < map.planes.size(); j++)
+        {
+            if( paired[j] )
+                continue;
+            const Eigen::Vector4d predicted = map.planes[j].transform( pose ).planeCoefficients();
+            const double direction = acos( std::min( 1.0, normal.dot( predicted.head<3>() ) ) );
+            const double distance = fabs( coef(3) - predicted(3) );
+            if( direction > plane_direction_threshold_ || distance > plane_distance_threshold_ )
+                continue;
+            const double error = direction / plane_direction_threshold_ + distance / plane_distance_threshold_;
+            if( error < min_error )
+            {
+                min_error = error;
+                best = j;
+            }
+        }
+        if( best >= 0 )
+        {
+            paired[best] = 1;
+            plane_matches_.push_back( std::pair<int, int>( i, best ) );
+        }
+    }
+}
+
+void LocalMapTracker::reduce( const Frame &frame, const LocalMap &map, const Eigen::Matrix4d &transform, System &system )
+{
+    const Eigen::Matrix3d R = transform.topLeftCorner<3,3>();
+    const Eigen::Vector3d t = transform.topRightCorner<3,1>();
+
+    system.JtJ.setZero();
+    system.Jtr.setZero();
+    system.error = 0;
+    system.point_inlier = 0;
+    system.plane_inlier = 0;
+
+    /// 1: Points, r = T * P_map - p, sigma grows with squared depth
+    Eigen::Matrix<double, 3, 6> Jp;
+    Jp.rightCols<3>().setIdentity();
+    for( int i = 0; i < keypoint_matches_.size(); i++)
+    {
+        const Eigen::Vector4f &measured = frame.feature_locations_3d_[keypoint_matches_[i].first];
+        const Eigen::Vector3d p = measured.head<3>().cast<double>();
+        const gtsam::Point3 &P = map.keypoints[keypoint_matches_[i].second];
+        const Eigen::Vector3d q = R * Eigen::Vector3d( P.x(), P.y(), P.z() ) + t;
+        const Eigen::Vector3d r = q - p;
+        const double sigma = point_sigma_ * p(2) * p(2);
+        const double information = 1.0 / (sigma * sigma);
+        const double e = sqrt( information * r.squaredNorm() );
+        const double w = information * ( e <= huber_ ? 1.0 : huber_ / e );
+        Jp.leftCols<3>() = -skew( q );
+        system.JtJ += w * Jp.transpose() * Jp;
+        system.Jtr += w * Jp.transpose() * r;
+        system.error += e * e;
+        if( e <= huber_ )
+            system.point_inlier ++;
+    }
+
+    /// 2: Planes, n_c = R * n_map, d_c = d_map - n_c^T * t
+    Eigen::Matrix<double, 4, 6> Jn;
+    Jn.setZero();
+    Eigen::Matrix<double, 4, 1> r;
+    Eigen::Matrix<double, 4, 1> information;
+    information << 1.0 / (plane_direction_sigma_ * plane_direction_sigma_),
+            1.0 / (plane_direction_sigma_ * plane_direction_sigma_),
+            1.0 / (plane_direction_sigma_ * plane_direction_sigma_),
+            1.0 / (plane_distance_sigma_ * plane_distance_sigma_);
+    for( int i = 0; i < plane_matches_.size(); i++)
+    {
+        const PlaneCoefficients &measured = frame.segment_planes_[plane_matches_[i].first].coefficients;
+        const Eigen::Vector4d lm = map.planes[plane_matches_[i].second].planeCoefficients();
+        const Eigen::Vector3d n = R * lm.head<3>();
+        r.head<3>() = n - measured.head<3>();
+        r(3) = lm(3) - n.dot( t ) - measured(3);
+        Jn.topLeftCorner<3,3>() = -skew( n );
+        Jn.bottomRightCorner<1,3>() = -n.transpose();
+        const double e = sqrt( r.dot( information.cwiseProduct( r ) ) );
+        const double k = e <= huber_ ? 1.0 : huber_ / e;
+        system.JtJ += k * Jn.transpose() * information.asDiagonal() * Jn;
+        system.Jtr += k * Jn.transpose() * information.cwiseProduct( r );
+        system.error += e * e;
+        if( e <= huber_ )
+            system.plane_inlier ++;
+    }
+}
+
+} // end of namespace plane_slam
@@ -4,6 +4,10 @@
 OrganizedPlaneSegmentor::OrganizedPlaneSegmentor( ros::NodeHandle &nh ):
     private_nh_(nh)
   , ne_()
+  , integral_ne_()
+  , normal_cloud_( new NormalCloud )
+  , temporal_seeder_( NULL )
+  , plane_preprocessor_( NULL )
   , mps_()
   , organized_segment_config_server_( ros::NodeHandle( private_nh_, "OrganizedSegment" ) )
   , is_update_organized_parameters_( true )
@@ -57,6 +61,8 @@ void OrganizedPlaneSegmentor::updateOrganizedSegmentParameters()
     }
     ne_.setMaxDepthChangeFactor(ne_max_depth_change_factor_);
     ne_.setNormalSmoothingSize(ne_normal_smoothing_size_);
+    integral_ne_.setMaxDepthChangeFactor(ne_max_depth_change_factor_);
+    integral_ne_.setSmoothingSize(ne_normal_smoothing_size_);
     //
     mps_.setMinInliers (min_inliers_);
     mps_.setAngularThreshold (0.017453 * angular_threshold_);
@@ -69,9 +75,15 @@ void OrganizedPlaneSegmentor::updateOrganizedSegmentParameters()
 
 
 void OrganizedPlaneSegmentor::operator()( const PointCloudTypePtr &input, std::vector<PlaneType> &planes )
+{
+    computeNormals( input, normal_cloud_ );
+    (*this)( input, normal_cloud_, planes );
+}
+
+void OrganizedPlaneSegmentor::operator()( const PointCloudTypePtr &input, const NormalCloudPtr &normals, std::vector<PlaneType> &planes )
 {
     OrganizedPlaneSegmentResult segment_result;
-    segment( input, segment_result );
+    segment( input, normals, segment_result );
 
 //    cout << BOLDWHITE << "OMPS planes = " << BOLDCYAN << segment_result.regions.size() << RESET << endl;
 
@@ -98,7 +110,7 @@ void OrganizedPlaneSegmentor::operator()( const PointCloudTypePtr &input, std::v
         plane.inlier = indices.indices;
         plane.boundary_inlier = boundary.indices;
         plane.hull_inlier = boundary.indices;
-        projectPoints( *input, plane.inlier, plane.coefficients, *(plane.cloud) );
+        computePlaneStatistics( *input, plane );
 //        getPointCloudFromIndices( input, plane.inlier, plane.cloud );
 //            getPointCloudFromIndices( input, plane.boundary_inlier, plane.cloud_boundary );
 //            getPointCloudFromIndices( input, plane.hull_inlier, plane.cloud_hull );
@@ -107,34 +119,49 @@ void OrganizedPlaneSegmentor::operator()( const PointCloudTypePtr &input, std::v
     }
 }
 
-void OrganizedPlaneSegmentor::segment(const pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &input, VectorPlanarRegion &regions)
+void OrganizedPlaneSegmentor::computeNormals( const PointCloudTypePtr &input, NormalCloudPtr &normals )
 {
     //
     updateOrganizedSegmentParameters();
 
+    if( ne_method_ == 0 )
+    {
+        integral_ne_.compute( *input, *normals );
+    }
+    else
+    {
+        ne_.setInputCloud(input);
+        ne_.compute(*normals);
+    }
+}
+
+void OrganizedPlaneSegmentor::segment(const pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &input, VectorPlanarRegion &regions)
+{
     // Calculate Normals
-    pcl::PointCloud<pcl::Normal>::Ptr normal_cloud (new pcl::PointCloud<pcl::Normal>);
-    ne_.setInputCloud(input);
-    ne_.compute(*normal_cloud);
+    computeNormals( input, normal_cloud_ );
 
     // Segment
-    mps_.setInputNormals(normal_cloud);
+    mps_.setInputNormals(normal_cloud_);
     mps_.setInputCloud(input);
     mps_.segmentAndRefine(regions);
 }
 
 void OrganizedPlaneSegmentor::segment(const pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &input, OrganizedPlaneSegmentResult &result)
+{
+    // Calculate Normals
+    computeNormals( input, normal_cloud_ );
+
+    segment( input, normal_cloud_, result );
+}
+
+void OrganizedPlaneSegmentor::segment(const pcl::PointCloud<pcl::PointXYZRGBA>::Ptr &input, const NormalCloudPtr &normals,
+                                      OrganizedPlaneSegmentResult &result)
 {
     //
     updateOrganizedSegmentParameters();
 
-    // Calculate Normals
-    pcl::PointCloud<pcl::Normal>::Ptr normal_cloud (new pcl::PointCloud<pcl::Normal>);
-    ne_.setInputCloud(input);
-    ne_.compute(*normal_cloud);
-
     // Segment
-    mps_.setInputNormals(normal_cloud);
+    mps_.setInputNormals(normals);
     mps_.setInputCloud(input);
     mps_.segmentAndRefine(result.regions, result.model_coeffs, result.inlier_indices, result.labels, result.label_indices, result.boundary_indices);
 }
@@ -0,0 +1,106 @@
+#include "plane_buckets.h"
+
+namespace plane_slam
+{
+
+// Distance between unit normals with the given angle between them
+static inline double chord( double angle )
+{
+    return 2.0 * sin( std::min( angle, M_PI ) * 0.5 );
+}
+
+PlaneBuckets::PlaneBuckets()
+    : cell_size_( chord( 10.0*DEG_TO_RAD ) )
+{
+}
+
+void PlaneBuckets::setAngularResolution( double angle )
+{
+    const double size = std::max( chord( angle ), 0.01 );
+    if( size == cell_size_ )
+        return;
+    cell_size_ = size;
+
+    /// Rehash
+    std::vector<std::pair<int, double> > items;
+    items.reserve( entries_.size() );
+    for( std::unordered_map<int, Entry>::iterator it = entries_.begin(); it != entries_.end(); it++)
+        items.push_back( std::make_pair( it->first, it->second.item->first ) );
+    buckets_.clear();
+    for( int i = 0; i < items.size(); i++)
+        insert( items[i].first, entries_.at( items[i].first ), items[i].second );
+}
+
+int64_t PlaneBuckets::cellKey( const Eigen::Vector3d &normal ) const
+{
+    return cellKey( cell( normal(0) ), cell( normal(1) ), cell( normal(2) ) );
+}
+
+void PlaneBuckets::insert( int id, Entry &entry, double d )
+{
+    entry.cell = cellKey( entry.normal );
+    entry.item = buckets_[entry.cell].insert( std::make_pair( d, id ) );
+}
+
+void PlaneBuckets::update( int id, const Eigen::Vector4d &coefficients )
+{
+    remove( id );
+    const double norm = coefficients.head<3>().norm();
+    Entry &entry = entries_[id];
+    entry.normal = coefficients.head<3>() / norm;
+    insert( id, entry, coefficients(3) / norm );
+}
+
+void PlaneBuckets::remove( int id )
+{
+    std::unordered_map<int, Entry>::iterator it = entries_.find( id );
+    if( it == entries_.end() )
+        return;
+
+    std::unordered_map<int64_t, Bucket>::iterator bit = buckets_.find( it->second.cell );
+    bit->second.erase( it->second.item );
+    if( bit->second.empty() )
+        buckets_.erase( bit );
+    entries_.erase( it );
+}
+
+void PlaneBuckets::clear()
+{
+    buckets_.clear();
+    entries_.clear();
+}
+
+void PlaneBuckets::query( const Eigen::Vector4d &coefficients, double angle, double distance, std::vector<int> &ids ) const
+{
+    ids.clear();
+    const double norm = coefficients.head<3>().norm();
+    const Eigen::Vector3d n = coefficients.head<3>() / norm;
+    const double d = coefficients(3) / norm;
+    const double cos_angle = cos( std::min( angle, M_PI ) );
+
+    /// 1: Buckets with a normal closer than the chord of angle
+    const double radius = chord( angle );
+    const int x0 = cell( n(0) - radius ), x1 = cell( n(0) + radius );
+    const int y0 = cell( n(1) - radius ), y1 = cell( n(1) + radius );
+    const int z0 = cell( n(2) - radius ), z1 = cell( n(2) + radius );
+    for( int x = std::max( x0, 0 ); x <= x1; x++)
+        for( int y = std::max( y0, 0 ); y <= y1; y++)
+            for( int z = std::max( z0, 0 ); z <= z1; z++)
+            {
+                std::unordered_map<int64_t, Bucket>::const_iterator bit = buckets_.find( cellKey( x, y, z ) );
+                if( bit == buckets_.end() )
+                    continue;
+
+                /// 2: Offset range in the bucket, then the exact angle
+                const Bucket &bucket = bit->second;
+                Bucket::const_iterator end = bucket.upper_bound( d + distance );
+                for( Bucket::const_iterator it = bucket.lower_bound( d - distance ); it != end; it++)
+                {
+                    if( entries_.at( it->second ).normal.dot( n ) >= cos_angle )
+                        ids.push_back( it->second );
+                }
+            }
+    std::sort( ids.begin(), ids.end() );
+}
+
+} // end of namespace plane_slam
@@ -0,0 +1,116 @@
+#include "plane_preprocessor.h"
+#include "plane_raster.h"
+#include <boost/bind.hpp>
+
+namespace plane_slam
+{
+
+PlanePreprocessor::PlanePreprocessor()
+    : run_in_frame_( false )
+    , leaf_size_( 0.05 )
+    , remove_bad_inlier_( true )
+    , bad_inlier_alpha_( 0.5 )
+    , threads_( 4 )
+{
+}
+
+void PlanePreprocessor::process( const PointCloudType &cloud, std::vector<PlaneType> &planes, bool convex_hull )
+{
+    std::unique_lock<std::mutex> lock( mutex_ );
+    pool_.resize( threads_ - 1 );
+    pool_.run( boost::bind( &PlanePreprocessor::processTask, this, &cloud, &planes, convex_hull, _1 ), planes.size() );
+}
+
+void PlanePreprocessor::processTask( const PointCloudType *cloud, std::vector<PlaneType> *planes, bool convex_hull, int index )
+{
+    process( *cloud, (*planes)[index], convex_hull );
+}
+
+void PlanePreprocessor::process( const PointCloudType &cloud, PlaneType &plane, bool convex_hull )
+{
+    /// 1: Voxelized projected inlier
+    PointCloudTypePtr cloud_voxel( new PointCloudType );
+    voxelGridFilter( getPlaneCloud( cloud, plane ), cloud_voxel, leaf_size_ );
+
+    /// 2: Bad inlier, same radius and neighbors as the mapper
+    if( remove_bad_inlier_ )
+    {
+        const double radius = leaf_size_ * 5;
+        const int min_neighbors = M_PI * radius * radius / (leaf_size_ * leaf_size_) * bad_inlier_alpha_;
+        radiusOutlierRemoval( cloud_voxel, plane.cloud_voxel, radius, min_neighbors );
+    }
+    else
+        plane.cloud_voxel = cloud_voxel;
+    plane.raster.reset( new PlaneRaster );
+    plane.raster->build( *plane.cloud_voxel, plane.coefficients, leaf_size_ );
+
+    /// 3: Ordered hull from the boundary
+    if( !convex_hull )
+        return;
+    std::vector<int> hull;
+    computeHullInlier( cloud, plane.boundary_inlier, plane.coefficients, hull );
+    if( hull.size() >= 3 )
+        plane.hull_inlier.swap( hull );
+}
+
+struct HullPoint
+{
+    double x, y;    // on the plane
+    int index;      // into the cloud
+    bool operator<( const HullPoint &m ) const { return x < m.x || ( x == m.x && y < m.y ); }
+};
+
+// z of the cross product of (b - a) and (c - a)
+static inline double cross( const HullPoint &a, const HullPoint &b, const HullPoint &c )
+{
+    return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+
+void computeHullInlier( const PointCloudType &cloud, const std::vector<int> &boundary,
+                        const Eigen::Vector4d &coefficients, std::vector<int> &hull )
+{
+    hull.clear();
+
+    /// 1: In-plane coordinates, u and v span the plane with u x v along the normal
+    const Eigen::Vector3d n = coefficients.head<3>().normalized();
+    Eigen::Vector3d u = fabs( n(0) ) < 0.9 ? Eigen::Vector3d::UnitX() : Eigen::Vector3d::UnitY();
+    u = (u - n * n.dot( u )).normalized();
+    const Eigen::Vector3d v = n.cross( u );
+    std::vector<HullPoint> points;
+    points.reserve( boundary.size() );
+    for( int i = 0; i < boundary.size(); i++)
+    {
+        const PointType &p = cloud.points[boundary[i]];
+        if( std::isnan(p.z) )
+            continue;
+        const Eigen::Vector3d q = p.getVector3fMap().cast<double>();
+        HullPoint hp = { u.dot(q), v.dot(q), boundary[i] };
+        points.push_back( hp );
+    }
+    if( points.size() < 3 )
+        return;
+
+    /// 2: Monotone chain, lower then upper hull
+    std::sort( points.begin(), points.end() );
+    std::vector<int> chain( 2 * points.size() );
+    int k = 0;
+    for( int i = 0; i < points.size(); i++)
+    {
+        while( k >= 2 && cross( points[chain[k-2]], points[chain[k-1]], points[i] ) <= 0 )
+            k--;
+        chain[k++] = i;
+    }
+    for( int i = points.size() - 2, lower = k + 1; i >= 0; i--)
+    {
+        while( k >= lower && cross( points[chain[k-2]], points[chain[k-1]], points[i] ) <= 0 )
+            k--;
+        chain[k++] = i;
+    }
+
+    // last point repeats the first
+    hull.resize( k - 1 );
+    for( int i = 0; i < k - 1; i++)
+        hull[i] = points[chain[i]].index;
+}
+
+} // end of namespace plane_slam
@@ -0,0 +1,120 @@
+#include "plane_raster.h"
+#include <climits>
+
+namespace plane_slam
+{
+
+PlaneRaster::PlaneRaster()
+    : origin_( Eigen::Vector3d::Zero() )
+    , u_( Eigen::Vector3d::UnitX() )
+    , v_( Eigen::Vector3d::UnitY() )
+    , resolution_( 0.05 )
+    , u0_( 0 ), v0_( 0 )
+    , rows_( 0 ), cols_( 0 ), words_( 0 )
+    , count_( 0 )
+{
+}
+
+void PlaneRaster::build( const PointCloudType &cloud, const Eigen::Vector4d &coefficients, double resolution )
+{
+    /// 1: Plane coordinates
+    const double norm = coefficients.head<3>().norm();
+    const Eigen::Vector3d n = coefficients.head<3>() / norm;
+    origin_ = -n * coefficients(3) / norm;
+    u_ = fabs( n(0) ) < 0.9 ? Eigen::Vector3d::UnitX() : Eigen::Vector3d::UnitY();
+    u_ = (u_ - n * n.dot( u_ )).normalized();
+    v_ = n.cross( u_ );
+    resolution_ = resolution;
+    count_ = 0;
+    bits_.clear();
+    rows_ = cols_ = words_ = 0;
+
+    /// 2: Cells and extent
+    std::vector<int> cells;
+    cells.reserve( cloud.size() * 2 );
+    int umin = INT_MAX, umax = INT_MIN, vmin = INT_MAX, vmax = INT_MIN;
+    for( int i = 0; i < cloud.size(); i++)
+    {
+        const PointType &pt = cloud.points[i];
+        if( std::isnan(pt.z) )
+            continue;
+        const Eigen::Vector3d p = pt.getVector3fMap().cast<double>() - origin_;
+        const int cu = floor( u_.dot( p ) / resolution_ );
+        const int cv = floor( v_.dot( p ) / resolution_ );
+        cells.push_back( cu );
+        cells.push_back( cv );
+        umin = std::min( umin, cu );
+        umax = std::max( umax, cu );
+        vmin = std::min( vmin, cv );
+        vmax = std::max( vmax, cv );
+    }
+    if( cells.empty() )
+        return;
+
+    /// 3: Bits
+    u0_ = umin;
+    v0_ = vmin;
+    cols_ = umax - umin + 1;
+    rows_ = vmax - vmin + 1;
+    words_ = (cols_ + 63) / 64;
+    bits_.assign( rows_ * words_, 0 );
+    for( int i = 0; i < cells.size(); i += 2 )
+    {
+        const int c = cells[i] - u0_;
+        const int r = cells[i+1] - v0_;
+        bits_[r*words_ + c/64] |= (uint64_t)1 << (c % 64);
+    }
+    for( int i = 0; i < bits_.size(); i++)
+        count_ += __builtin_popcountll( bits_[i] );
+}
+
+int PlaneRaster::intersect( const PlaneRaster &other, const Eigen::Matrix4d &transform ) const
+{
+    if( empty() || other.empty() )
+        return 0;
+
+    /// 1: Cell of other (col, row) lands on (a0 + col*ac + row*ar, b0 + col*bc + row*br) of this raster
+    const Eigen::Matrix3d R = transform.topLeftCorner<3,3>();
+    const Eigen::Vector3d t = transform.topRightCorner<3,1>();
+    const Eigen::Vector3d ou = R * other.u_ * other.resolution_;
+    const Eigen::Vector3d ov = R * other.v_ * other.resolution_;
+    const Eigen::Vector3d first = R * other.origin_ + t - origin_
+            + ou * (other.u0_ + 0.5) + ov * (other.v0_ + 0.5);
+    const double a0 = u_.dot( first ) / resolution_ - u0_;
+    const double b0 = v_.dot( first ) / resolution_ - v0_;
+    const double ac = u_.dot( ou ) / resolution_;
+    const double ar = u_.dot( ov ) / resolution_;
+    const double bc = v_.dot( ou ) / resolution_;
+    const double br = v_.dot( ov ) / resolution_;
+
+    /// 2: Test the occupied cells of other against the words of this raster
+    int count = 0;
+    for( int r = 0; r < other.rows_; r++)
+    {
+        for( int w = 0; w < other.words_; w++)
+        {
+            uint64_t word = other.bits_[r*other.words_ + w];
+            while( word )
+            {
+                const int c = w*64 + __builtin_ctzll( word );
+                word &= word - 1;
+                const int col = floor( a0 + c*ac + r*ar );
+                const int row = floor( b0 + c*bc + r*br );
+                if( col < 0 || col >= cols_ || row < 0 || row >= rows_ )
+                    continue;
+                if( bits_[row*words_ + col/64] & ((uint64_t)1 << (col % 64)) )
+                    count ++;
+            }
+        }
+    }
+    return count;
+}
+
+double PlaneRaster::overlap( const PlaneRaster &other, const Eigen::Matrix4d &transform ) const
+{
+    if( other.empty() )
+        return 0;
+    return (double)intersect( other, transform ) / other.count();
+}
+
+} // end of namespace plane_slam
@@ -0,0 +1,129 @@
+#include "rgbd_factors.h"
+#include <Eigen/Cholesky>
+#include <gtsam/linear/NoiseModel.h>
+
+namespace plane_slam
+{
+
+// Whitening is done by the factors
+static const gtsam::SharedNoiseModel &unitNoise()
+{
+    static const gtsam::SharedNoiseModel unit = gtsam::noiseModel::Unit::Create( 3 );
+    return unit;
+}
+
+RGBDPlaneFactor::RGBDPlaneFactor( const gtsam::Vector4 &coefficients, const gtsam::Vector3 &sigmas,
+                                  gtsam::Key pose, gtsam::Key plane )
+    : gtsam::NoiseModelFactor2<gtsam::Pose3, gtsam::OrientedPlane3>( unitNoise(), pose, plane )
+{
+    const double norm = coefficients.head<3>().norm();
+    normal_ = coefficients.head<3>() / norm;
+    distance_ = coefficients(3) / norm;
+
+    // Any axis off the normal
+    gtsam::Vector3 axis( 0, 0, 0 );
+    int k;
+    normal_.cwiseAbs().minCoeff( &k );
+    axis(k) = 1.0;
+    basis1_ = normal_.cross( axis ).normalized();
+    basis2_ = normal_.cross( basis1_ );
+
+    sqrt_information_ = sigmas.cwiseInverse();
+}
+
+gtsam::NonlinearFactor::shared_ptr RGBDPlaneFactor::clone() const
+{
+    return gtsam::NonlinearFactor::shared_ptr( new RGBDPlaneFactor( *this ) );
+}
+
+gtsam::Vector4 RGBDPlaneFactor::measured() const
+{
+    gtsam::Vector4 coefficients;
+    coefficients << normal_, distance_;
+    return coefficients;
+}
+
+gtsam::Vector RGBDPlaneFactor::evaluateError( const gtsam::Pose3 &pose, const gtsam::OrientedPlane3 &plane,
+                                              boost::optional<gtsam::Matrix&> H1,
+                                              boost::optional<gtsam::Matrix&> H2 ) const
+{
+    const gtsam::Matrix3 R = pose.rotation().matrix();
+    const gtsam::Vector3 t( pose.x(), pose.y(), pose.z() );
+    const gtsam::Vector3 n_w = plane.normal().unitVector();
+
+    /// 1: Plane in the camera frame, n_c = R'n, d_c = n't + d
+    const gtsam::Vector3 n_c = R.transpose() * n_w;
+    const double d_c = n_w.dot( t ) + plane.distance();
+
+    gtsam::Vector error( 3 );
+    error << sqrt_information_(0) * basis1_.dot( n_c ),
+             sqrt_information_(1) * basis2_.dot( n_c ),
+             sqrt_information_(2) * (d_c - distance_);
+
+    /// 2: Whitened Jacobians. Pose tangent is [w, v], R exp(w) and t + Rv: dn_c = [n_c]x w,
+    ///    dd_c = n_c'v. Plane tangent is the normal basis B and the distance.
+    if( H1 )
+    {
+        const gtsam::Matrix3 skew = gtsam::skewSymmetric( n_c );
+        H1->resize( 3, 6 );
+        H1->setZero();
+        H1->block<1,3>(0, 0) = sqrt_information_(0) * basis1_.transpose() * skew;
+        H1->block<1,3>(1, 0) = sqrt_information_(1) * basis2_.transpose() * skew;
+        H1->block<1,3>(2, 3) = sqrt_information_(2) * n_c.transpose();
+    }
+    if( H2 )
+    {
+        const gtsam::Matrix32 &B = plane.normal().basis();
+        const gtsam::Matrix32 RB = R.transpose() * B;
+        H2->resize( 3, 3 );
+        H2->block<1,2>(0, 0) = sqrt_information_(0) * basis1_.transpose() * RB;
+        H2->block<1,2>(1, 0) = sqrt_information_(1) * basis2_.transpose() * RB;
+        H2->block<1,2>(2, 0) = sqrt_information_(2) * t.transpose() * B;
+        (*H2)(0, 2) = 0;
+        (*H2)(1, 2) = 0;
+        (*H2)(2, 2) = sqrt_information_(2);
+    }
+    return error;
+}
+
+RGBDPointFactor::RGBDPointFactor( const gtsam::Point3 &measured, const Eigen::Matrix3d &covariance,
+                                  gtsam::Key pose, gtsam::Key point )
+    : gtsam::NoiseModelFactor2<gtsam::Pose3, gtsam::Point3>( unitNoise(), pose, point )
+    , measured_( measured )
+{
+    // information = L L', R = L'
+    const Eigen::Matrix3d information = covariance.inverse();
+    sqrt_information_ = information.llt().matrixU();
+}
+
+gtsam::NonlinearFactor::shared_ptr RGBDPointFactor::clone() const
+{
+    return gtsam::NonlinearFactor::shared_ptr( new RGBDPointFactor( *this ) );
+}
+
+gtsam::Vector RGBDPointFactor::evaluateError( const gtsam::Pose3 &pose, const gtsam::Point3 &point,
+                                              boost::optional<gtsam::Matrix&> H1,
+                                              boost::optional<gtsam::Matrix&> H2 ) const
+{
+    const gtsam::Matrix3 Rt = pose.rotation().matrix().transpose();
+    const gtsam::Vector3 t( pose.x(), pose.y(), pose.z() );
+    const gtsam::Vector3 p( point.x(), point.y(), point.z() );
+    const gtsam::Vector3 m( measured_.x(), measured_.y(), measured_.z() );
+
+    /// 1: Point in the camera frame, q = R'(p - t)
+    const gtsam::Vector3 q = Rt * (p - t);
+    const gtsam::Vector error = sqrt_information_ * (q - m);
+
+    /// 2: Whitened Jacobians, dq = [q]x w - v, dq = R'dp
+    if( H1 )
+    {
+        H1->resize( 3, 6 );
+        H1->block<3,3>(0, 0) = sqrt_information_ * gtsam::skewSymmetric( q );
+        H1->block<3,3>(0, 3) = -sqrt_information_;
+    }
+    if( H2 )
+        *H2 = sqrt_information_ * Rt;
+    return error;
+}
+
+} // end of namespace plane_slam
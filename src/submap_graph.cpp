@@ -0,0 +1,149 @@
+#include "submap_graph.h"
+#include <sstream>
+#include <pcl/io/pcd_io.h>
+#include <gtsam/inference/Symbol.h>
+#include <gtsam/slam/PriorFactor.h>
+#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam/nonlinear/LevenbergMarquardtOptimizer.h>
+
+namespace plane_slam
+{
+
+Submap::Submap()
+    : id( -1 )
+    , first_frame( -1 )
+    , last_frame( -1 )
+    , hot( true )
+    , cloud( new PointCloudType )
+    , octree( 0 )
+{
+}
+
+Submap::~Submap()
+{
+    evict( "" );
+}
+
+void Submap::evict( const std::string &directory )
+{
+    if( !hot )
+        return;
+
+    /// 1: Map to disk
+    if( !directory.empty() )
+    {
+        std::stringstream ss;
+        ss << directory << "/submap_" << id;
+        if( cloud->size() > 0 )
+            pcl::io::savePCDFileBinary( ss.str() + ".pcd", *cloud );
+        if( octree )
+            octree->write( ss.str() + ".ot" );
+    }
+
+    /// 2: Release
+    for( SlotMap<Frame*>::iterator it = frames.begin(); it != frames.end(); it++)
+        delete it->second;
+    for( SlotMap<PlaneType*>::iterator it = landmarks.begin(); it != landmarks.end(); it++)
+        delete it->second;
+    for( SlotMap<KeyPoint*>::iterator it = keypoints.begin(); it != keypoints.end(); it++)
+        delete it->second;
+    frames.clear();
+    landmarks.clear();
+    keypoints.clear();
+    points.clear();
+    cloud.reset( new PointCloudType );
+    delete octree;
+    octree = 0;
+    hot = false;
+}
+
+SubmapGraph::~SubmapGraph()
+{
+    clear();
+}
+
+void SubmapGraph::add( Submap *submap, const gtsam::SharedNoiseModel &noise )
+{
+    submap->id = submaps_.size();
+    const gtsam::Key key = gtsam::Symbol( 's', submap->id );
+
+    /// 1: The first one fixed at its anchor, the others tied to the previous one
+    if( submaps_.empty() )
+    {
+        graph_.push_back( gtsam::PriorFactor<gtsam::Pose3>( key, submap->anchor,
+                                                             gtsam::noiseModel::Isotropic::Sigma( 6, 1e-6 ) ) );
+        estimate_.insert( key, submap->anchor );
+    }
+    else
+    {
+        const Submap &previous = *submaps_.back();
+        const gtsam::Key previous_key = gtsam::Symbol( 's', previous.id );
+        const gtsam::Pose3 relative = previous.first_pose.between( submap->anchor );
+        graph_.push_back( gtsam::BetweenFactor<gtsam::Pose3>( previous_key, key, relative, noise ) );
+        estimate_.insert( key, estimate_.at<gtsam::Pose3>( previous_key ).compose( relative ) );
+    }
+    submaps_.push_back( submap );
+
+    /// 2: A few nodes, solved from scratch
+    estimate_ = gtsam::LevenbergMarquardtOptimizer( graph_, estimate_ ).optimize();
+}
+
+void SubmapGraph::evict( int hot_count, const std::string &directory )
+{
+    for( int i = 0; i + hot_count < (int)submaps_.size(); i++)
+        submaps_[i]->evict( directory );
+}
+
+void SubmapGraph::clear()
+{
+    for( int i = 0; i < submaps_.size(); i++)
+        delete submaps_[i];
+    submaps_.clear();
+    graph_.resize(0);
+    estimate_.clear();
+}
+
+gtsam::Pose3 SubmapGraph::correction( const Submap &submap ) const
+{
+    return estimate_.at<gtsam::Pose3>( gtsam::Symbol( 's', submap.id ) ).compose( submap.first_pose.inverse() );
+}
+
+gtsam::Pose3 SubmapGraph::placement( const Submap &submap ) const
+{
+    // The active submap is built in the frame of the last finished one
+    if( submaps_.empty() )
+        return gtsam::Pose3();
+    return correction( *submaps_.back() ).between( correction( submap ) );
+}
+
+void SubmapGraph::getCloud( PointCloudType &cloud ) const
+{
+    for( int i = 0; i < submaps_.size(); i++)
+    {
+        const Submap &submap = *submaps_[i];
+        if( !submap.hot || submap.cloud->size() == 0 )
+            continue;
+        PointCloudType placed;
+        transformPointCloud( *(submap.cloud), placed, placement( submap ).matrix() );
+        cloud += placed;
+    }
+}
+
+void SubmapGraph::getPath( std::vector<geometry_msgs::PoseStamped> &poses ) const
+{
+    for( int i = 0; i < submaps_.size(); i++)
+    {
+        const Submap &submap = *submaps_[i];
+        const gtsam::Pose3 transform = placement( submap );
+        for( SlotMap<gtsam::Pose3>::const_iterator it = submap.poses.begin(); it != submap.poses.end(); it++)
+        {
+            geometry_msgs::PoseStamped pose = pose3ToGeometryPose( transform.compose( it->second ) );
+            SlotMap<std_msgs::Header>::const_iterator ith = submap.headers.find( it->first );
+            if( ith != submap.headers.end() )
+                pose.header = ith->second;
+            poses.push_back( pose );
+        }
+    }
+}
+
+} // end of namespace plane_slam
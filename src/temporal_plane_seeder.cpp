@@ -0,0 +1,178 @@
+#include "temporal_plane_seeder.h"
+
+namespace plane_slam
+{
+
+TemporalPlaneSeeder::TemporalPlaneSeeder()
+    : verbose_( false )
+    , seed_distance_threshold_( 0.05 )
+    , distance_threshold_( 0.02 )
+    , angular_threshold_( 10.0*DEG_TO_RAD )
+    , neighbor_threshold_( 0.2 )
+    , min_support_( 0.6 )
+    , min_inlier_( 600 )
+    , remaining_( new PointCloudType )
+{
+}
+
+void TemporalPlaneSeeder::setSeed( const std::vector<PlaneType> &planes, const PointCloudType &cloud,
+                                   const Eigen::Matrix4d &motion )
+{
+    seeds_.resize( planes.size() );
+    const Eigen::Matrix3d R = motion.topLeftCorner<3,3>();
+    const Eigen::Vector3d t = motion.topRightCorner<3,1>();
+    const Eigen::Matrix3f Rt = R.transpose().cast<float>();
+    const Eigen::Vector3f tf = t.cast<float>();
+    for( int i = 0; i < planes.size(); i++)
+    {
+        // n_next = R^T * n, d_next = d + n^T * t
+        const PlaneType &plane = planes[i];
+        Seed &seed = seeds_[i];
+        const Eigen::Vector3d n = plane.coefficients.head<3>();
+        seed.coefficients.head<3>() = R.transpose() * n;
+        seed.coefficients(3) = plane.coefficients(3) + n.dot( t );
+        seed.points.resize( plane.inlier.size() );
+        for( int j = 0; j < plane.inlier.size(); j++)
+            seed.points[j] = Rt * ( cloud.points[plane.inlier[j]].getVector3fMap() - tf );
+    }
+}
+
+void TemporalPlaneSeeder::clear()
+{
+    seeds_.clear();
+}
+
+int TemporalPlaneSeeder::seed( const PointCloudType &cloud, const NormalCloud &normals,
+                               const CameraParameters &camera, std::vector<PlaneType> &planes )
+{
+    const int width = cloud.width;
+    const int height = cloud.height;
+    const bool use_normals = normals.size() == cloud.size();
+    const float cos_threshold = cos( angular_threshold_ );
+    const float squared_neighbor = neighbor_threshold_ * neighbor_threshold_;
+    regions_.assign( width * height, -1 );
+    projected_.assign( width * height, -1 );
+    int seeded = 0;
+
+    for( int s = 0; s < seeds_.size(); s++)
+    {
+        const Seed &seed = seeds_[s];
+
+        /// 1: Projected mask, support of the predicted plane
+        queue_.clear();
+        int projected = 0;
+        for( int i = 0; i < seed.points.size(); i++)
+        {
+            const Eigen::Vector3f &p = seed.points[i];
+            if( p(2) <= 0 )
+                continue;
+            const int u = (int)( camera.fx * p(0) / p(2) + camera.cx + 0.5 );
+            const int v = (int)( camera.fy * p(1) / p(2) + camera.cy + 0.5 );
+            if( u < 0 || u >= width || v < 0 || v >= height )
+                continue;
+            const int idx = v*width + u;
+            const PointType &q = cloud.points[idx];
+            if( projected_[idx] == s || std::isnan(q.z) )
+                continue;
+            projected_[idx] = s;
+            projected ++;
+            if( regions_[idx] >= 0 )
+                continue;
+            const double distance = seed.coefficients(0)*q.x + seed.coefficients(1)*q.y
+                    + seed.coefficients(2)*q.z + seed.coefficients(3);
+            if( fabs( distance ) > seed_distance_threshold_ )
+                continue;
+            if( use_normals && !std::isnan( normals.points[idx].normal_z )
+                    && fabs( seed.coefficients.head<3>().cast<float>().dot( normals.points[idx].getNormalVector3fMap() ) ) < cos_threshold )
+                continue;
+            queue_.push_back( idx );
+        }
+        if( !projected || queue_.size() < min_support_ * projected )
+            continue;
+
+        /// 2: Refit on the support, keep the close ones as growing seeds
+        Eigen::Vector4d coefficients;
+        Eigen::Vector3d centroid;
+        if( !fitPlane( cloud, queue_, coefficients, centroid ) )
+            continue;
+        int count = 0;
+        for( int i = 0; i < queue_.size(); i++)
+        {
+            const PointType &q = cloud.points[queue_[i]];
+            if( fabs( coefficients(0)*q.x + coefficients(1)*q.y + coefficients(2)*q.z + coefficients(3) ) > distance_threshold_ )
+                continue;
+            regions_[queue_[i]] = s;
+            queue_[count++] = queue_[i];
+        }
+        queue_.resize( count );
+
+        /// 3: Grow over connected pixels on the refitted plane
+        for( int i = 0; i < queue_.size(); i++)
+        {
+            const int idx = queue_[i];
+            const int u = idx % width;
+            const int v = idx / width;
+            const int neighbors[4] = { u > 0 ? idx-1 : -1, u+1 < width ? idx+1 : -1,
+                                       v > 0 ? idx-width : -1, v+1 < height ? idx+width : -1 };
+            for( int k = 0; k < 4; k++)
+            {
+                const int n = neighbors[k];
+                if( n < 0 || regions_[n] >= 0 )
+                    continue;
+                const PointType &q = cloud.points[n];
+                if( std::isnan(q.z) )
+                    continue;
+                if( fabs( coefficients(0)*q.x + coefficients(1)*q.y + coefficients(2)*q.z + coefficients(3) ) > distance_threshold_ )
+                    continue;
+                if( (q.getVector3fMap() - cloud.points[idx].getVector3fMap()).squaredNorm() > squared_neighbor )
+                    continue;
+                if( use_normals && !std::isnan( normals.points[n].normal_z )
+                        && fabs( coefficients.head<3>().cast<float>().dot( normals.points[n].getNormalVector3fMap() ) ) < cos_threshold )
+                    continue;
+                regions_[n] = s;
+                queue_.push_back( n );
+            }
+        }
+        if( queue_.size() < min_inlier_ )
+        {
+            for( int i = 0; i < queue_.size(); i++)
+                regions_[queue_[i]] = -1;
+            continue;
+        }
+
+        /// 4: Plane of the grown region
+        PlaneType plane;
+        std::sort( queue_.begin(), queue_.end() );
+        fitPlane( cloud, queue_, plane.coefficients, centroid );
+        plane.sigmas[0] = 0.008;
+        plane.sigmas[1] = 0.008;
+        plane.sigmas[2] = 0.008;
+        plane.inlier = queue_;
+        extractRegionBoundary( regions_, s, width, height, queue_, plane.boundary_inlier );
+        plane.hull_inlier = plane.boundary_inlier;
+        computePlaneStatistics( cloud, plane );
+        planes.push_back( plane );
+        seeded ++;
+    }
+
+    /// 5: Unexplained pixels for full segmentation
+    *remaining_ = cloud;
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    int left = 0;
+    for( int i = 0; i < remaining_->points.size(); i++)
+    {
+        PointType &p = remaining_->points[i];
+        if( regions_[i] >= 0 )
+            p.x = p.y = p.z = nan;
+        else if( !std::isnan(p.z) )
+            left ++;
+    }
+
+    if( verbose_ )
+        cout << GREEN << " Temporal seeds = " << seeds_.size() << ", verified = " << seeded
+             << ", pixels left = " << left << RESET << endl;
+
+    return left;
+}
+
+} // end of namespace plane_slam
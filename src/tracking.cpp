@@ -6,7 +6,10 @@ namespace plane_slam
 Tracking::Tracking( ros::NodeHandle &nh, Viewer * viewer )
     : nh_(nh),
       viewer_(viewer),
-      tracking_config_server_( ros::NodeHandle(nh_, "Tracking") )
+      tracking_config_server_( ros::NodeHandle(nh_, "Tracking") ),
+      has_motion_prior_( false ),
+      velocity_valid_( false ),
+      velocity_interval_( 0 )
 {
     tracking_config_callback_ = boost::bind(&Tracking::trackingReconfigCallback, this, _1, _2);
     tracking_config_server_.setCallback(tracking_config_callback_);
@@ -23,19 +26,21 @@ bool Tracking::trackPlanes(const Frame &source, const Frame &target,
     motion.rmse = 1e9;
     motion.inlier = 0;
 
+    // Odometry is the motion prior
+    has_motion_prior_ = use_motion_prior_;
+    motion_prior_ = gtsam::Pose3( estimated_transform );
+
     // Find plane correspondences
-    const std::vector<PlaneType> &planes = target.segment_planes_;
-    const std::vector<PlaneType> &last_planes = source.segment_planes_;
     std::vector<PlanePair> pairs;
-    if( planes.size() > 0 && last_planes.size() > 0 )
-    {
-        ITree::euclidianPlaneCorrespondences( planes, last_planes, pairs, estimated_transform);
-        std::sort( pairs.begin(), pairs.end() );
-    }
+    findPlaneCorrespondence( &source, &target, estimated_transform, &pairs );
     const int pairs_num = pairs.size();
     cout << GREEN << " Plane pairs = " << pairs_num << RESET << endl;
     if( pairs_num < 3 )
+    {
+        has_motion_prior_ = false;
+        updateVelocity( source, target, motion );
         return false;
+    }
 
     //
     pairs_dura = (ros::Time::now() - start_time).toSec() * 1000;
@@ -50,6 +55,8 @@ bool Tracking::trackPlanes(const Frame &source, const Frame &target,
     best_transform.valid = solveRelativeTransformPlanes( source, target, pairs, best_transform, best_inlier );
     if( best_transform.valid && validRelativeTransform(best_transform) )
         motion = best_transform;
+    has_motion_prior_ = false;
+    updateVelocity( source, target, motion );
     //
     m_e_dura = (ros::Time::now() - start_time).toSec() * 1000;
 
@@ -71,18 +78,19 @@ bool Tracking::track(const Frame &source, const Frame &target,
     double match_kp_dura, match_plane_dura, m_f_dura, m_e_dura, display_dura;
 
     // Find plane correspondences
-    const std::vector<PlaneType> &planes = target.segment_planes_;
-    const std::vector<PlaneType> &last_planes = source.segment_planes_;
     std::vector<PlanePair> pairs;
     // Find keypoint correspondences
     std::vector<cv::DMatch> good_matches;
+    // Motion prior narrows both searches
+    has_motion_prior_ = use_motion_prior_ && predictMotion( source, target, estimated_transform, motion_prior_ );
+    const Eigen::Matrix4d predicted_transform = has_motion_prior_ ? motion_prior_.matrix() : estimated_transform;
     // Spin two threads
     thread threadKpMatch( &Tracking::findKeypointCorrespondence, this, &source, &target, &good_matches );
-    thread threadPlaneMatch( &Tracking::findPlaneCorrespondence, this, &planes, &last_planes, estimated_transform, &pairs );
+    thread threadPlaneMatch( &Tracking::findPlaneCorrespondence, this, &source, &target, predicted_transform, &pairs );
     threadKpMatch.join();
     threadPlaneMatch.join();
 //    findKeypointCorrespondence( &source, &target, &good_matches );
-//    findPlaneCorrespondence( &planes, &last_planes, estimated_transform, &pairs );
+//    findPlaneCorrespondence( &source, &target, estimated_transform, &pairs );
 
     const int pairs_num = pairs.size();
     if( verbose_ )
@@ -108,6 +116,25 @@ bool Tracking::track(const Frame &source, const Frame &target,
     std::vector<PlanePair> pl_inlier;
     bool valid = solveRelativeTransform( source, target, pairs, good_matches,
                                          motion, pl_inlier, kp_inlier );
+    if( !valid && has_motion_prior_ )
+    {
+        // Prior might be wrong, search globally
+        if( verbose_ )
+            cout << YELLOW << " Tracking with motion prior failed, match globally." << RESET << endl;
+        has_motion_prior_ = false;
+        pairs.clear();
+        good_matches.clear();
+        pl_inlier.clear();
+        kp_inlier.clear();
+        thread threadKpMatch( &Tracking::findKeypointCorrespondence, this, &source, &target, &good_matches );
+        thread threadPlaneMatch( &Tracking::findPlaneCorrespondence, this, &source, &target, estimated_transform, &pairs );
+        threadKpMatch.join();
+        threadPlaneMatch.join();
+        valid = solveRelativeTransform( source, target, pairs, good_matches,
+                                        motion, pl_inlier, kp_inlier );
+    }
+    has_motion_prior_ = false;
+    updateVelocity( source, target, motion );
     m_e_dura = (ros::Time::now() - start_time).toSec() * 1000;
     start_time = ros::Time::now();
 
@@ -149,8 +176,12 @@ void Tracking::findKeypointCorrespondence( const Frame *source, const Frame *tar
     ros::Time start_time = ros::Time::now();
     if( !source->keypoint_type_.compare("ORB") && !target->keypoint_type_.compare("ORB") )
     {
-        matchImageFeatures( *source, *target, *good_matches,
-                            feature_good_match_threshold_, feature_min_good_match_size_ );
+        if( has_motion_prior_ )
+            matchImageFeaturesWindow( *source, *target, motion_prior_.matrix(), *good_matches,
+                                      feature_good_match_threshold_, feature_min_good_match_size_ );
+        else
+            matchImageFeatures( *source, *target, *good_matches,
+                                feature_good_match_threshold_, feature_min_good_match_size_ );
     }
     else if( !source->keypoint_type_.compare("SURF") && !target->keypoint_type_.compare("SURF") )
     {
@@ -160,20 +191,74 @@ void Tracking::findKeypointCorrespondence( const Frame *source, const Frame *tar
     keypoint_match_duration_ = (ros::Time::now() - start_time).toSec()*1000;
 }
 
-void Tracking::findPlaneCorrespondence( const std::vector<PlaneType> *planes,
-                                        const std::vector<PlaneType> *last_planes,
+void Tracking::findPlaneCorrespondence( const Frame *source, const Frame *target,
                                         const Eigen::Matrix4d estimated_transform,
                                         std::vector<PlanePair> *pairs )
 {
     ros::Time start_time = ros::Time::now();
-    if( planes->size() > 0 && last_planes->size() > 0 )
+    const std::vector<PlaneType> &planes = target->segment_planes_;
+    const std::vector<PlaneType> &last_planes = source->segment_planes_;
+    if( planes.size() > 0 && last_planes.size() > 0 )
     {
-        ITree::euclidianPlaneCorrespondences( *planes, *last_planes, *pairs, estimated_transform);
+        // Overlap on inlier indices, no projected clouds needed
+        const PointCloudType &cloud = *(target->cloud_downsampled_);
+        const PointCloudType &last_cloud = *(source->cloud_downsampled_);
+        // Tighter gates around the predicted planes
+        if( has_motion_prior_ )
+            ITree::euclidianPlaneCorrespondences( planes, cloud, last_planes, last_cloud, *pairs, estimated_transform,
+                                                  prior_plane_direction_threshold_, prior_plane_distance_threshold_ );
+        else
+            ITree::euclidianPlaneCorrespondences( planes, cloud, last_planes, last_cloud, *pairs, estimated_transform);
         std::sort( pairs->begin(), pairs->end() );
     }
     plane_match_duration_ = (ros::Time::now() - start_time).toSec()*1000;
 }
 
+bool Tracking::predictMotion( const Frame &source, const Frame &target,
+                              const Eigen::Matrix4d &estimated_transform,
+                              gtsam::Pose3 &prior )
+{
+    /// 1: Constant velocity, only between consecutive frames
+    const double interval = (target.stamp_ - source.stamp_).toSec();
+    if( velocity_valid_ && source.stamp_ == velocity_stamp_
+            && interval > 0 && interval < prior_max_interval_ && velocity_interval_ > 0 )
+    {
+        prior = gtsam::Pose3::Expmap( gtsam::Pose3::Logmap( velocity_ ) * (interval / velocity_interval_) );
+        return true;
+    }
+
+    /// 2: Given estimate
+    if( !estimated_transform.isIdentity() )
+    {
+        prior = gtsam::Pose3( estimated_transform );
+        return true;
+    }
+
+    return false;
+}
+
+bool Tracking::predictNextMotion( const Frame &source, gtsam::Pose3 &prior )
+{
+    if( !velocity_valid_ || source.stamp_ != velocity_stamp_ )
+        return false;
+
+    prior = velocity_;
+    return true;
+}
+
+void Tracking::updateVelocity( const Frame &source, const Frame &target, const RESULT_OF_MOTION &motion )
+{
+    // Only the newest frame updates velocity, not the ones from mapping
+    if( target.stamp_ <= velocity_stamp_ )
+        return;
+
+    velocity_stamp_ = target.stamp_;
+    velocity_interval_ = (target.stamp_ - source.stamp_).toSec();
+    velocity_valid_ = motion.valid && velocity_interval_ > 0;
+    if( velocity_valid_ )
+        velocity_ = gtsam::Pose3( gtsam::Rot3(motion.rotation), gtsam::Point3(motion.translation) );
+}
+
 
 bool Tracking::solveRelativeTransformPlanes( const Frame &source,
                                              const Frame &target,
@@ -187,73 +272,489 @@ bool Tracking::solveRelativeTransformPlanes( const Frame &source,
     if( planes.size() < 3 || last_planes.size() < 3 || pairs.size() < 3)
         return false;
 
+    if( plane_ransac_method_ == Guided )
+        return solveRelativeTransformPlanesGuided( source, target, pairs, result, return_inlier );
+
     return_inlier.clear();
 
     const unsigned int pairs_num = pairs.size();
 
-    // Estimate transformation using all the plane correspondences
+    // Prior hypothesis first, no triple is solved if it explains most pairs
+    RESULT_OF_MOTION seed;
+    std::vector<PlanePair> seed_inlier;
+    const bool seeded = has_motion_prior_ && planesPriorHypothesis( last_planes, planes, pairs, seed, seed_inlier );
+    if( seeded && seed_inlier.size() >= prior_inlier_ratio_ * pairs_num )
+    {
+        result = seed;
+        return_inlier = seed_inlier;
+        return true;
+    }
+
+    // Estimate transformation using all the plane correspondences, triples are spread over tasks
+    const int triples = pairs_num * (pairs_num-1) * (pairs_num-2) / 6;
+    ransac_pool_.resize( ransac_threads_ - 1 );
+    const int tasks = std::max( 1, std::min( ransac_threads_, triples / 16 ) );
+    std::vector<PlaneHypothesis> bests( tasks );
+    ransac_pool_.run( boost::bind( &Tracking::planesRansacWorker, this, &last_planes, &planes, &pairs, _1, tasks, &bests[0] ), tasks );
+
+    // Merge with the criteria of the sequential loop, ties go to the first triple, so
+    // the result does not depend on the number of tasks
     RESULT_OF_MOTION best_transform;
     std::vector<PlanePair> best_inlier;
+    int best_triple = -1;
     best_transform.rmse = 1e9; // no inlier
     best_transform.valid = false;
+    if( seeded )
+    {
+        best_transform = seed;
+        best_inlier = seed_inlier;
+    }
     unsigned int real_iterations = 0;
     unsigned int valid_iterations = 0;
+    for( int i = 0; i < tasks; i++ )
+    {
+        const PlaneHypothesis &best = bests[i];
+        real_iterations += best.real_iterations;
+        valid_iterations += best.valid_iterations;
+        if( !best.motion.valid )
+            continue;
+        if( best.inlier.size() > best_inlier.size()
+                || ( best.inlier.size() == best_inlier.size() && best.motion.rmse < best_transform.rmse )
+                || ( best.inlier.size() == best_inlier.size() && best.motion.rmse == best_transform.rmse
+                     && best_triple >= 0 && best.triple < best_triple ) )
+        {
+            best_transform = best.motion;
+            best_inlier = best.inlier;
+            best_triple = best.triple;
+        }
+    }
+
+    if( verbose_ ){
+        cout << GREEN << " Plane RANSAC iterations = " << real_iterations
+             << ", valid iterations = " << valid_iterations << RESET << endl;
+    }
+
+//    Eigen::umeyama
+    result = best_transform;
+    return_inlier = best_inlier;
+    return best_transform.valid;
+}
+
+
+bool Tracking::solveRelativeTransformPlanesGuided( const Frame &source,
+                                                   const Frame &target,
+                                                   const std::vector<PlanePair> &pairs,
+                                                   RESULT_OF_MOTION &result,
+                                                   std::vector<PlanePair> &return_inlier )
+{
+    const std::vector<PlaneType> &planes = target.segment_planes_;
+    const std::vector<PlaneType> &last_planes = source.segment_planes_;
+
+    if( planes.size() < 3 || last_planes.size() < 3 || pairs.size() < 3)
+        return false;
+
+    return_inlier.clear();
+
+    const int pairs_num = pairs.size();
+
+    /// 1: Compatible pairs, checked on normals in both frames
+    const double parallel_cos = cos( 15.0 * DEG_TO_RAD );    // same as solveRtPlanes
+    const double consistent_angle = 8.0 * DEG_TO_RAD;       // angle between two planes is rigid
+    std::vector<char> compatible( pairs_num * pairs_num, 0 );
+    for( int i = 0; i < pairs_num; i++)
+    {
+        const Eigen::Vector3d n_obs = planes[pairs[i].iobs].coefficients.head<3>();
+        const Eigen::Vector3d n_lm = last_planes[pairs[i].ilm].coefficients.head<3>();
+        for( int j = i+1; j < pairs_num; j++)
+        {
+            const double c_obs = n_obs.dot( planes[pairs[j].iobs].coefficients.head<3>() );
+            const double c_lm = n_lm.dot( last_planes[pairs[j].ilm].coefficients.head<3>() );
+            // nearly parallel or anti-parallel normals give no constraint
+            if( fabs(c_obs) > parallel_cos || fabs(c_lm) > parallel_cos )
+                continue;
+            if( fabs( acos(c_obs) - acos(c_lm) ) > consistent_angle )
+                continue;
+            compatible[i*pairs_num + j] = compatible[j*pairs_num + i] = 1;
+        }
+    }
+
+    /// 2: Non-degenerate triples, ordered by sum of pair distances (pairs are sorted, best first)
+    struct PlaneTriple
+    {
+        int x1, x2, x3;
+        double distance;
+        bool operator<( const PlaneTriple &m ) const { return distance < m.distance; }
+    };
+    std::vector<PlaneTriple> triples;
+    for( int x1 = 0; x1 < pairs_num-2; x1++)
+    {
+        for( int x2 = x1+1; x2 < pairs_num-1; x2++ )
+        {
+            if( !compatible[x1*pairs_num + x2] )
+                continue;
+            for( int x3 = x2+1; x3 < pairs_num; x3++)
+            {
+                if( !compatible[x1*pairs_num + x3] || !compatible[x2*pairs_num + x3] )
+                    continue;
+                PlaneTriple triple;
+                triple.x1 = x1;
+                triple.x2 = x2;
+                triple.x3 = x3;
+                triple.distance = pairs[x1].distance + pairs[x2].distance + pairs[x3].distance;
+                triples.push_back( triple );
+            }
+        }
+    }
+    std::stable_sort( triples.begin(), triples.end() );
+
+    /// 3: Solve in order, stop once enough pairs agree
+    const unsigned int enough_inlier = std::max( 3, (int)ceil( plane_ransac_inlier_ratio_ * pairs_num ) );
+    const int max_iterations = std::min( (int)triples.size(), plane_ransac_iterations_ );
+    RESULT_OF_MOTION best_transform;
+    std::vector<PlanePair> best_inlier;
+    best_transform.rmse = 1e9; // no inlier
+    best_transform.valid = false;
+    if( has_motion_prior_ )
+        planesPriorHypothesis( last_planes, planes, pairs, best_transform, best_inlier );
+    unsigned int valid_iterations = 0;
+    int n = 0;
+    for( ; n < max_iterations && best_inlier.size() < enough_inlier; n++)
+    {
+        const PlanePair &p1 = pairs[triples[n].x1];
+        const PlanePair &p2 = pairs[triples[n].x2];
+        const PlanePair &p3 = pairs[triples[n].x3];
+        RESULT_OF_MOTION motion;
+        motion.valid = solveRtPlanes( last_planes[p1.ilm].coefficients, last_planes[p2.ilm].coefficients, last_planes[p3.ilm].coefficients,
+                                      planes[p1.iobs].coefficients, planes[p2.iobs].coefficients, planes[p3.iobs].coefficients,
+                                      motion );
+        if( !motion.valid )
+            continue;
+
+        valid_iterations++;
+        std::vector<PlanePair> inlier;
+        computePairInliersAndError( motion.transform4d(), pairs, last_planes, planes,
+                                    inlier, motion.rmse, 5.0*DEG_TO_RAD, 0.05);
+        if( inlier.size() > best_inlier.size()
+                || ( inlier.size() == best_inlier.size() && motion.rmse < best_transform.rmse ) )
+        {
+            best_transform = motion;
+            best_inlier = inlier;
+        }
+
+        if( best_inlier.size() >= enough_inlier )
+        {
+            n++;
+            break;
+        }
+    }
+
+    if( verbose_ ){
+        cout << GREEN << " Plane guided RANSAC triples = " << triples.size()
+             << ", iterations = " << n
+             << ", valid iterations = " << valid_iterations << RESET << endl;
+    }
+
+    result = best_transform;
+    return_inlier = best_inlier;
+    return best_transform.valid;
+}
+
+bool Tracking::planesPriorHypothesis( const std::vector<PlaneType> &last_planes,
+                                      const std::vector<PlaneType> &planes,
+                                      const std::vector<PlanePair> &pairs,
+                                      RESULT_OF_MOTION &motion,
+                                      std::vector<PlanePair> &inlier )
+{
+    /// 1: Pairs agreeing with the prior
+    motion.setTransform4d( motion_prior_.matrix() );
+    computePairInliersAndError( motion_prior_.matrix(), pairs, last_planes, planes,
+                                inlier, motion.rmse, 5.0*DEG_TO_RAD, 0.05);
+    motion.valid = inlier.size() >= 3;
+    if( !motion.valid )
+    {
+        inlier.clear();
+        motion.rmse = 1e9;
+        return false;
+    }
+
+    /// 2: Refine on the inlier, kept only if it does not lose any pair
+    const int num = inlier.size();
+    std::vector<PlaneCoefficients> last_coefficients( num ), coefficients( num );
+    std::vector<double> weights( num, 1.0 );
+    for( int i = 0; i < num; i++)
+    {
+        last_coefficients[i] = last_planes[inlier[i].ilm].coefficients;
+        coefficients[i] = planes[inlier[i].iobs].coefficients;
+    }
+    RESULT_OF_MOTION refined;
+    solveRtWeighted( &last_coefficients[0], &coefficients[0], &weights[0], num, NULL, NULL, NULL, 0, refined );
+    if( refined.translation == refined.translation && refined.rotation == refined.rotation )
+    {
+        std::vector<PlanePair> refined_inlier;
+        computePairInliersAndError( refined.transform4d(), pairs, last_planes, planes,
+                                    refined_inlier, refined.rmse, 5.0*DEG_TO_RAD, 0.05);
+        if( refined_inlier.size() >= inlier.size() && refined.rmse <= motion.rmse )
+        {
+            motion = refined;
+            inlier = refined_inlier;
+        }
+    }
+
+    if( verbose_ )
+        cout << GREEN << " Plane prior inlier = " << inlier.size() << ", rmse = " << motion.rmse << RESET << endl;
+
+    return true;
+}
+
+void Tracking::planesRansacWorker( const std::vector<PlaneType> *last_planes_ptr,
+                                   const std::vector<PlaneType> *planes_ptr,
+                                   const std::vector<PlanePair> *pairs_ptr,
+                                   const int task,
+                                   const int tasks,
+                                   PlaneHypothesis *bests )
+{
+    const std::vector<PlaneType> &last_planes = *last_planes_ptr;
+    const std::vector<PlaneType> &planes = *planes_ptr;
+    const std::vector<PlanePair> &pairs = *pairs_ptr;
+    const int pairs_num = pairs.size();
+
+    PlaneHypothesis *best = &bests[task];
+    best->motion.rmse = 1e9; // no inlier
+    best->motion.valid = false;
+    best->inlier.clear();
+    best->triple = -1;
+    best->real_iterations = 0;
+    best->valid_iterations = 0;
+    // Triple k is handled by task (k % tasks), keeps the load balanced
+    int k = 0;
     for( int x1 = 0; x1 < pairs_num-2; x1++)
     {
         const PlanePair &p1 = pairs[x1];
         for( int x2 = x1+1; x2 < pairs_num-1; x2++ )
         {
             const PlanePair &p2 = pairs[x2];
-            for( int x3 = x2+1; x3 < pairs_num; x3++)
+            for( int x3 = x2+1; x3 < pairs_num; x3++, k++)
             {
-                real_iterations ++;
+                if( k % tasks != task )
+                    continue;
+
+                best->real_iterations ++;
                 const PlanePair &p3 = pairs[x3];
-                std::vector<PlaneCoefficients> currents;
-                std::vector<PlaneCoefficients> lasts;
-                currents.push_back( planes[p1.iobs].coefficients );
-                currents.push_back( planes[p2.iobs].coefficients );
-                currents.push_back( planes[p3.iobs].coefficients );
-                lasts.push_back( last_planes[p1.ilm].coefficients );
-                lasts.push_back( last_planes[p2.ilm].coefficients );
-                lasts.push_back( last_planes[p3.ilm].coefficients );
-                //
-//                cout << YELLOW << " solve motion: (" << x1 << "/" << x2 << "/" << x3 << ")" << RESET << endl;
                 RESULT_OF_MOTION motion;
-                motion.valid = solveRtPlanes( lasts, currents, motion);
+                motion.valid = solveRtPlanes( last_planes[p1.ilm].coefficients, last_planes[p2.ilm].coefficients, last_planes[p3.ilm].coefficients,
+                                              planes[p1.iobs].coefficients, planes[p2.iobs].coefficients, planes[p3.iobs].coefficients,
+                                              motion );
 
                 if( motion.valid )
                 {
-                    valid_iterations++;
+                    best->valid_iterations++;
                     // check if better
                     std::vector<PlanePair> inlier;
                     computePairInliersAndError( motion.transform4d(), pairs, last_planes, planes,
                                                 inlier, motion.rmse, 5.0*DEG_TO_RAD, 0.05);
-                    if( inlier.size() > best_inlier.size() )
+                    if( inlier.size() > best->inlier.size() )
                     {
-                        best_transform = motion;
-                        best_inlier = inlier;
+                        best->motion = motion;
+                        best->inlier = inlier;
+                        best->triple = k;
                     }
-                    else if( inlier.size() == best_inlier.size() && motion.rmse < best_transform.rmse )
+                    else if( inlier.size() == best->inlier.size() && motion.rmse < best->motion.rmse )
                     {
-                        best_transform = motion;
-                        best_inlier = inlier;
+                        best->motion = motion;
+                        best->inlier = inlier;
+                        best->triple = k;
                     }
                 }
             }
         }
     }
+}
 
-    if( verbose_ ){
-        cout << GREEN << " Plane RANSAC iterations = " << real_iterations
-             << ", valid iterations = " << valid_iterations << RESET << endl;
+// Random stream of hypothesis index under the seed (splitmix64), the same whichever task draws it
+static uint64 hypothesisSeed( int seed, int index )
+{
+    uint64 z = (uint64)seed * 0x9E3779B97F4A7C15ULL + (uint64)index + 1;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+void Tracking::pointsRansacHypothesis( const std_vector_of_eigen_vector4f *source_feature_3d_ptr,
+                                       const std_vector_of_eigen_vector4f *target_feature_3d_ptr,
+                                       const std::vector<cv::DMatch> *good_matches_ptr,
+                                       const unsigned int min_inlier_threshold,
+                                       const int first_index,
+                                       const int task,
+                                       RansacHypothesis *hypotheses )
+{
+    const std_vector_of_eigen_vector4f &source_feature_3d = *source_feature_3d_ptr;
+    const std_vector_of_eigen_vector4f &target_feature_3d = *target_feature_3d_ptr;
+    const std::vector<cv::DMatch> &good_matches = *good_matches_ptr;
+
+    cv::RNG rng( hypothesisSeed( ransac_seed_, first_index + task ) );
+    RansacHypothesis *hypothesis = &hypotheses[task];
+    hypothesis->transform = Eigen::Matrix4f::Identity();
+    hypothesis->matches.clear();
+    hypothesis->rmse = 1e6;
+    hypothesis->real_iterations = 1;
+    hypothesis->valid_iterations = 0;
+    //
+    const unsigned int sample_size = ransac_sample_size_;
+    double inlier_error;
+    double max_dist_m = ransac_inlier_max_mahal_distance_;
+    bool valid_tf;
+    std::vector<cv::DMatch> inlier = randomChooseMatchesPreferGood( sample_size, good_matches, rng ); //initialization with random samples
+    for( int refine = 0; refine < 20; refine ++)
+    {
+        Eigen::Matrix4f transformation = solveRtPoints( source_feature_3d,
+                                                     target_feature_3d,
+                                                     inlier, valid_tf );
+        if( !valid_tf || transformation != transformation )
+            break;
+
+        computeCorrespondenceInliersAndError( good_matches, transformation, source_feature_3d, target_feature_3d,
+                                              min_inlier_threshold, inlier, inlier_error, max_dist_m );
+
+        if( inlier.size() < min_inlier_threshold || inlier_error > max_dist_m)
+            break;
+
+        if( inlier.size() > hypothesis->matches.size() && inlier_error < hypothesis->rmse )
+        {
+            unsigned int prev_num_inliers = hypothesis->matches.size();
+            assert( inlier_error>=0 );
+            hypothesis->transform = transformation;
+            hypothesis->matches = inlier;
+            hypothesis->rmse = inlier_error;
+            if( inlier.size() == prev_num_inliers )
+                break; //only error improved -> no change would happen next iteration
+        }
+        else
+            break;
     }
+    if( hypothesis->matches.size() > 0 )
+        hypothesis->valid_iterations = 1;
+}
 
-//    Eigen::umeyama
-    result = best_transform;
-    return_inlier = best_inlier;
-    return best_transform.valid;
+void Tracking::pointsRansacParallel( const std_vector_of_eigen_vector4f &source_feature_3d,
+                                     const std_vector_of_eigen_vector4f &target_feature_3d,
+                                     const std::vector<cv::DMatch> &good_matches,
+                                     const unsigned int min_inlier_threshold,
+                                     RansacHypothesis &result )
+{
+    // Prior hypothesis first, sampling is skipped if it explains most matches
+    RansacHypothesis seed;
+    const bool seeded = has_motion_prior_
+            && pointsPriorHypothesis( source_feature_3d, target_feature_3d, good_matches, min_inlier_threshold, seed );
+    if( seeded && seed.matches.size() >= prior_inlier_ratio_ * good_matches.size() )
+    {
+        result = seed;
+        return;
+    }
+
+    result.transform = Eigen::Matrix4f::Identity();
+    result.matches.clear();
+    result.rmse = 1e6;
+    result.real_iterations = 0;
+    result.valid_iterations = 0;
+    if( seeded )
+        result = seed;
+    if( good_matches.size() < ransac_sample_size_ )
+        return;
+
+    // Hypotheses are refined in batches by the pool, then taken in index order as by the
+    // sequential loop. Hypothesis n samples from its own stream, so the result only
+    // depends on the seed, not on the number of threads.
+    ransac_pool_.resize( ransac_threads_ - 1 );
+    const int batch_size = 2 * (ransac_pool_.size() + 1);
+    std::vector<RansacHypothesis, Eigen::aligned_allocator<RansacHypothesis> > hypotheses( batch_size );
+    int n = 0;
+    bool done = false;
+    while( n < ransac_iterations_ && !done )
+    {
+        const int first = n;
+        const int count = std::min( batch_size, ransac_iterations_ - first );
+        ransac_pool_.run( boost::bind( &Tracking::pointsRansacHypothesis, this, &source_feature_3d, &target_feature_3d,
+                                       &good_matches, min_inlier_threshold, first, _1, &hypotheses[0] ), count );
+
+        for( ; n < first + count; n++)
+        {
+            const RansacHypothesis &hypothesis = hypotheses[n - first];
+            result.real_iterations++;
+            // Success
+            if( hypothesis.matches.size() == 0 )
+                continue;
+            result.valid_iterations++;
+
+            //Acceptable && superior to previous iterations?
+            if( hypothesis.rmse <= result.rmse &&
+                hypothesis.matches.size() >= result.matches.size() &&
+                hypothesis.matches.size() >= min_inlier_threshold )
+            {
+                result.rmse = hypothesis.rmse;
+                result.transform = hypothesis.transform;
+                result.matches = hypothesis.matches;
+                //Performance hacks:
+                if ( hypothesis.matches.size() > good_matches.size()*0.5 ) n+=10;///Iterations with more than half of the initial_matches inlying, count tenfold
+                if ( hypothesis.matches.size() > good_matches.size()*0.75 ) n+=10;///Iterations with more than 3/4 of the initial_matches inlying, count twentyfold
+                if ( hypothesis.matches.size() > good_matches.size()*0.8 ) { done = true; break; } ///Can this get better anyhow?
+            }
+        }
+    }
 }
 
+bool Tracking::pointsPriorHypothesis( const std_vector_of_eigen_vector4f &source_feature_3d,
+                                      const std_vector_of_eigen_vector4f &target_feature_3d,
+                                      const std::vector<cv::DMatch> &good_matches,
+                                      const unsigned int min_inlier_threshold,
+                                      RansacHypothesis &hypothesis )
+{
+    hypothesis.transform = motion_prior_.matrix().cast<float>();
+    hypothesis.matches.clear();
+    hypothesis.rmse = 1e6;
+    hypothesis.real_iterations = 1;
+    hypothesis.valid_iterations = 0;
+
+    // Refine from the prior, same as a ransac iteration
+    const double max_dist_m = ransac_inlier_max_mahal_distance_;
+    std::vector<cv::DMatch> inlier;
+    double inlier_error;
+    bool valid_tf;
+    Eigen::Matrix4f transformation = hypothesis.transform;
+    computeCorrespondenceInliersAndError( good_matches, transformation, source_feature_3d, target_feature_3d,
+                                          min_inlier_threshold, inlier, inlier_error, max_dist_m );
+    for( int refine = 0; refine < 20; refine ++)
+    {
+        if( inlier.size() < min_inlier_threshold || inlier_error > max_dist_m )
+            break;
+
+        if( inlier.size() > hypothesis.matches.size() && inlier_error < hypothesis.rmse )
+        {
+            const unsigned int prev_num_inliers = hypothesis.matches.size();
+            hypothesis.transform = transformation;
+            hypothesis.matches = inlier;
+            hypothesis.rmse = inlier_error;
+            if( inlier.size() == prev_num_inliers )
+                break;
+        }
+        else
+            break;
+
+        transformation = solveRtPoints( source_feature_3d, target_feature_3d, inlier, valid_tf );
+        if( !valid_tf || transformation != transformation )
+            break;
+
+        computeCorrespondenceInliersAndError( good_matches, transformation, source_feature_3d, target_feature_3d,
+                                              min_inlier_threshold, inlier, inlier_error, max_dist_m );
+    }
+
+    if( hypothesis.matches.size() > 0 )
+        hypothesis.valid_iterations = 1;
+
+    if( verbose_ )
+        cout << BLUE << " Point prior inlier = " << hypothesis.matches.size() << ", rmse = " << hypothesis.rmse << RESET << endl;
+
+    return hypothesis.matches.size() > 0;
+}
 
 bool Tracking::solveRelativeTransformPointsRansac( const Frame &source,
                                                    const Frame &target,
@@ -282,76 +783,20 @@ bool Tracking::solveRelativeTransformPointsRansac( const Frame &source,
     //
     matches.clear();
     const unsigned int sample_size = ransac_sample_size_;
-    unsigned int valid_iterations = 0;
-    const unsigned int max_iterations = ransac_iterations_;
-    int real_iterations = 0;
     double inlier_error;
     double max_dist_m = ransac_inlier_max_mahal_distance_;
     bool valid_tf;
-    for( int n = 0; n < max_iterations && good_matches.size() >= sample_size; n++)
-    {
-        double refined_error = 1e6;
-        std::vector<cv::DMatch> refined_matches;
-        std::vector<cv::DMatch> inlier = randomChooseMatchesPreferGood( sample_size, good_matches); //initialization with random samples
-//        std::vector<cv::DMatch> inlier = randomChooseMatches( sample_size, good_matches); //initialization with random samples
-        Eigen::Matrix4f refined_transformation = Eigen::Matrix4f::Identity();
 
-        real_iterations++;
-//        cout << "Iteration = " << real_iterations << endl;
-        for( int refine = 0; refine < 20; refine ++)
-        {
-            Eigen::Matrix4f transformation = solveRtPcl( source.feature_locations_3d_,
-                                                         target.feature_locations_3d_,
-                                                         inlier, valid_tf );
-            if( !valid_tf || transformation != transformation )
-            {
-//                cout << BLUE << "- valid = " << (valid_tf?"true":"false") << ", equal = " << (transformation == transformation) << RESET << endl;
-                break;
-            }
-
-            computeCorrespondenceInliersAndError( good_matches, transformation, source.feature_locations_3d_, target.feature_locations_3d_,
-                                                  min_inlier_threshold, inlier, inlier_error, max_dist_m );
-
-            if( inlier.size() < min_inlier_threshold || inlier_error > max_dist_m)
-                break;
-
-//            cout << BOLDBLUE << " - refine = " << refine << ", relative transform: " << RESET << endl;
-//            printTransform( transformation );
-//            cout << BLUE << " - inlier = " << inlier.size() << ", error = " << inlier_error << RESET << endl;
-//            cout << endl;
-
-            if( inlier.size() > refined_matches.size() && inlier_error < refined_error )
-            {
-                unsigned int prev_num_inliers = refined_matches.size();
-                assert( inlier_error>=0 );
-                refined_transformation = transformation;
-                refined_matches = inlier;
-                refined_error = inlier_error;
-                if( inlier.size() == prev_num_inliers )
-                    break; //only error improved -> no change would happen next iteration
-            }
-            else
-                break;
-        }
-        // Success
-        if( refined_matches.size() > 0 )
-        {
-            valid_iterations++;
-
-            //Acceptable && superior to previous iterations?
-            if (refined_error <= rmse &&
-                refined_matches.size() >= matches.size() &&
-                refined_matches.size() >= min_inlier_threshold)
-            {
-                rmse = refined_error;
-                resulting_transformation = refined_transformation;
-                matches.assign(refined_matches.begin(), refined_matches.end());
-                //Performance hacks:
-                if ( refined_matches.size() > good_matches.size()*0.5 ) n+=10;///Iterations with more than half of the initial_matches inlying, count tenfold
-                if ( refined_matches.size() > good_matches.size()*0.75 ) n+=10;///Iterations with more than 3/4 of the initial_matches inlying, count twentyfold
-                if ( refined_matches.size() > good_matches.size()*0.8 ) break; ///Can this get better anyhow?
-            }
-        }
+    // Generate and score hypotheses in parallel
+    RansacHypothesis best;
+    pointsRansacParallel( source.feature_locations_3d_, target.feature_locations_3d_, good_matches, min_inlier_threshold, best );
+    const int real_iterations = best.real_iterations;
+    const unsigned int valid_iterations = best.valid_iterations;
+    if( best.matches.size() > 0 )
+    {
+        rmse = best.rmse;
+        resulting_transformation = best.transform;
+        matches.assign( best.matches.begin(), best.matches.end() );
     }
 
     if( valid_iterations == 0 ) // maybe no depth. Try identity?
@@ -382,7 +827,7 @@ bool Tracking::solveRelativeTransformPointsRansac( const Frame &source,
             if( inlier.size() < sample_size )
                 break;
 
-            Eigen::Matrix4f transformation = solveRtPcl( source.feature_locations_3d_,
+            Eigen::Matrix4f transformation = solveRtPoints( source.feature_locations_3d_,
                                                          target.feature_locations_3d_,
                                                          inlier, valid_tf );
             if( !valid_tf || transformation != transformation )
@@ -472,88 +917,20 @@ bool Tracking::solveRelativeTransformPointsRansac( const std_vector_of_eigen_vec
     //
     matches.clear();
     const unsigned int sample_size = ransac_sample_size_;
-    unsigned int valid_iterations = 0;
-    const unsigned int max_iterations = ransac_iterations_;
-    int real_iterations = 0;
     double inlier_error;
     double max_dist_m = ransac_inlier_max_mahal_distance_;
     bool valid_tf;
-    for( int n = 0; n < max_iterations && good_matches.size() >= sample_size; n++)
-    {
-        double refined_error = 1e6;
-        std::vector<cv::DMatch> refined_matches;
-        std::vector<cv::DMatch> inlier = randomChooseMatchesPreferGood( sample_size, good_matches); //initialization with random samples
-//        std::vector<cv::DMatch> inlier = randomChooseMatches( sample_size, good_matches); //initialization with random samples
-        Eigen::Matrix4f refined_transformation = Eigen::Matrix4f::Identity();
-
-        real_iterations++;
-//        cout << "Iteration = " << real_iterations << endl;
-        for( int refine = 0; refine < 20; refine ++)
-        {
-            Eigen::Matrix4f transformation = solveRtPcl( source_feature_3d,
-                                                         target_feature_3d,
-                                                         inlier, valid_tf );
-
-//            for( int mi = 0; mi < inlier.size(); mi++)
-//            {
-//                cv::DMatch &mm = inlier[mi];
-//                cout << BLUE << "  -(" << source_feature_3d[mm.queryIdx](0)
-//                     << "," << source_feature_3d[mm.queryIdx](1)
-//                     << "," << source_feature_3d[mm.queryIdx](2) << ")"
-//                     << " (" << target_feature_3d[mm.trainIdx](0)
-//                     << "," << target_feature_3d[mm.trainIdx](1)
-//                     << "," << target_feature_3d[mm.trainIdx](2) << ")" << RESET << endl;
-//            }
-
-            if( !valid_tf || transformation != transformation )
-            {
-//                cout << BLUE << "- valid = " << (valid_tf?"true":"false") << ", equal = " << (transformation == transformation) << RESET << endl;
-                break;
-            }
-
-            computeCorrespondenceInliersAndError( good_matches, transformation, source_feature_3d, target_feature_3d,
-                                                  min_inlier_threshold, inlier, inlier_error, max_dist_m );
-
-            if( inlier.size() < min_inlier_threshold || inlier_error > max_dist_m)
-                break;
-
-//            cout << BOLDBLUE << " - refine = " << refine << ", relative transform: " << RESET << endl;
-//            printTransform( transformation, "", BOLDBLUE );
-//            cout << BLUE << " - inlier = " << inlier.size() << ", error = " << inlier_error << RESET << endl;
-//            cout << endl;
-
-            if( inlier.size() > refined_matches.size() && inlier_error < refined_error )
-            {
-                unsigned int prev_num_inliers = refined_matches.size();
-                assert( inlier_error>=0 );
-                refined_transformation = transformation;
-                refined_matches = inlier;
-                refined_error = inlier_error;
-                if( inlier.size() == prev_num_inliers )
-                    break; //only error improved -> no change would happen next iteration
-            }
-            else
-                break;
-        }
-        // Success
-        if( refined_matches.size() > 0 )
-        {
-            valid_iterations++;
 
-            //Acceptable && superior to previous iterations?
-            if (refined_error <= rmse &&
-                refined_matches.size() >= matches.size() &&
-                refined_matches.size() >= min_inlier_threshold)
-            {
-                rmse = refined_error;
-                resulting_transformation = refined_transformation;
-                matches.assign(refined_matches.begin(), refined_matches.end());
-                //Performance hacks:
-                if ( refined_matches.size() > good_matches.size()*0.5 ) n+=10;///Iterations with more than half of the initial_matches inlying, count tenfold
-                if ( refined_matches.size() > good_matches.size()*0.75 ) n+=10;///Iterations with more than 3/4 of the initial_matches inlying, count twentyfold
-                if ( refined_matches.size() > good_matches.size()*0.8 ) break; ///Can this get better anyhow?
-            }
-        }
+    // Generate and score hypotheses in parallel
+    RansacHypothesis best;
+    pointsRansacParallel( source_feature_3d, target_feature_3d, good_matches, min_inlier_threshold, best );
+    const int real_iterations = best.real_iterations;
+    const unsigned int valid_iterations = best.valid_iterations;
+    if( best.matches.size() > 0 )
+    {
+        rmse = best.rmse;
+        resulting_transformation = best.transform;
+        matches.assign( best.matches.begin(), best.matches.end() );
     }
 
     if( valid_iterations == 0 ) // maybe no depth. Try identity?
@@ -583,7 +960,7 @@ bool Tracking::solveRelativeTransformPointsRansac( const std_vector_of_eigen_vec
             if( inlier.size() < sample_size )
                 break;
 
-            Eigen::Matrix4f transformation = solveRtPcl( source_feature_3d,
+            Eigen::Matrix4f transformation = solveRtPoints( source_feature_3d,
                                                          target_feature_3d,
                                                          inlier, valid_tf );
             if( !valid_tf || transformation != transformation )
@@ -778,6 +1155,211 @@ bool Tracking::solveRelativeTransformIcp( const Frame &source,
     return result.valid;
 }
 
+bool Tracking::solveRelativeTransformDense( const Frame &source,
+                                            const Frame &target,
+                                            RESULT_OF_MOTION &result,
+                                            const Eigen::Matrix4d &estimated_transform )
+{
+    result.valid = dense_odometry_.align( source, target, result, estimated_transform );
+    return result.valid;
+}
+
+bool Tracking::trackLocalMap( const Frame &frame, const LocalMap &map,
+                              const gtsam::Pose3 &initial_pose, gtsam::Pose3 &pose )
+{
+    pose = initial_pose;
+    if( !use_local_map_tracking_ )
+        return false;
+    return local_map_tracker_.track( frame, map, initial_pose, pose );
+}
+
+// Projective point-to-plane ICP on the organized QQVGA clouds, motion maps target points into source.
+bool Tracking::solveRelativeTransformProjectiveIcp( const Frame &source,
+                                                    const Frame &target,
+                                                    RESULT_OF_MOTION &result,
+                                                    const Eigen::Matrix4d &estimated_transform )
+{
+    result.valid = false;
+
+    const PointCloudType &model = *source.cloud_downsampled_;
+    const PointCloudType &data = *target.cloud_downsampled_;
+    if( !model.size() || model.width != data.width || model.height != data.height )
+        return false;
+
+    /// 1: Model normals, cached on the frame, otherwise from plane normals and neighbours
+    if( source.normal_cloud_->size() != model.size() )
+        computeOrganizedNormals( source, icp_model_normals_ );
+
+    /// 2: Coarse to fine, pass l samples every 2^l pixel of the target, against the
+    ///    full resolution source
+    Eigen::Matrix4d T = estimated_transform;
+    IcpSystem system;
+    for( int pass = projective_icp_strides_-1; pass >= 0; pass-- )
+    {
+        const int stride = 1 << pass;
+        const double max_distance = icp_max_distance_ * stride;
+        for( int it = 0; it < projective_icp_iterations_; it++ )
+        {
+            projectiveIcpReduce( source, target, T, stride, max_distance, system );
+            if( system.count < 6 )
+                return false;
+
+            const Eigen::Matrix<double, 6, 1> xi = system.JtJ.ldlt().solve( -system.Jtr );
+            if( xi != xi )
+                return false;
+            T = gtsam::Pose3::Expmap( xi ).matrix() * T;
+            if( xi.norm() < icp_tf_epsilon_ )
+                break;
+        }
+    }
+
+    /// 3: Residual at the final estimate
+    projectiveIcpReduce( source, target, T, 1, icp_max_distance_, system );
+    result.setTransform4d( T );
+    result.inlier = system.count;
+    result.rmse = system.count ? sqrt( system.error / system.count ) : 1e9;
+    result.score = result.rmse;
+    result.valid = system.count >= icp_min_indices_;
+
+    if( verbose_ )
+        cout << GREEN << " Projective ICP inlier = " << system.count << ", rmse = " << result.rmse << RESET << endl;
+
+    return result.valid;
+}
+
+void Tracking::computeOrganizedNormals( const Frame &frame, std::vector<Eigen::Vector3f> &normals )
+{
+    const PointCloudType &cloud = *frame.cloud_downsampled_;
+    const int width = cloud.width;
+    const int height = cloud.height;
+    normals.assign( cloud.size(), Eigen::Vector3f::Zero() );    // keeps capacity between frames
+
+    // Plane inlier, normal from segmentation
+    for( int i = 0; i < frame.segment_planes_.size(); i++)
+    {
+        const PlaneType &plane = frame.segment_planes_[i];
+        const Eigen::Vector3f n = plane.coefficients.head<3>().cast<float>();
+        for( int j = 0; j < plane.inlier.size(); j++)
+            normals[plane.inlier[j]] = n;
+    }
+
+    // Others, cross product of right and down neighbours
+    for( int v = 0; v < height-1; v++)
+    {
+        for( int u = 0; u < width-1; u++)
+        {
+            const int idx = v*width + u;
+            if( normals[idx](0) != 0 || normals[idx](1) != 0 || normals[idx](2) != 0 )
+                continue;
+            const PointType &p = cloud.points[idx];
+            const PointType &pr = cloud.points[idx+1];
+            const PointType &pd = cloud.points[idx+width];
+            if( std::isnan(p.z) || std::isnan(pr.z) || std::isnan(pd.z) )
+                continue;
+            const Eigen::Vector3f n = (pr.getVector3fMap() - p.getVector3fMap()).cross( pd.getVector3fMap() - p.getVector3fMap() );
+            const float norm = n.norm();
+            if( norm > 1e-6 )
+                normals[idx] = n / norm;
+        }
+    }
+}
+
+void Tracking::projectiveIcpReduce( const Frame &source,
+                                    const Frame &target,
+                                    const Eigen::Matrix4d &transform,
+                                    const int stride,
+                                    const double max_distance,
+                                    IcpSystem &system )
+{
+    const int height = target.cloud_downsampled_->height;
+    const int bands = std::max( 1, std::min( projective_icp_threads_, height / (stride * 8) ) );
+    const int rows = (height + bands - 1) / bands;
+
+    // Each task reduces a band of rows, summed in band order
+    icp_pool_.resize( projective_icp_threads_ - 1 );
+    std::vector<IcpSystem, Eigen::aligned_allocator<IcpSystem> > systems( bands );
+    icp_pool_.run( boost::bind( &Tracking::projectiveIcpWorker, this, &source, &target, &transform,
+                                rows, stride, max_distance, _1, &systems[0] ), bands );
+
+    system = systems[0];
+    for( int i = 1; i < bands; i++ )
+    {
+        system.JtJ += systems[i].JtJ;
+        system.Jtr += systems[i].Jtr;
+        system.error += systems[i].error;
+        system.count += systems[i].count;
+    }
+}
+
+void Tracking::projectiveIcpWorker( const Frame *source,
+                                    const Frame *target,
+                                    const Eigen::Matrix4d *transform,
+                                    const int rows,
+                                    const int stride,
+                                    const double max_distance,
+                                    const int band,
+                                    IcpSystem *systems )
+{
+    const PointCloudType &model = *source->cloud_downsampled_;
+    const PointCloudType &data = *target->cloud_downsampled_;
+    const CameraParameters &camera = source->camera_params_downsampled_;
+    const NormalCloud &cached_normals = *source->normal_cloud_;
+    const bool cached = cached_normals.size() == model.size();
+    const std::vector<Eigen::Vector3f> &normals = icp_model_normals_;
+    const int width = model.width;
+    const int height = model.height;
+    const Eigen::Matrix3f R = transform->topLeftCorner<3,3>().cast<float>();
+    const Eigen::Vector3f t = transform->topRightCorner<3,1>().cast<float>();
+    const float max_distance_squared = max_distance * max_distance;
+    const int row_begin = band * rows;
+    const int row_end = std::min( height, row_begin + rows );
+    IcpSystem *system = &systems[band];
+
+    system->JtJ.setZero();
+    system->Jtr.setZero();
+    system->error = 0;
+    system->count = 0;
+
+    // align first row to the stride grid
+    const int first_row = ((row_begin + stride - 1) / stride) * stride;
+    for( int v = first_row; v < row_end; v += stride)
+    {
+        for( int u = 0; u < width; u += stride)
+        {
+            const PointType &pt = data.points[v*width + u];
+            if( std::isnan(pt.z) )
+                continue;
+
+            // target point in source frame, projective association
+            const Eigen::Vector3f p = R * pt.getVector3fMap() + t;
+            if( p(2) <= 0 )
+                continue;
+            const int mu = (int)( camera.fx * p(0) / p(2) + camera.cx + 0.5 );
+            const int mv = (int)( camera.fy * p(1) / p(2) + camera.cy + 0.5 );
+            if( mu < 0 || mu >= width || mv < 0 || mv >= height )
+                continue;
+            const int idx = mv*width + mu;
+            const PointType &q = model.points[idx];
+            const Eigen::Vector3f n = cached ? Eigen::Vector3f( cached_normals.points[idx].getNormalVector3fMap() ) : normals[idx];
+            if( std::isnan(q.z) || std::isnan(n(2)) || (n(0) == 0 && n(1) == 0 && n(2) == 0) )
+                continue;
+            const Eigen::Vector3f diff = p - q.getVector3fMap();
+            if( diff.squaredNorm() > max_distance_squared )
+                continue;
+
+            // point-to-plane residual, Jacobian w.r.t. left twist [w, v]
+            const double r = n.dot( diff );
+            Eigen::Matrix<double, 6, 1> J;
+            J.head<3>() = p.cross( n ).cast<double>();
+            J.tail<3>() = n.cast<double>();
+            system->JtJ += J * J.transpose();
+            system->Jtr += J * r;
+            system->error += r * r;
+            system->count ++;
+        }
+    }
+}
+
 // estimateMotion 计算两个帧之间的运动
 // 输入：帧1和帧2
 // 输出：rvec 和 tvec
@@ -864,6 +1446,22 @@ bool Tracking::solveRelativeTransform( const Frame &source,
     ros::Time start_time = ros::Time::now();
     double planes_dura, points_planes_dura,
             points_dura, icp_dura, pnp_dura;
+    // Dense methods start from the prior if any
+    const Eigen::Matrix4d initial_transform = has_motion_prior_ ? motion_prior_.matrix() : Eigen::Matrix4d::Identity();
+
+    /// case 0: Dense odometry, falls back to correspondences if failed
+    if( use_dense_odometry_ )
+    {
+        RESULT_OF_MOTION dense_transform;
+        if( solveRelativeTransformDense( source, target, dense_transform, initial_transform )
+                && validRelativeTransform(dense_transform) )
+        {
+            result = dense_transform;
+            return true;
+        }
+        if( verbose_ )
+            cout << GREEN << " Transformation from dense odometry: valid = false" << RESET << endl;
+    }
 
     /// case 1: Estimate motion using plane correspondences
     RESULT_OF_MOTION best_transform;
@@ -935,8 +1533,23 @@ bool Tracking::solveRelativeTransform( const Frame &source,
 //    cout << GREEN << "  - rmse: " << best_transform.rmse << ", inlier = " << best_transform.inlier << RESET << endl;
 //    printTransform( best_transform.transform4d() );
 
+    /// case 4: Projective ICP on the organized clouds, no features needed
+    if( !best_transform.valid && use_projective_icp_ )
+    {
+        best_transform.valid = solveRelativeTransformProjectiveIcp( source, target, best_transform, initial_transform );
+    }
+
+    if( best_transform.valid && validRelativeTransform(best_transform) )
+    {
+        result = best_transform;
+        return true;
+    }
+
+    if( verbose_ )
+        cout << GREEN << " Transformation from projective ICP: valid = " << (best_transform.valid?"true":"false") << RESET << endl;
+
 //    best_transform.valid = false; // for test
-    /// case 4: Using ICP
+    /// case 5: Using ICP
     if( !best_transform.valid && good_matches.size() >= 20 )
     {
         best_transform.valid = solveRelativeTransformIcp( source, target, best_transform );
@@ -958,7 +1571,7 @@ bool Tracking::solveRelativeTransform( const Frame &source,
 //    printTransform( best_transform.transform4d() );
 
 //    best_transform.valid = false; // for test
-    /// case 5: using PnP
+    /// case 6: using PnP
     if( !best_transform.valid && good_matches.size() >= 20 )
     {
         best_transform.valid = solveRelativeTransformPnP( source, target, good_matches, target.camera_params_, best_transform );
@@ -1333,6 +1946,170 @@ bool Tracking::solveRtPlanes( const std::vector<PlaneCoefficients> &last_planes,
 }
 
 
+// Umeyama rotation from a 3x3 cross-covariance, sigma = sum( dst * src^T ), fixed size
+Eigen::Matrix3d Tracking::umeyamaRotation( const Eigen::Matrix3d &sigma )
+{
+    Eigen::JacobiSVD<Eigen::Matrix3d> svd( sigma, Eigen::ComputeFullU | Eigen::ComputeFullV );
+    // Eq. (39)
+    Eigen::Vector3d S = Eigen::Vector3d::Ones();
+    if( sigma.determinant() < 0 )
+        S( 2 ) = -1;
+    // Eq. (40) and (43)
+    const Eigen::Vector3d &vs = svd.singularValues();
+    int rank = 0;
+    for (int i=0; i<3; ++i)
+        if (!Eigen::internal::isMuchSmallerThan(vs.coeff(i),vs.coeff(0)))
+            ++rank;
+    if ( rank == 2 )
+    {
+        if ( svd.matrixU().determinant() * svd.matrixV().determinant() > 0 )
+            return svd.matrixU()*svd.matrixV().transpose();
+        S(2) = -1;
+    }
+    return svd.matrixU() * S.asDiagonal() * svd.matrixV().transpose();
+}
+
+// Weighted Umeyama for point matches, drop-in for solveRtPcl( same weights and direction ).
+Eigen::Matrix4f Tracking::solveRtPoints( const std_vector_of_eigen_vector4f &query_points,
+                                         const std_vector_of_eigen_vector4f &train_points,
+                                         const std::vector<cv::DMatch> &matches,
+                                         bool &valid )
+{
+    Eigen::Vector3d from_sum = Eigen::Vector3d::Zero();
+    Eigen::Vector3d to_sum = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d cross_sum = Eigen::Matrix3d::Zero();
+    double weight_sum = 0;
+    int samples = 0;
+    for( int i = 0; i < matches.size(); i++)
+    {
+        const cv::DMatch &m = matches[i];
+        const Eigen::Vector3d to = query_points[m.queryIdx].head<3>().cast<double>();
+        const Eigen::Vector3d from = train_points[m.trainIdx].head<3>().cast<double>();
+        if( std::isnan(from(2)) || std::isnan(to(2)) )
+            continue;
+        const double weight = 1.0/(from(2) * to(2)); //the further, the less weight b/c of quadratic accuracy decay
+        weight_sum += weight;
+        from_sum += weight * from;
+        to_sum += weight * to;
+        cross_sum += weight * to * from.transpose();
+        samples ++;
+    }
+
+    if( samples < 3 )
+    {
+        valid = false;
+        return Eigen::Matrix4f();
+    }
+
+    const Eigen::Vector3d from_mean = from_sum / weight_sum;
+    const Eigen::Vector3d to_mean = to_sum / weight_sum;
+    // Eq. (38)
+    const Eigen::Matrix3d sigma = cross_sum / weight_sum - to_mean * from_mean.transpose();
+    const Eigen::Matrix3d R = umeyamaRotation( sigma );
+    const Eigen::Vector3d T = to_mean - R * from_mean;
+
+    Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+    transform.topLeftCorner<3,3>() = R.cast<float>();
+    transform.topRightCorner<3,1>() = T.cast<float>();
+    valid = true;
+    return transform;
+}
+
+// Closed-form plane triple, same result as solveRtPlanes( vector, vector ) without building vectors.
+bool Tracking::solveRtPlanes( const PlaneCoefficients &last1, const PlaneCoefficients &last2, const PlaneCoefficients &last3,
+                              const PlaneCoefficients &plane1, const PlaneCoefficients &plane2, const PlaneCoefficients &plane3,
+                              RESULT_OF_MOTION &result )
+{
+    result.rotation = Eigen::Matrix3d::Identity();
+    result.translation = Eigen::Vector3d::Zero();
+
+    /// 1: Check co-planar, angle of each normal pair must be above 15 degree
+    const double dir_cos_thresh = cos( 15.0 * DEG_TO_RAD );
+    if( plane1.head<3>().dot( plane2.head<3>() ) > dir_cos_thresh
+            || plane1.head<3>().dot( plane3.head<3>() ) > dir_cos_thresh
+            || plane2.head<3>().dot( plane3.head<3>() ) > dir_cos_thresh )
+        return false;
+    if( last1.head<3>().dot( last2.head<3>() ) > dir_cos_thresh
+            || last1.head<3>().dot( last3.head<3>() ) > dir_cos_thresh
+            || last2.head<3>().dot( last3.head<3>() ) > dir_cos_thresh )
+        return false;
+
+    /// 2: Rotation, n_dst = R * n_src
+    Eigen::Matrix3d A, B;   // A = RB, A === dst, B === src
+    A.col(0) = last1.head<3>();
+    A.col(1) = last2.head<3>();
+    A.col(2) = last3.head<3>();
+    B.col(0) = plane1.head<3>();
+    B.col(1) = plane2.head<3>();
+    B.col(2) = plane3.head<3>();
+    result.rotation = umeyamaRotation( A * B.transpose() );
+
+    /// 3: Translation, n_dst^T * t = d_src - d_dst
+    const Eigen::Vector3d distance( plane1(3) - last1(3), plane2(3) - last2(3), plane3(3) - last3(3) );
+    Eigen::JacobiSVD<Eigen::Matrix3d> svdA( A.transpose(), Eigen::ComputeFullU | Eigen::ComputeFullV );
+    result.translation = svdA.solve( distance );
+
+    return true;
+}
+
+// Weighted joint least-squares of plane and point correspondences, motion maps current to last.
+// Minimizes sum( w_p * |R*p + t - p_last|^2 ) + sum( w_n * |R*n - n_last|^2 + w_n * (n_last^T*t - (d - d_last))^2 ).
+// The point weights of the translation are scaled by point_translation_scale.
+void Tracking::solveRtWeighted( const PlaneCoefficients *last_planes,
+                                const PlaneCoefficients *planes,
+                                const double *plane_weights,
+                                const int num_planes,
+                                const Eigen::Vector3d *last_points,
+                                const Eigen::Vector3d *points,
+                                const double *point_weights,
+                                const int num_points,
+                                RESULT_OF_MOTION &result,
+                                const double point_translation_scale )
+{
+    /// 1: Accumulate
+    Eigen::Vector3d point_sum = Eigen::Vector3d::Zero();
+    Eigen::Vector3d last_point_sum = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d point_cross = Eigen::Matrix3d::Zero();
+    double point_weight_sum = 0;
+    for( int i = 0; i < num_points; i++)
+    {
+        const double w = point_weights[i];
+        point_weight_sum += w;
+        point_sum += w * points[i];
+        last_point_sum += w * last_points[i];
+        point_cross += w * last_points[i] * points[i].transpose();
+    }
+    Eigen::Vector3d point_mean = Eigen::Vector3d::Zero();
+    Eigen::Vector3d last_point_mean = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d sigma = Eigen::Matrix3d::Zero();
+    if( point_weight_sum > 0 )
+    {
+        point_mean = point_sum / point_weight_sum;
+        last_point_mean = last_point_sum / point_weight_sum;
+        sigma = point_cross - point_weight_sum * last_point_mean * point_mean.transpose();
+    }
+    for( int i = 0; i < num_planes; i++)
+        sigma += plane_weights[i] * last_planes[i].head<3>() * planes[i].head<3>().transpose();
+
+    /// 2: Rotation
+    const Eigen::Matrix3d R = umeyamaRotation( sigma );
+
+    /// 3: Translation, normal equations ( W_p * I + sum(w_n * n_last * n_last^T) ) * t = W_p * c + sum(w_n * n_last * b)
+    const double translation_weight = point_translation_scale * point_weight_sum;
+    Eigen::Matrix3d AtA = translation_weight * Eigen::Matrix3d::Identity();
+    Eigen::Vector3d Atb = translation_weight * ( last_point_mean - R * point_mean );
+    for( int i = 0; i < num_planes; i++)
+    {
+        const Eigen::Vector3d n = last_planes[i].head<3>();
+        AtA += plane_weights[i] * n * n.transpose();
+        Atb += plane_weights[i] * n * ( planes[i](3) - last_planes[i](3) );
+    }
+
+    result.rotation = R;
+    result.translation = AtA.ldlt().solve( Atb );
+    result.valid = true;
+}
+
 Eigen::Matrix4f Tracking::solveRtPlanesPoints( const std::vector<PlaneType> &last_planes,
                                                const std::vector<PlaneType> &planes,
                                                const std::vector<PlanePair> &pairs,
@@ -1349,21 +2126,27 @@ Eigen::Matrix4f Tracking::solveRtPlanesPoints( const std::vector<PlaneType> &las
         return Eigen::Matrix4f::Identity();
     }
 
-    std::vector<PlaneCoefficients> before;
-    std::vector<PlaneCoefficients> after;
-    std::vector<Eigen::Vector3d> from_points;
-    std::vector<Eigen::Vector3d> to_points;
+    const int num_planes = pairs.size();
+    const int num_points = matches.size();
+    PlaneCoefficients before[2];
+    PlaneCoefficients after[2];
+    Eigen::Vector3d from_points[2];
+    Eigen::Vector3d to_points[2];
+    double plane_weights[2];
+    double point_weights[2];
 
     // solve RT
-    for( int i = 0; i < pairs.size(); i++)
+    for( int i = 0; i < num_planes; i++)
     {
-        before.push_back( last_planes[pairs[i].ilm].coefficients );
-        after.push_back( planes[pairs[i].iobs].coefficients );
+        before[i] = last_planes[pairs[i].ilm].coefficients;
+        after[i] = planes[pairs[i].iobs].coefficients;
+        plane_weights[i] = 1.0;
     }
-    for( int i = 0; i < matches.size(); i++)
+    for( int i = 0; i < num_points; i++)
     {
-        from_points.push_back( last_feature_3d[matches[i].queryIdx].head<3>().cast<double>() );
-        to_points.push_back( feature_3d[matches[i].trainIdx].head<3>().cast<double>() );
+        from_points[i] = last_feature_3d[matches[i].queryIdx].head<3>().cast<double>();
+        to_points[i] = feature_3d[matches[i].trainIdx].head<3>().cast<double>();
+        point_weights[i] = 1.0 / num_points;    // point covariance averaged in the rotation
     }
 
     // check geometric constrains
@@ -1398,8 +2181,8 @@ Eigen::Matrix4f Tracking::solveRtPlanesPoints( const std::vector<PlaneType> &las
     {
         double dis1, dis2;
         // distance of 2 points
-        dis1 = (before[0] - before[1]).norm();
-        dis2 = (after[0] - after[1]).norm();
+        dis1 = (from_points[0] - from_points[1]).norm();
+        dis2 = (to_points[0] - to_points[1]).norm();
         if(  dis1 < 0.2 || dis2 < 0.2
                 || fabs(dis1 - dis2) > dis_threshold )
             return Eigen::Matrix4f::Identity();
@@ -1422,8 +2205,12 @@ Eigen::Matrix4f Tracking::solveRtPlanesPoints( const std::vector<PlaneType> &las
     }
 
 
+    // Same balance as solveRt( planes, points ): the rotation averages the points, the
+    // translation stacks n * I for the point mean, n^2 in the normal equations
     RESULT_OF_MOTION motion;
-    solveRt( before, after, from_points, to_points, motion );
+    solveRtWeighted( before, after, plane_weights, num_planes,
+                     from_points, to_points, point_weights, num_points, motion,
+                     num_points * num_points );
     valid = true;
 
     return motion.transform4f();
@@ -1473,6 +2260,104 @@ void Tracking::matchImageFeatures( const Frame& source,
 
 //    cout << GREEN << "Kp matches = " << matches.size() << RESET << endl;
 
+    selectGoodMatches( source, target, matches, good_matches, good_match_threshold, min_match_size );
+
+//    cout << "good matches: " << good_matches.size() << endl;
+}
+
+void Tracking::matchImageFeaturesWindow( const Frame& source,
+                                         const Frame& target,
+                                         const Eigen::Matrix4d &prior,
+                                         vector< cv::DMatch > &good_matches,
+                                         double good_match_threshold,
+                                         int min_match_size )
+{
+    const CameraParameters &camera = target.camera_params_;
+    const float radius = prior_search_radius_;
+    const int cols = camera.width / radius + 1;
+    const int rows = camera.height / radius + 1;
+
+    /// 1: Grid of target keypoints with depth, cell size is the search radius
+    keypoint_grid_.resize( cols * rows );
+    for( int i = 0; i < keypoint_grid_.size(); i++)
+        keypoint_grid_[i].clear();
+    for( int i = 0; i < target.feature_locations_2d_.size(); i++)
+    {
+        if( target.feature_locations_3d_[i](2) == 0 )
+            continue;
+        const cv::Point2f &pt = target.feature_locations_2d_[i].pt;
+        const int x = std::min( std::max( (int)(pt.x / radius), 0 ), cols-1 );
+        const int y = std::min( std::max( (int)(pt.y / radius), 0 ), rows-1 );
+        keypoint_grid_[y*cols + x].push_back( i );
+    }
+
+    /// 2: Predict source keypoints in target image, search the neighbouring cells
+    const Eigen::Matrix4f inverse = prior.inverse().cast<float>();
+    const float squared_radius = radius * radius;
+    vector< cv::DMatch > matches;
+    const uint64_t* query_value =  reinterpret_cast<const uint64_t*>(source.feature_descriptors_.data);
+    const uint64_t* search_array = reinterpret_cast<const uint64_t*>(target.feature_descriptors_.data);
+    for(unsigned int i = 0; i < source.feature_locations_2d_.size(); ++i, query_value += 4)
+    {
+        const Eigen::Vector4f &ps = source.feature_locations_3d_[i];
+        if( ps(2) == 0 )
+            continue;
+        const Eigen::Vector3f pt = inverse.topLeftCorner<3,3>() * ps.head<3>() + inverse.topRightCorner<3,1>();
+        if( pt(2) <= 0 )
+            continue;
+        const float u = camera.fx * pt(0) / pt(2) + camera.cx;
+        const float v = camera.fy * pt(1) / pt(2) + camera.cy;
+        if( u < -radius || v < -radius || u >= camera.width + radius || v >= camera.height + radius )
+            continue;
+
+        int result_index = -1;
+        int hd = 256;
+        const int x_min = std::max( (int)floor( (u - radius) / radius ), 0 );
+        const int x_max = std::min( (int)floor( (u + radius) / radius ), cols-1 );
+        const int y_min = std::max( (int)floor( (v - radius) / radius ), 0 );
+        const int y_max = std::min( (int)floor( (v + radius) / radius ), rows-1 );
+        for( int y = y_min; y <= y_max; y++)
+        {
+            for( int x = x_min; x <= x_max; x++)
+            {
+                const std::vector<int> &cell = keypoint_grid_[y*cols + x];
+                for( int k = 0; k < cell.size(); k++)
+                {
+                    const int j = cell[k];
+                    const cv::Point2f &kp = target.feature_locations_2d_[j].pt;
+                    if( (kp.x-u)*(kp.x-u) + (kp.y-v)*(kp.y-v) > squared_radius )
+                        continue;
+                    const int d = hamming_distance_orb32x8_popcountll( query_value, search_array + 4*j );
+                    if( d < hd )
+                    {
+                        hd = d;
+                        result_index = j;
+                    }
+                }
+            }
+        }
+        if(hd >= 128)
+            continue;//not more than half of the bits matching: Random
+        cv::DMatch match(i, result_index, hd /256.0 + (float)rand()/(1000.0*RAND_MAX));
+        matches.push_back(match);
+    }
+
+    selectGoodMatches( source, target, matches, good_matches, good_match_threshold, min_match_size );
+
+    if( verbose_ )
+        cout << GREEN << " Window matches = " << matches.size() << ", good matches = " << good_matches.size() << RESET << endl;
+}
+
+void Tracking::selectGoodMatches( const Frame& source,
+                                  const Frame& target,
+                                  std::vector< cv::DMatch > &matches,
+                                  std::vector< cv::DMatch > &good_matches,
+                                  double good_match_threshold,
+                                  int min_match_size )
+{
+    if( matches.empty() )
+        return;
+
     // Sort
     std::sort( matches.begin(), matches.end() );
 
@@ -1510,14 +2395,12 @@ void Tracking::matchImageFeatures( const Frame& source,
         }
 
     }
-
-//    cout << "good matches: " << good_matches.size() << endl;
 }
 
 
 void Tracking::matchImageFeatures( const cv::Mat &feature_descriptor,
                                    const std::vector<cv::DMatch> &kp_inlier,
-                                   const std::map<int, KeyPoint*> &keypoints_list,
+                                   const SlotMap<KeyPoint*> &keypoints_list,
                                    const std::map<int, gtsam::Point3> &predicted_keypoints,
                                    vector<cv::DMatch> &good_matches,
                                    double good_match_threshold,
@@ -1573,7 +2456,7 @@ void Tracking::matchImageFeatures( const cv::Mat &feature_descriptor,
 }
 
 void Tracking::matchImageFeatures( const Frame &frame,
-                                   const std::map<int, KeyPoint*> &keypoints_list,
+                                   const SlotMap<KeyPoint*> &keypoints_list,
                                    const std::map<int, gtsam::Point3> &predicted_keypoints,
                                    vector<cv::DMatch> &good_matches,
                                    double good_match_threshold,
@@ -1713,8 +2596,8 @@ void Tracking::computePairInliersAndError( const Eigen::Matrix4d &transform,
     {
         const PlaneType &plane = planes[ pairs[i].iobs ];
         const PlaneType &last_plane = last_planes[ pairs[i].ilm ];
-        PlaneType transformed_plane;
-        transformPlane( last_plane.coefficients, transform, transformed_plane.coefficients );
+        PlaneCoefficients transformed_plane;
+        transformPlane( last_plane.coefficients, transform, transformed_plane );
 //        cout << GREEN << " - tr p: " << pairs[i].iobs << "/" << pairs[i].ilm << ": " << endl;
 //        cout << " current: " << plane.coefficients[0] << ", " << plane.coefficients[1]
 //             << ", " << plane.coefficients[2] << ", " << plane.coefficients[3] << endl;
@@ -1722,7 +2605,7 @@ void Tracking::computePairInliersAndError( const Eigen::Matrix4d &transform,
 //             << ", " << transformed_plane.coefficients[2] << ", " << transformed_plane.coefficients[3]
 //             << RESET << endl;
         double direction, distance;
-        ITree::euclidianDistance( plane, transformed_plane, direction, distance );
+        ITree::euclidianDistance( plane.coefficients, transformed_plane, direction, distance );
 
         // check inlier
         if( (direction < max_direction_error) && (distance < max_distance_error) )
@@ -1764,13 +2647,21 @@ std::vector<PlanePair> Tracking::randomChoosePlanePairs( const std::vector< std:
 
 std::vector<cv::DMatch> Tracking::randomChooseMatchesPreferGood( const unsigned int sample_size,
                                                                 const vector< cv::DMatch > &matches_with_depth )
+{
+    cv::RNG rng( rand() );
+    return randomChooseMatchesPreferGood( sample_size, matches_with_depth, rng );
+}
+
+std::vector<cv::DMatch> Tracking::randomChooseMatchesPreferGood( const unsigned int sample_size,
+                                                                const vector< cv::DMatch > &matches_with_depth,
+                                                                cv::RNG &rng )
 {
     std::set<std::vector<cv::DMatch>::size_type> sampled_ids;
     int safety_net = 0;
     while(sampled_ids.size() < sample_size && matches_with_depth.size() >= sample_size)
     {
-        int id1 = rand() % matches_with_depth.size();
-        int id2 = rand() % matches_with_depth.size();
+        int id1 = rng.uniform( 0, (int)matches_with_depth.size() );
+        int id2 = rng.uniform( 0, (int)matches_with_depth.size() );
         if(id1 > id2) id1 = id2; //use smaller one => increases chance for lower id
             sampled_ids.insert(id1);
         if(++safety_net > 2000)
@@ -1843,16 +2734,54 @@ void Tracking::trackingReconfigCallback(plane_slam::TrackingConfig &config, uint
 {
     feature_good_match_threshold_ = config.feature_good_match_threshold;
     feature_min_good_match_size_ = config.feature_min_good_match_size;
+    plane_ransac_method_ = config.plane_ransac_method;
+    plane_ransac_iterations_ = config.plane_ransac_iterations;
+    plane_ransac_inlier_ratio_ = config.plane_ransac_inlier_ratio;
     ransac_sample_size_ = config.ransac_sample_size;
     ransac_iterations_ = config.ransac_iterations;
     ransac_min_inlier_ = config.ransac_min_inlier;
     ransac_inlier_max_mahal_distance_ = config.ransac_inlier_max_mahal_distance;
+    ransac_threads_ = config.ransac_threads;
+    ransac_seed_ = config.ransac_seed;
+    //
+    use_motion_prior_ = config.use_motion_prior;
+    prior_search_radius_ = config.prior_search_radius;
+    prior_plane_direction_threshold_ = config.prior_plane_direction_threshold;
+    prior_plane_distance_threshold_ = config.prior_plane_distance_threshold;
+    prior_inlier_ratio_ = config.prior_inlier_ratio;
+    prior_max_interval_ = config.prior_max_interval;
     //
     icp_max_distance_ = config.icp_max_distance;
     icp_iterations_ = config.icp_iterations;
     icp_tf_epsilon_ = config.icp_tf_epsilon;
     icp_min_indices_ = config.icp_min_indices;
     icp_score_threshold_ = config.icp_score_threshold;
+    use_projective_icp_ = config.use_projective_icp;
+    projective_icp_strides_ = config.projective_icp_strides;
+    projective_icp_iterations_ = config.projective_icp_iterations;
+    projective_icp_threads_ = config.projective_icp_threads;
+    //
+    use_dense_odometry_ = config.use_dense_odometry;
+    dense_odometry_.setLevels( config.dense_levels );
+    dense_odometry_.setIterations( config.dense_iterations );
+    dense_odometry_.setThreads( config.dense_threads );
+    dense_odometry_.setDepthWeight( config.dense_depth_weight );
+    dense_odometry_.setIntensityHuber( config.dense_intensity_huber );
+    dense_odometry_.setDepthHuber( config.dense_depth_huber );
+    dense_odometry_.setMinPixels( config.dense_min_pixels );
+    dense_odometry_.setMaxRmse( config.dense_max_rmse );
+    //
+    use_local_map_tracking_ = config.use_local_map_tracking;
+    local_map_tracker_.setSearchRadius( config.local_map_search_radius );
+    local_map_tracker_.setHammingThreshold( config.local_map_hamming_threshold );
+    local_map_tracker_.setIterations( config.local_map_iterations );
+    local_map_tracker_.setPointSigma( config.local_map_point_sigma );
+    local_map_tracker_.setPlaneSigmas( config.local_map_plane_direction_sigma, config.local_map_plane_distance_sigma );
+    local_map_tracker_.setPlaneThresholds( config.local_map_plane_direction_threshold * DEG_TO_RAD,
+                                           config.local_map_plane_distance_threshold );
+    local_map_tracker_.setHuber( config.local_map_huber );
+    local_map_tracker_.setMinInlier( config.local_map_min_inlier );
+    local_map_tracker_.setMaxCorrection( config.local_map_max_translation, config.local_map_max_rotation * DEG_TO_RAD );
     //
     pnp_iterations_ = config.pnp_iterations;
     pnp_min_inlier_ = config.pnp_min_inlier;
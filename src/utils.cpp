@@ -1,4 +1,5 @@
 #include "utils.h"
+#include <Eigen/Eigenvalues>
 
 PointRepresentationConstPtr prttcp_(new pcl::DefaultPointRepresentation<PointType>) ;
 //
@@ -551,6 +552,79 @@ void projectPoints ( const PointCloudType &input, const std::vector<int> &inlier
 }
 
 
+bool fitPlane( const PointCloudType &input, const std::vector<int> &inlier,
+               Eigen::Vector4d &coefficients, Eigen::Vector3d &centroid )
+{
+    if( inlier.size() < 3 )
+        return false;
+
+    Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d squared_sum = Eigen::Matrix3d::Zero();
+    for( int i = 0; i < inlier.size(); i++)
+    {
+        const Eigen::Vector3d p = input.points[inlier[i]].getVector3fMap().cast<double>();
+        sum += p;
+        squared_sum += p * p.transpose();
+    }
+    centroid = sum / inlier.size();
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver;
+    solver.computeDirect( squared_sum / inlier.size() - centroid * centroid.transpose() );
+    Eigen::Vector3d n = solver.eigenvectors().col(0);
+    if( n.dot( centroid ) > 0 )
+        n = -n;
+    coefficients << n, -n.dot( centroid );
+    return true;
+}
+
+void computePlaneStatistics( const PointCloudType &input, PlaneType &plane )
+{
+    const std::vector<int> &inlier = plane.inlier;
+    plane.count = inlier.size();
+    plane.scatter.setZero();
+    if( inlier.empty() )
+        return;
+
+    Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d squared_sum = Eigen::Matrix3d::Zero();
+    for( int i = 0; i < inlier.size(); i++)
+    {
+        const Eigen::Vector3d p = input.points[inlier[i]].getVector3fMap().cast<double>();
+        sum += p;
+        squared_sum += p * p.transpose();
+    }
+    const Eigen::Vector3d centroid = sum / inlier.size();
+    plane.centroid.x = centroid(0);
+    plane.centroid.y = centroid(1);
+    plane.centroid.z = centroid(2);
+    plane.scatter = squared_sum - sum * centroid.transpose();
+}
+
+PointCloudTypePtr getPlaneCloud( const PointCloudType &input, const PlaneType &plane )
+{
+    if( plane.cloud && !plane.cloud->empty() )
+        return plane.cloud;
+    PointCloudTypePtr cloud( new PointCloudType );
+    if( !plane.inlier.empty() && !input.empty() )
+        projectPoints( input, plane.inlier, plane.coefficients, *cloud );
+    return cloud;
+}
+
+void extractRegionBoundary( const std::vector<int> &labels, int label, int width, int height,
+                            const std::vector<int> &inlier, std::vector<int> &boundary )
+{
+    boundary.clear();
+    for( int i = 0; i < inlier.size(); i++)
+    {
+        const int idx = inlier[i];
+        const int u = idx % width;
+        const int v = idx / width;
+        if( u == 0 || u == width-1 || v == 0 || v == height-1
+                || labels[idx-1] != label || labels[idx+1] != label
+                || labels[idx-width] != label || labels[idx+width] != label )
+            boundary.push_back( idx );
+    }
+}
+
 void getPointCloudFromIndices( const PointCloudTypePtr &input,
                                const pcl::PointIndices &indices,
                                PointCloudTypePtr &output)
@@ -852,11 +926,6 @@ gtsam::Pose3 motionToPose3( RESULT_OF_MOTION &motion)
     return gtsam::Pose3( motion.transform4d() );
 }
 
-static inline int hamming_distance_orb32x8_popcountll(const uint64_t* v1, const uint64_t* v2) {
-  return (__builtin_popcountll(v1[0] ^ v2[0]) + __builtin_popcountll(v1[1] ^ v2[1])) +
-         (__builtin_popcountll(v1[2] ^ v2[2]) + __builtin_popcountll(v1[3] ^ v2[3]));
-}
-
 int bruteForceSearchORB(const uint64_t* v, const uint64_t* search_array, const unsigned int& size, int& result_index)
 {
     //constexpr unsigned int howmany64bitwords = 4;//32*8/64;
@@ -875,7 +944,7 @@ int bruteForceSearchORB(const uint64_t* v, const uint64_t* search_array, const u
     return min_distance;
 }
 
-int bruteForceSearchORB(const uint64_t* v, const std::map<int, KeyPoint*> &keypoints_list,
+int bruteForceSearchORB(const uint64_t* v, const plane_slam::SlotMap<KeyPoint*> &keypoints_list,
                         const std::map<int, gtsam::Point3> &predicted_keypoints, int& result_index)
 {
     //constexpr unsigned int howmany64bitwords = 4;//32*8/64;
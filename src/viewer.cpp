@@ -246,7 +246,7 @@ void Viewer::displayMapLandmarks( const PointCloudTypePtr &keypoints_cloud, cons
     }
 }
 
-void Viewer::displayMapLandmarks( std::map<int, PlaneType*> &landmarks, const std::string &prefix )
+void Viewer::displayMapLandmarks( SlotMap<PlaneType*> &landmarks, const std::string &prefix )
 {
     if( display_plane_landmarks_ )
     {
@@ -254,7 +254,7 @@ void Viewer::displayMapLandmarks( std::map<int, PlaneType*> &landmarks, const st
 
         int invalid_count = 0;
 
-        for( std::map<int, PlaneType*>::iterator it = landmarks.begin();
+        for( SlotMap<PlaneType*>::iterator it = landmarks.begin();
              it != landmarks.end(); it++)
         {
             const int id = it->first;
@@ -477,7 +477,7 @@ void Viewer::displayPath( const std::vector<geometry_msgs::PoseStamped> &poses,
     }
 }
 
-void Viewer::displayPath( const std::map<int, gtsam::Pose3> &optimized_poses, const std::string &prefix, double r, double g, double b )
+void Viewer::displayPath( const SlotMap<gtsam::Pose3> &optimized_poses, const std::string &prefix, double r, double g, double b )
 {
     if(!display_pathes_ || !display_optimized_path_)
         return;
@@ -488,7 +488,7 @@ void Viewer::displayPath( const std::map<int, gtsam::Pose3> &optimized_poses, co
     bool last_valid = false;
     pcl::PointXYZ p1, p2;
 //    int last_index = 0;
-    for( std::map<int, gtsam::Pose3>::const_iterator it = optimized_poses.begin();
+    for( SlotMap<gtsam::Pose3>::const_iterator it = optimized_poses.begin();
             it != optimized_poses.end(); it++)
     {
         const gtsam::Pose3 &pose = it->second;
@@ -656,7 +656,7 @@ void Viewer::pclViewerLandmark( const PlaneType &plane, const std::string &id, c
     }
 
     // boundary
-    if( display_landmark_boundary_ )
+    if( display_landmark_boundary_ && plane.cloud_boundary )
     {
         double r = rng.uniform(0.0, 255.0);
         double g = rng.uniform(0.0, 255.0);
@@ -674,7 +674,7 @@ void Viewer::pclViewerLandmark( const PlaneType &plane, const std::string &id, c
         double g = rng.uniform(0.0, 1.0);
         double b = rng.uniform(0.0, 1.0);
 
-        const int num = plane.cloud_hull->size();
+        const int num = plane.cloud_hull ? plane.cloud_hull->size() : 0;
         if( num >= 3)
         {
             for(int i = 1; i < num; i++)
@@ -755,8 +755,11 @@ void Viewer::pclViewerPlane( const PointCloudTypePtr &input, const PlaneType &pl
     // inlier
     if( display_plane_inlier_ && display_plane_projected_inlier_ )
     {
-        pcl::visualization::PointCloudColorHandlerCustom<pcl::PointXYZRGBA> color( plane.cloud, r, g, b);
-        pcl_viewer_->addPointCloud( plane.cloud, color, id+"_inlier", viewport);
+        PointCloudTypePtr cloud = input ? getPlaneCloud( *input, plane ) : plane.cloud;
+        if( !cloud )
+            cloud.reset( new PointCloudType );
+        pcl::visualization::PointCloudColorHandlerCustom<pcl::PointXYZRGBA> color( cloud, r, g, b);
+        pcl_viewer_->addPointCloud( cloud, color, id+"_inlier", viewport);
         pcl_viewer_->setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 1, id+"_inlier", viewport);
 
         if( display_plane_arrow_ )
@@ -768,7 +771,7 @@ void Viewer::pclViewerPlane( const PointCloudTypePtr &input, const PlaneType &pl
             if( p1.z == 0 && p1.x == 0 && p1.y == 0 )
             {
                 Eigen::Vector4f cen;
-                pcl::compute3DCentroid( *plane.cloud, cen );
+                pcl::compute3DCentroid( *cloud, cen );
                 p1.x = cen[0];
                 p1.y = cen[1];
                 p1.z = cen[2];
@@ -847,7 +850,7 @@ void Viewer::pclViewerPlane( const PointCloudTypePtr &input, const PlaneType &pl
     }
 
     // boundary
-    if( display_plane_boundary_ && display_plane_projected_inlier_ )
+    if( display_plane_boundary_ && display_plane_projected_inlier_ && plane.cloud_boundary )
     {
         r = rng.uniform(0.0, 255.0);
         g = rng.uniform(0.0, 255.0);
@@ -877,7 +880,7 @@ void Viewer::pclViewerPlane( const PointCloudTypePtr &input, const PlaneType &pl
         g = rng.uniform(0.0, 1.0);
         b = rng.uniform(0.0, 1.0);
 
-        const int num = plane.cloud_hull->size();
+        const int num = plane.cloud_hull ? plane.cloud_hull->size() : 0;
         if( num >= 3)
         {
             for(int i = 1; i < num; i++)
@@ -0,0 +1,106 @@
+#include "worker_pool.h"
+
+namespace plane_slam
+{
+
+WorkerPool::WorkerPool( int threads )
+    : task_( 0 )
+    , count_( 0 )
+    , next_( 0 )
+    , pending_( 0 )
+    , generation_( 0 )
+    , stop_( false )
+{
+    resize( threads );
+}
+
+WorkerPool::~WorkerPool()
+{
+    resize( 0 );
+}
+
+void WorkerPool::resize( int threads )
+{
+    threads = std::max( 0, threads );
+    if( threads == workers_.size() )
+        return;
+
+    /// 1: Stop the old workers, they are idle between runs
+    {
+        std::unique_lock<std::mutex> lock( mutex_ );
+        stop_ = true;
+    }
+    start_condition_.notify_all();
+    for( int i = 0; i < workers_.size(); i++)
+        workers_[i].join();
+    workers_.clear();
+
+    /// 2: Start the new ones
+    stop_ = false;
+    for( int i = 0; i < threads; i++)
+        workers_.push_back( std::thread( &WorkerPool::loop, this ) );
+}
+
+void WorkerPool::run( const Task &task, int count )
+{
+    if( count <= 0 )
+        return;
+
+    {
+        std::unique_lock<std::mutex> lock( mutex_ );
+        task_ = &task;
+        count_ = count;
+        next_ = 0;
+        pending_ = count;
+        generation_++;
+    }
+    start_condition_.notify_all();
+
+    work();
+
+    std::unique_lock<std::mutex> lock( mutex_ );
+    while( pending_ > 0 )
+        done_condition_.wait( lock );
+    task_ = 0;
+}
+
+void WorkerPool::loop()
+{
+    unsigned int generation = 0;
+    while( true )
+    {
+        {
+            std::unique_lock<std::mutex> lock( mutex_ );
+            while( !stop_ && generation == generation_ )
+                start_condition_.wait( lock );
+            if( stop_ )
+                return;
+            generation = generation_;
+        }
+        work();
+    }
+}
+
+void WorkerPool::work()
+{
+    while( true )
+    {
+        const Task *task;
+        int index;
+        {
+            std::unique_lock<std::mutex> lock( mutex_ );
+            if( !task_ || next_ >= count_ )
+                return;
+            task = task_;
+            index = next_++;
+        }
+
+        (*task)( index );
+
+        std::unique_lock<std::mutex> lock( mutex_ );
+        if( --pending_ == 0 )
+            done_condition_.notify_all();
+    }
+}
+
+} // end of namespace plane_slam
@@ -0,0 +1,73 @@
+#include <CppUnitLite/TestHarness.h>
+#include <gtsam/base/Testable.h>
+#include <gtsam/inference/Symbol.h>
+#include <gtsam/nonlinear/Values.h>
+#include <gtsam/nonlinear/factorTesting.h>
+#include "rgbd_factors.h"
+
+using namespace gtsam;
+using namespace plane_slam;
+
+static const Pose3 pose( Rot3::RzRyRx( 0.3, -0.2, 1.1 ), Point3( 1.0, -2.0, 0.5 ) );
+static const OrientedPlane3 plane( Unit3( 0.2, -0.6, 0.7 ), 1.5 );
+static const Point3 point( 2.0, 1.0, 1.2 );
+
+// Measurement of the landmark from the pose, moved off by a small error
+static OrientedPlane3 measuredPlane()
+{
+    return plane.transform( pose ).retract( Vector3( 0.01, -0.02, 0.03 ) );
+}
+
+static Point3 measuredPoint()
+{
+    const Point3 q = pose.transform_to( point );
+    return Point3( q.x() + 0.01, q.y() - 0.02, q.z() + 0.03 );
+}
+
+TEST( RGBDPlaneFactor, Error )
+{
+    RGBDPlaneFactor factor( plane.transform( pose ).planeCoefficients(), Vector3( 0.01, 0.01, 0.02 ),
+                            Symbol( 'x', 0 ), Symbol( 'l', 0 ) );
+    EXPECT( assert_equal( Vector::Zero( 3 ), factor.evaluateError( pose, plane ), 1e-9 ) );
+}
+
+TEST( RGBDPlaneFactor, Jacobians )
+{
+    RGBDPlaneFactor factor( measuredPlane().planeCoefficients(), Vector3( 0.01, 0.01, 0.02 ),
+                            Symbol( 'x', 0 ), Symbol( 'l', 0 ) );
+    Values values;
+    values.insert( Symbol( 'x', 0 ), pose );
+    values.insert( Symbol( 'l', 0 ), plane );
+    EXPECT_CORRECT_FACTOR_JACOBIANS( factor, values, 1e-5, 1e-5 );
+
+    // Plane through the origin of the world and of the camera
+    values.update( Symbol( 'l', 0 ), OrientedPlane3( Unit3( -0.5, 0.1, 0.9 ), 0.0 ) );
+    EXPECT_CORRECT_FACTOR_JACOBIANS( factor, values, 1e-5, 1e-5 );
+}
+
+TEST( RGBDPointFactor, Error )
+{
+    RGBDPointFactor factor( pose.transform_to( point ), Eigen::Vector3d( 1e-4, 1e-4, 4e-4 ).asDiagonal(),
+                            Symbol( 'x', 0 ), Symbol( 'p', 0 ) );
+    EXPECT( assert_equal( Vector::Zero( 3 ), factor.evaluateError( pose, point ), 1e-9 ) );
+}
+
+TEST( RGBDPointFactor, Jacobians )
+{
+    // Correlated noise so that the whitening is not diagonal
+    Eigen::Matrix3d covariance;
+    covariance << 4e-4, 1e-4, 0,
+                  1e-4, 3e-4, 5e-5,
+                  0,    5e-5, 9e-4;
+    RGBDPointFactor factor( measuredPoint(), covariance, Symbol( 'x', 0 ), Symbol( 'p', 0 ) );
+    Values values;
+    values.insert( Symbol( 'x', 0 ), pose );
+    values.insert( Symbol( 'p', 0 ), point );
+    EXPECT_CORRECT_FACTOR_JACOBIANS( factor, values, 1e-5, 1e-5 );
+}
+
+int main()
+{
+    TestResult tr;
+    return TestRegistry::runAllTests( tr );
+}
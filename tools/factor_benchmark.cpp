@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <gtsam/inference/Symbol.h>
+#include <gtsam/base/numericalDerivative.h>
+#include <gtsam/slam/OrientedPlane3Factor.h>
+#include <gtsam/sam/BearingRangeFactor.h>
+#include <gtsam/nonlinear/NonlinearFactorGraph.h>
+#include <gtsam/nonlinear/Values.h>
+#include "rgbd_factors.h"
+
+using namespace std;
+using namespace gtsam;
+using namespace plane_slam;
+
+static double nowMS()
+{
+    return std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+static double uniform( double min, double max )
+{
+    return min + (max - min) * rand() / RAND_MAX;
+}
+
+// Kinect noise as in kinectBearingRangeCov and kinectPointCov, depth stddev 0.01 z^2
+static Eigen::Matrix3d bearingRangeCov( const Point3 &p )
+{
+    const double bx = 5.0 * (58.0/180.0*M_PI) / 640, by = 5.0 * (45.0/180.0*M_PI) / 480;
+    const double sd = 0.01 * p.z() * p.z();
+    return Eigen::Vector3d( bx*bx, by*by, sd*sd ).asDiagonal();
+}
+
+static Eigen::Matrix3d pointCov( const Point3 &p )
+{
+    const double rx = 3*tan( (58.0/180.0*M_PI) / 640 ), ry = 3*tan( (45.0/180.0*M_PI) / 480 );
+    const double sd = 0.01 * p.z() * p.z();
+    return Eigen::Vector3d( rx*rx*p.z(), ry*ry*p.z(), sd*sd ).asDiagonal();
+}
+
+static Pose3 randomPose()
+{
+    return Pose3( Rot3::RzRyRx( uniform( -0.5, 0.5 ), uniform( -0.5, 0.5 ), uniform( -3.1, 3.1 ) ),
+                  Point3( uniform( -5, 5 ), uniform( -5, 5 ), uniform( 0, 2 ) ) );
+}
+
+// Largest difference of the whitened Jacobians to the numerical ones
+template <typename Factor, typename T>
+double checkJacobians( const Factor &factor, const Pose3 &pose, const T &landmark )
+{
+    // Errors of the analytic factors come out whitened
+    Matrix H1, H2;
+    factor.evaluateError( pose, landmark, H1, H2 );
+    boost::function<Vector( const Pose3&, const T& )> error =
+            boost::bind( &Factor::evaluateError, &factor, _1, _2, boost::none, boost::none );
+    const Matrix N1 = numericalDerivative21<Vector, Pose3, T>( error, pose, landmark, 1e-6 );
+    const Matrix N2 = numericalDerivative22<Vector, Pose3, T>( error, pose, landmark, 1e-6 );
+    return std::max( (H1 - N1).cwiseAbs().maxCoeff() / std::max( 1.0, N1.cwiseAbs().maxCoeff() ),
+                     (H2 - N2).cwiseAbs().maxCoeff() / std::max( 1.0, N2.cwiseAbs().maxCoeff() ) );
+}
+
+static void run( const char *name, const NonlinearFactorGraph &graph, const Values &values, double build_ms )
+{
+    const int rounds = 20;
+    double start = nowMS();
+    for( int r = 0; r < rounds; r++)
+        graph.linearize( values );
+    const double linearize_ms = (nowMS() - start) / rounds;
+
+    start = nowMS();
+    volatile double error = 0;
+    for( int r = 0; r < rounds; r++)
+        error = graph.error( values );
+    const double error_ms = (nowMS() - start) / rounds;
+
+    printf( "  %-20s build %8.3f ms, linearize %8.3f ms, error %8.3f ms, chi2 %12.3f\n",
+            name, build_ms, linearize_ms, error_ms, (double)error );
+}
+
+int main( int argc, char** argv )
+{
+    const int poses = 500, planes_per_pose = 8, points_per_pose = 100;
+    srand( 0 );
+
+    /// 1: Random poses, planes and points, noisy measurements in the camera frames
+    Values values;
+    std::vector<Pose3> pose_list;
+    for( int i = 0; i < poses; i++)
+    {
+        pose_list.push_back( randomPose() );
+        values.insert( Symbol( 'x', i ), pose_list.back() );
+    }
+    std::vector<OrientedPlane3> plane_list;
+    for( int i = 0; i < poses * planes_per_pose / 4; i++)
+    {
+        plane_list.push_back( OrientedPlane3( Unit3( uniform( -1, 1 ), uniform( -1, 1 ), uniform( -1, 1 ) ), uniform( -4, 4 ) ) );
+        values.insert( Symbol( 'l', i ), plane_list.back() );
+    }
+
+    struct PlaneMeasurement { Key pose, plane; OrientedPlane3 measured; };
+    struct PointMeasurement { Key pose, point; Point3 measured; };
+    std::vector<PlaneMeasurement> plane_measurements;
+    std::vector<PointMeasurement> point_measurements;
+    int next_point = 0;
+    for( int i = 0; i < poses; i++)
+    {
+        for( int k = 0; k < planes_per_pose; k++)
+        {
+            const int j = rand() % plane_list.size();
+            const OrientedPlane3 local = plane_list[j].transform( pose_list[i] );
+            PlaneMeasurement m;
+            m.pose = Symbol( 'x', i );
+            m.plane = Symbol( 'l', j );
+            m.measured = local.retract( Vector3( uniform( -0.01, 0.01 ), uniform( -0.01, 0.01 ), uniform( -0.01, 0.01 ) ) );
+            plane_measurements.push_back( m );
+        }
+        for( int k = 0; k < points_per_pose; k++)
+        {
+            const Point3 local( uniform( -1.5, 1.5 ), uniform( -1, 1 ), uniform( 0.5, 4 ) );
+            const Point3 noisy( local.x() + uniform( -0.01, 0.01 ), local.y() + uniform( -0.01, 0.01 ), local.z() + uniform( -0.02, 0.02 ) );
+            values.insert( Symbol( 'p', next_point ), pose_list[i].transform_from( local ) );
+            PointMeasurement m;
+            m.pose = Symbol( 'x', i );
+            m.point = Symbol( 'p', next_point++ );
+            m.measured = noisy;
+            point_measurements.push_back( m );
+        }
+    }
+    cout << " Poses: " << poses << ", plane factors: " << plane_measurements.size()
+         << ", point factors: " << point_measurements.size() << endl;
+
+    /// 2: Build and linearize with the generic and the analytic factors
+    NonlinearFactorGraph plane_generic, plane_analytic, point_generic, point_analytic;
+    const Vector3 sigmas( 0.0001, 0.0001, 0.005 );
+    double start = nowMS();
+    for( int i = 0; i < plane_measurements.size(); i++)
+    {
+        const PlaneMeasurement &m = plane_measurements[i];
+        plane_generic.push_back( OrientedPlane3Factor( m.measured.planeCoefficients(), noiseModel::Diagonal::Sigmas( sigmas ), m.pose, m.plane ) );
+    }
+    run( "OrientedPlane3Factor", plane_generic, values, nowMS() - start );
+
+    start = nowMS();
+    for( int i = 0; i < plane_measurements.size(); i++)
+    {
+        const PlaneMeasurement &m = plane_measurements[i];
+        plane_analytic.push_back( RGBDPlaneFactor( m.measured.planeCoefficients(), sigmas, m.pose, m.plane ) );
+    }
+    run( "RGBDPlaneFactor", plane_analytic, values, nowMS() - start );
+
+    start = nowMS();
+    for( int i = 0; i < point_measurements.size(); i++)
+    {
+        const PointMeasurement &m = point_measurements[i];
+        noiseModel::Gaussian::shared_ptr noise = noiseModel::Gaussian::Covariance( bearingRangeCov( m.measured ) );
+        point_generic.push_back( BearingRangeFactor<Pose3, Point3>( m.pose, m.point, Unit3( m.measured ), m.measured.norm(), noise ) );
+    }
+    run( "BearingRangeFactor", point_generic, values, nowMS() - start );
+
+    start = nowMS();
+    for( int i = 0; i < point_measurements.size(); i++)
+    {
+        const PointMeasurement &m = point_measurements[i];
+        point_analytic.push_back( RGBDPointFactor( m.measured, pointCov( m.measured ), m.pose, m.point ) );
+    }
+    run( "RGBDPointFactor", point_analytic, values, nowMS() - start );
+
+    /// 3: Analytic Jacobians against numerical ones
+    double plane_max = 0, point_max = 0;
+    for( int i = 0; i < 100; i++)
+    {
+        const RGBDPlaneFactor &fl = *boost::static_pointer_cast<RGBDPlaneFactor>( plane_analytic[i] );
+        plane_max = std::max( plane_max, checkJacobians( fl, values.at<Pose3>( fl.key1() ), values.at<OrientedPlane3>( fl.key2() ) ) );
+        const RGBDPointFactor &fp = *boost::static_pointer_cast<RGBDPointFactor>( point_analytic[i] );
+        point_max = std::max( point_max, checkJacobians( fp, values.at<Pose3>( fp.key1() ), values.at<Point3>( fp.key2() ) ) );
+    }
+    printf( " Jacobians, max relative difference to numerical: plane %g, point %g\n", plane_max, point_max );
+
+    return 0;
+}
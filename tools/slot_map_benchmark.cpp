@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <map>
+#include <vector>
+#include <chrono>
+#include <Eigen/Core>
+#include "slot_map.h"
+
+using namespace std;
+using plane_slam::SlotMap;
+
+// Same payload size as the optimized landmarks
+struct Payload
+{
+    double v[4];
+    Payload() { v[0] = v[1] = v[2] = v[3] = 0; }
+};
+
+static double nowMS()
+{
+    return std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+template <typename Map>
+void fill( Map &map, int n )
+{
+    for( int i = 0; i < n; i++)
+        map[i].v[0] = i;
+}
+
+template <typename Map>
+double iterate( const Map &map, int rounds )
+{
+    double sum = 0;
+    for( int r = 0; r < rounds; r++)
+        for( typename Map::const_iterator it = map.begin(); it != map.end(); it++)
+            sum += it->second.v[0];
+    return sum;
+}
+
+template <typename Map>
+double lookup( const Map &map, const std::vector<int> &ids )
+{
+    double sum = 0;
+    for( int i = 0; i < ids.size(); i++)
+    {
+        typename Map::const_iterator it = map.find( ids[i] );
+        if( it != map.end() )
+            sum += it->second.v[0];
+    }
+    return sum;
+}
+
+template <typename Map>
+void erase( Map &map, const std::vector<int> &ids )
+{
+    for( int i = 0; i < ids.size(); i++)
+        map.erase( ids[i] );
+}
+
+template <typename Map>
+void run( const char *name, int n, const std::vector<int> &queries, const std::vector<int> &removed )
+{
+    const int rounds = 100;
+    Map map;
+    double start = nowMS();
+    fill( map, n );
+    const double fill_ms = nowMS() - start;
+
+    start = nowMS();
+    volatile double sum = iterate( map, rounds );
+    const double iterate_ms = (nowMS() - start) / rounds;
+
+    start = nowMS();
+    sum = lookup( map, queries );
+    const double lookup_ms = nowMS() - start;
+
+    start = nowMS();
+    erase( map, removed );
+    const double erase_ms = nowMS() - start;
+
+    start = nowMS();
+    sum = iterate( map, rounds );
+    const double iterate_holes_ms = (nowMS() - start) / rounds;
+    (void)sum;
+
+    printf( "  %-10s fill %8.3f ms, iterate %8.3f ms, %zu lookups %8.3f ms, erase 10%% %8.3f ms, iterate after %8.3f ms\n",
+            name, fill_ms, iterate_ms, queries.size(), lookup_ms, erase_ms, iterate_holes_ms );
+}
+
+int main( int argc, char** argv )
+{
+    int sizes[2] = { 10000, 100000 };
+    srand( 0 );
+    for( int s = 0; s < 2; s++)
+    {
+        const int n = sizes[s];
+        std::vector<int> queries( 1000000 );
+        for( int i = 0; i < queries.size(); i++)
+            queries[i] = rand() % n;
+        std::vector<int> removed( n / 10 );
+        for( int i = 0; i < removed.size(); i++)
+            removed[i] = rand() % n;
+
+        cout << " Elements: " << n << endl;
+        run< std::map<int, Payload> >( "std::map", n, queries, removed );
+        run< SlotMap<Payload> >( "SlotMap", n, queries, removed );
+    }
+    return 0;
+}